@@ -1,25 +1,522 @@
+/*
+ * Job table of the shell.
+ *
+ * SIGCHLD is blocked and delivered through a signalfd instead of an async
+ * handler. When it is readable the shell reaps with waitpid(-1, WNOHANG),
+ * which only returns children that actually changed state, and finds
+ * their job through a pid hash table.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
 #include "ProgramState.h"
+#include "joblimits.h"
+#include "trace.h"
+
+#define PID_REMOVED ((pid_t)-1)
+
+int init_state(ProgramState* pState)
+{
+    sigset_t mask;
+
+    memset(pState, 0, sizeof(*pState));
+    pState->shellPid = getpid();
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1){
+        return -1;
+    }
+    pState->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    return pState->sigfd == -1 ? -1 : 0;
+}
+
+static PidEntry* find_pid(ProgramState* pState, pid_t pid)
+{
+    if(pState->capPids == 0){
+        return NULL;
+    }
+    size_t mask = pState->capPids - 1;
+    for(size_t i = (size_t)pid & mask;; i = (i + 1) & mask){
+        PidEntry* e = &pState->pids[i];
+        if(e->pid == pid){
+            return e;
+        }
+        if(e->pid == 0){
+            return NULL;
+        }
+    }
+}
+
+static void insert_pid(ProgramState* pState, pid_t pid, Job* job, size_t index)
+{
+    size_t mask = pState->capPids - 1;
+    size_t i = (size_t)pid & mask;
+    while(pState->pids[i].pid > 0){
+        i = (i + 1) & mask;
+    }
+    if(pState->pids[i].pid == 0){
+        pState->usedPids++;
+    }
+    pState->pids[i].pid = pid;
+    pState->pids[i].job = job;
+    pState->pids[i].index = index;
+}
+
+static void grow_pids(ProgramState* pState)
+{
+    PidEntry* old = pState->pids;
+    size_t oldCap = pState->capPids;
+
+    pState->capPids = oldCap ? oldCap * 2 : 64;
+    pState->pids = calloc(pState->capPids, sizeof(PidEntry));
+    pState->usedPids = 0;
+    for(size_t i = 0; i < oldCap; i++){
+        if(old[i].pid > 0){
+            insert_pid(pState, old[i].pid, old[i].job, old[i].index);
+        }
+    }
+    free(old);
+}
+
+Job* add_job(ProgramState* pState, const char* cmdline, int background)
+{
+    int id = 1;
+    for(size_t i = 0; i < pState->numJobs; i++){
+        if(pState->jobs[i]->id >= id){
+            id = pState->jobs[i]->id + 1;
+        }
+    }
+    if(pState->numJobs == pState->capJobs){
+        pState->capJobs = pState->capJobs ? pState->capJobs * 2 : 16;
+        pState->jobs = realloc(pState->jobs, pState->capJobs * sizeof(Job*));
+    }
+    Job* job = calloc(1, sizeof(Job));
+    job->id = id;
+    job->state = JOB_RUNNING;
+    job->background = background;
+    job->cmdline = strdup(cmdline);
+    pState->jobs[pState->numJobs++] = job;
+    return job;
+}
+
+static ChildProcess* new_child(Job* job, pid_t cpid, const char* name)
+{
+    if(job->numChildren == job->capChildren){
+        job->capChildren = job->capChildren ? job->capChildren * 2 : 4;
+        job->children = realloc(job->children, job->capChildren * sizeof(ChildProcess));
+    }
+    ChildProcess* child = &job->children[job->numChildren];
+    memset(child, 0, sizeof(*child));
+    child->pid = cpid;
+    child->name = strdup(name);
+    child->started = monotonic_seconds();
+    return child;
+}
+
+void add_child(ProgramState* pState, Job* job, pid_t cpid, const char* name)
+{
+    new_child(job, cpid, name);
+
+    // Keep the table at most 70% full, removed slots included
+    if(pState->usedPids + 1 > pState->capPids * 7 / 10){
+        grow_pids(pState);
+    }
+    insert_pid(pState, cpid, job, job->numChildren);
+    job->numChildren++;
+    job->numAlive++;
+    // A job that keeps starting processes (parallel) may have run dry
+    job->state = JOB_RUNNING;
+}
+
+/*
+ * Stage run by the shell itself, it has no pid and is finished with
+ * finish_shell_stage instead of being reaped. Returns its index.
+ */
+size_t add_shell_stage(Job* job, const char* name)
+{
+    new_child(job, 0, name);
+    job->numAlive++;
+    return job->numChildren++;
+}
+
+void remove_job(ProgramState* pState, Job* job)
+{
+    for(size_t i = 0; i < job->numChildren; i++){
+        if(!job->children[i].terminated){
+            PidEntry* e = find_pid(pState, job->children[i].pid);
+            if(e != NULL){
+                e->pid = PID_REMOVED;
+            }
+        }
+    }
+    for(size_t i = 0; i < pState->numJobs; i++){
+        if(pState->jobs[i] == job){
+            memmove(&pState->jobs[i], &pState->jobs[i + 1], (pState->numJobs - i - 1) * sizeof(Job*));
+            pState->numJobs--;
+            break;
+        }
+    }
+    for(size_t i = 0; i < job->numChildren; i++){
+        free(job->children[i].name);
+    }
+    free(job->children);
+    free(job->cmdline);
+    // Empty by now, every stage has been reaped
+    joblimits_remove_group(job->cgroup);
+    free(job);
+}
+
+/*
+ * Job from a job spec: %n or n, %% or %+ or NULL for the most recent job
+ */
+Job* find_job(ProgramState* pState, const char* spec)
+{
+    if(pState->numJobs == 0){
+        return NULL;
+    }
+    if(spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0){
+        return pState->jobs[pState->numJobs - 1];
+    }
+    if(*spec == '%'){
+        spec++;
+    }
+    char* end;
+    long id = strtol(spec, &end, 10);
+    if(*spec == '\0' || *end != '\0'){
+        return NULL;
+    }
+    for(size_t i = 0; i < pState->numJobs; i++){
+        if(pState->jobs[i]->id == id){
+            return pState->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+Job* find_job_by_pid(ProgramState* pState, pid_t pid)
+{
+    PidEntry* e = pid > 0 ? find_pid(pState, pid) : NULL;
+    return e != NULL ? e->job : NULL;
+}
+
+/*
+ * Wait status of the job's last stage, the status of the whole job
+ */
+static int last_status(const Job* job)
+{
+    return job->lastStage >= 0 ? job->children[job->lastStage].status : W_EXITCODE(127, 0);
+}
+
+static void child_changed(Job* job, ChildProcess* child, int status)
+{
+    if(WIFSTOPPED(status)){
+        job->state = JOB_STOPPED;
+        job->notified = 0;
+        return;
+    }
+    if(WIFCONTINUED(status)){
+        job->state = JOB_RUNNING;
+        return;
+    }
+    child->terminated = 1;
+    child->status = status;
+    child->finished = monotonic_seconds();
+    trace_complete("stage", child->name, child->pid, child->started * 1e6, child->finished * 1e6);
+    if(--job->numAlive == 0){
+        job->state = JOB_DONE;
+        job->status = exit_status(last_status(job));
+        job->notified = 0;
+    }
+}
+
+void finish_shell_stage(Job* job, size_t index, int exitStatus, const struct rusage* usage)
+{
+    ChildProcess* child = &job->children[index];
+    child->usage = *usage;
+    child_changed(job, child, W_EXITCODE(exitStatus, 0));
+}
+
+/*
+ * Collect every child that has changed state, never blocks.
+ * Returns the number of state changes.
+ */
+int reap_children(ProgramState* pState)
+{
+    struct signalfd_siginfo info;
+    struct rusage usage;
+    int changes = 0;
+    int status;
+    pid_t pid;
+
+    // Several SIGCHLDs may have been merged into one, waitpid finds them all
+    while(read(pState->sigfd, &info, sizeof(info)) > 0);
+
+    while((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0){
+        PidEntry* e = find_pid(pState, pid);
+        if(e == NULL){
+            continue;
+        }
+        Job* job = e->job;
+        ChildProcess* child = &job->children[e->index];
+        if(!WIFSTOPPED(status) && !WIFCONTINUED(status)){
+            e->pid = PID_REMOVED;
+            child->usage = usage;
+        }
+        child_changed(job, child, status);
+        changes++;
+    }
+    return changes;
+}
 
 /*
-void add_child(ProgramState* pState, pid_t cpid)
+ * Wait until job has finished or been stopped, children of other jobs
+ * are reaped in the meantime. Returns the exit status of the job.
+ */
+int wait_job(ProgramState* pState, Job* job)
 {
-    for(size_t i = 0; i < MAX_PIPELEN; i++){
-        if(pState->foregroundChildren[i].terminated){
-            pState->foregroundChildren[i].pid = cpid;
-            pState->foregroundChildren[i].terminated = 0;
+    struct pollfd pfd = {.fd = pState->sigfd, .events = POLLIN};
+
+    pState->foregroundJob = job;
+    reap_children(pState);
+    while(job->state == JOB_RUNNING){
+        // Interrupted by Ctrl+C is fine, the children got it as well
+        if(poll(&pfd, 1, -1) == -1 && errno != EINTR){
             break;
         }
+        reap_children(pState);
+    }
+    pState->foregroundJob = NULL;
+
+    if(job->state == JOB_STOPPED){
+        job->background = 1;
+        return 128 + SIGTSTP;
     }
+    return job->status;
 }
 
-void terminate_child(ProgramState* pState, pid_t cpid)
+/*
+ * Wait until fewer than maxAlive processes of job are running, for
+ * runners that start the next process as soon as one exits. Returns -1
+ * if the job was stopped meanwhile.
+ */
+int wait_job_slot(ProgramState* pState, Job* job, size_t maxAlive)
 {
+    struct pollfd pfd = {.fd = pState->sigfd, .events = POLLIN};
 
-    for(size_t i = 0; i < MAX_PIPELEN; i++){
-        if(pState->foregroundChildren[i].pid == cpid){
-            pState->foregroundChildren[i].terminated = 1;
+    pState->foregroundJob = job;
+    reap_children(pState);
+    while(job->state == JOB_RUNNING && job->numAlive >= maxAlive){
+        int ready = poll(&pfd, 1, -1);
+        if(ready == -1 && errno != EINTR){
+            break;
+        }
+        reap_children(pState);
+        // Interrupted, maybe by Ctrl+C: the caller decides whether to go on
+        if(ready == -1){
             break;
         }
     }
+    pState->foregroundJob = NULL;
+    return job->state == JOB_STOPPED ? -1 : 0;
+}
+
+/*
+ * Send SIGCONT to every process of a stopped job
+ */
+int continue_job(Job* job)
+{
+    for(size_t i = 0; i < job->numChildren; i++){
+        ChildProcess* child = &job->children[i];
+        if(!child->terminated && child->pid > 0 && kill(child->pid, SIGCONT) == -1){
+            return -1;
+        }
+    }
+    job->state = JOB_RUNNING;
+    return 0;
+}
+
+/*
+ * Send sig to every live process of the job, -1 if none could be signalled
+ */
+int signal_job(Job* job, int sig)
+{
+    int sent = 0;
+    int err = ESRCH;
+    for(size_t c = 0; c < job->numChildren; c++){
+        if(!job->children[c].terminated && job->children[c].pid > 0){
+            if(kill(job->children[c].pid, sig) == 0){
+                sent = 1;
+            }
+            else {
+                err = errno;
+            }
+        }
+    }
+    if(!sent){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void signal_jobs(ProgramState* pState, int sig)
+{
+    for(size_t i = 0; i < pState->numJobs; i++){
+        signal_job(pState->jobs[i], sig);
+    }
+}
+
+static void print_job(Job* job, FILE* out)
+{
+    char state[64];
+    int status = last_status(job);
+
+    if(job->state == JOB_RUNNING){
+        snprintf(state, sizeof(state), "Running");
+    }
+    else if(job->state == JOB_STOPPED){
+        snprintf(state, sizeof(state), "Stopped");
+    }
+    else if(WIFSIGNALED(status)){
+        snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(status)));
+    }
+    else if(job->status != 0){
+        snprintf(state, sizeof(state), "Exit %d", job->status);
+    }
+    else {
+        snprintf(state, sizeof(state), "Done");
+    }
+    fprintf(out, "[%d]  %-24s%s\n", job->id, state, job->cmdline);
+}
+
+/*
+ * Report background jobs that finished or stopped since the last call and
+ * drop the finished ones. Nothing is printed if out is NULL.
+ */
+void notify_jobs(ProgramState* pState, FILE* out)
+{
+    for(size_t i = 0; i < pState->numJobs;){
+        Job* job = pState->jobs[i];
+        if(job->background && !job->notified && job->state != JOB_RUNNING){
+            if(out != NULL){
+                print_job(job, out);
+            }
+            job->notified = 1;
+            if(job->state == JOB_DONE){
+                remove_job(pState, job);
+                continue;
+            }
+        }
+        i++;
+    }
+}
+
+/*
+ * List all jobs (the jobs builtin), finished jobs are dropped afterwards
+ */
+void print_jobs(ProgramState* pState, FILE* out)
+{
+    for(size_t i = 0; i < pState->numJobs; i++){
+        print_job(pState->jobs[i], out);
+        pState->jobs[i]->notified = 1;
+    }
+    for(size_t i = 0; i < pState->numJobs;){
+        if(pState->jobs[i]->state == JOB_DONE){
+            remove_job(pState, pState->jobs[i]);
+            continue;
+        }
+        i++;
+    }
+}
+
+/*
+ * Exit status of a process from its wait status, 128 + signal if killed
+ */
+int exit_status(int waitStatus)
+{
+    if(WIFSIGNALED(waitStatus)){
+        return 128 + WTERMSIG(waitStatus);
+    }
+    return WEXITSTATUS(waitStatus);
+}
+
+double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv)
+{
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/*
+ * Wall time of the whole job, from the first spawn to the last exit
+ */
+static double job_wall(Job* job)
+{
+    double first = 0;
+    double last = 0;
+    for(size_t i = 0; i < job->numChildren; i++){
+        ChildProcess* child = &job->children[i];
+        if(i == 0 || child->started < first){
+            first = child->started;
+        }
+        if(child->finished > last){
+            last = child->finished;
+        }
+    }
+    return last > first ? last - first : 0;
+}
+
+/*
+ * One line per stage in pipeline order: wall, user and sys CPU, max RSS
+ * and voluntary/involuntary context switches. Used by the time builtin.
+ */
+void print_job_usage(Job* job, FILE* out)
+{
+    fprintf(out, "%-16s %9s %9s %9s %10s %8s %8s\n",
+            "stage", "real", "user", "sys", "maxrss", "vcsw", "ivcsw");
+    // children are in reverse pipeline order
+    for(size_t i = job->numChildren; i > 0; i--){
+        ChildProcess* child = &job->children[i - 1];
+        fprintf(out, "%-16.16s %8.3fs %8.3fs %8.3fs %9ldk %8ld %8ld\n",
+                child->name,
+                child->finished - child->started,
+                timeval_seconds(child->usage.ru_utime),
+                timeval_seconds(child->usage.ru_stime),
+                child->usage.ru_maxrss,
+                child->usage.ru_nvcsw,
+                child->usage.ru_nivcsw);
+    }
+}
+
+/*
+ * Single summary line of a finished job: totals, then wall time and max
+ * RSS of every stage so a slow stage stands out
+ */
+void print_job_summary(Job* job, FILE* out)
+{
+    double user = 0;
+    double sys = 0;
+    for(size_t i = 0; i < job->numChildren; i++){
+        user += timeval_seconds(job->children[i].usage.ru_utime);
+        sys += timeval_seconds(job->children[i].usage.ru_stime);
+    }
+    fprintf(out, "# %.3fs real %.3fs user %.3fs sys", job_wall(job), user, sys);
+    for(size_t i = job->numChildren; i > 0; i--){
+        ChildProcess* child = &job->children[i - 1];
+        fprintf(out, " | %s %.3fs %ldk", child->name, child->finished - child->started, child->usage.ru_maxrss);
+    }
+    fprintf(out, "\n");
 }
-*/
\ No newline at end of file
@@ -1,18 +1,81 @@
-#include <time.h>
+#ifndef PROGRAMSTATE_INC
+#define PROGRAMSTATE_INC
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef enum{
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
 
-#define MAX_PIPELEN 16
-/*
 typedef struct{
-    pid_t pid;
+    pid_t pid; // 0 for a stage run by the shell itself (cat, tee)
     int terminated;
+    int status; // Wait status once terminated
+    char* name; // argv[0] of the stage
+    double started; // Monotonic seconds at spawn
+    double finished; // Monotonic seconds when reaped
+    struct rusage usage; // From wait4 once terminated
 } ChildProcess;
-*/
+
+/*
+ * One command line, i.e. all processes of a pipeline
+ */
+typedef struct{
+    int id; // Number shown by jobs, used as %id
+    JobState state;
+    int background;
+    int notified; // State change has been reported to the user
+    int status; // Exit status of the last stage once done
+    ChildProcess* children; // In reverse pipeline order
+    long lastStage; // Index of the last stage in children, -1 if it couldn't be started
+    size_t numChildren;
+    size_t capChildren;
+    size_t numAlive;
+    char* cmdline;
+    char* cgroup; // Directory of the job's cgroup, NULL if it has none
+} Job;
+
+typedef struct{
+    pid_t pid; // 0 if never used, -1 if removed
+    Job* job;
+    size_t index;
+} PidEntry;
 
 typedef struct{
     pid_t shellPid;
-    pid_t foregroundChild;
+    Job* foregroundJob;
+    Job** jobs;
+    size_t numJobs;
+    size_t capJobs;
+    // pid -> child lookup, so reaping costs O(ready children)
+    PidEntry* pids;
+    size_t capPids;
+    size_t usedPids;
+    // Readable when a child changed state, SIGCHLD itself is blocked
+    int sigfd;
 } ProgramState;
-/*
-void add_child(ProgramState* pState, pid_t cpid);
-void terminate_child(ProgramState* pState, pid_t cpid);
-*/
\ No newline at end of file
+
+int init_state(ProgramState* pState);
+Job* add_job(ProgramState* pState, const char* cmdline, int background);
+void add_child(ProgramState* pState, Job* job, pid_t cpid, const char* name);
+size_t add_shell_stage(Job* job, const char* name);
+void finish_shell_stage(Job* job, size_t index, int exitStatus, const struct rusage* usage);
+void remove_job(ProgramState* pState, Job* job);
+Job* find_job(ProgramState* pState, const char* spec);
+Job* find_job_by_pid(ProgramState* pState, pid_t pid);
+int reap_children(ProgramState* pState);
+int wait_job(ProgramState* pState, Job* job);
+int wait_job_slot(ProgramState* pState, Job* job, size_t maxAlive);
+int continue_job(Job* job);
+int signal_job(Job* job, int sig);
+void signal_jobs(ProgramState* pState, int sig);
+void notify_jobs(ProgramState* pState, FILE* out);
+void print_jobs(ProgramState* pState, FILE* out);
+int exit_status(int waitStatus);
+double monotonic_seconds(void);
+void print_job_usage(Job* job, FILE* out);
+void print_job_summary(Job* job, FILE* out);
+#endif
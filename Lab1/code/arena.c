@@ -0,0 +1,165 @@
+/*
+ * Bump arena backing the parser.
+ *
+ * The shell reserves room for a whole line up front so the common case is
+ * one block that is reused for every command. A line that needs more gets
+ * extra blocks, on reset they are folded into one larger first block.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN (alignof(max_align_t))
+#define ARENA_MIN_BLOCK 4096
+
+static size_t align_up(size_t n)
+{
+  return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *new_block(size_t size)
+{
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  if (block == NULL)
+  {
+    abort();
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void arena_init(Arena *arena, size_t size)
+{
+  arena->head = new_block(size < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : size);
+  arena->current = arena->head;
+}
+
+/*
+ * Make sure the next size bytes can be allocated without a new block.
+ * On an empty arena the first block is resized instead, so a reserve
+ * before parsing keeps the arena at one allocation.
+ */
+void arena_reserve(Arena *arena, size_t size)
+{
+  ArenaBlock *cur = arena->current;
+  if (cur->size - cur->used >= size)
+  {
+    return;
+  }
+  if (cur == arena->head && cur->used == 0)
+  {
+    free(cur);
+    arena->head = arena->current = new_block(size);
+    return;
+  }
+  cur->next = new_block(size < cur->size * 2 ? cur->size * 2 : size);
+  arena->current = cur->next;
+}
+
+static void *bump(Arena *arena, size_t size)
+{
+  arena_reserve(arena, size);
+
+  ArenaBlock *cur = arena->current;
+  void *p = cur->data + cur->used;
+  cur->used += size;
+  return p;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+  ArenaBlock *cur = arena->current;
+  cur->used = align_up(cur->used);
+  if (cur->used > cur->size)
+  {
+    cur->used = cur->size;
+  }
+  return bump(arena, align_up(size));
+}
+
+/*
+ * Strings need no alignment and are packed back to back
+ */
+char *arena_strndup(Arena *arena, const char *s, size_t len)
+{
+  char *copy = bump(arena, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+/*
+ * Release everything allocated from the arena.
+ * O(1) unless the last line overflowed the first block.
+ */
+void arena_reset(Arena *arena)
+{
+  ArenaBlock *head = arena->head;
+  if (head->next != NULL)
+  {
+    size_t total = 0;
+    ArenaBlock *block = head;
+    while (block != NULL)
+    {
+      ArenaBlock *next = block->next;
+      total += block->size;
+      free(block);
+      block = next;
+    }
+    head = arena->head = new_block(total);
+  }
+  head->used = 0;
+  arena->current = head;
+}
+
+/*
+ * Remember the current position, for arena_release
+ */
+ArenaMark arena_mark(Arena *arena)
+{
+  ArenaMark mark = {0, arena->current->used};
+  for (ArenaBlock *block = arena->head; block != arena->current; block = block->next)
+  {
+    mark.block++;
+  }
+  return mark;
+}
+
+/*
+ * Drop everything allocated since mark was taken, so that a loop can
+ * allocate per iteration without growing the arena. The block is found
+ * by index because arena_reserve may have replaced an empty first block.
+ */
+void arena_release(Arena *arena, ArenaMark mark)
+{
+  ArenaBlock *block = arena->head;
+  for (size_t i = 0; i < mark.block && block->next != NULL; i++)
+  {
+    block = block->next;
+  }
+  ArenaBlock *extra = block->next;
+  while (extra != NULL)
+  {
+    ArenaBlock *next = extra->next;
+    free(extra);
+    extra = next;
+  }
+  block->next = NULL;
+  block->used = mark.used < block->used ? mark.used : block->used;
+  arena->current = block;
+}
+
+void arena_free(Arena *arena)
+{
+  ArenaBlock *block = arena->head;
+  while (block != NULL)
+  {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head = arena->current = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef ARENA_INC
+#define ARENA_INC
+#include <stdalign.h>
+#include <stddef.h>
+
+/*
+ * Bump allocator for everything that lives as long as one command line.
+ * Allocations are never freed one by one, arena_reset drops them all.
+ */
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) char data[];
+} ArenaBlock;
+
+typedef struct
+{
+  ArenaBlock *head;    // First block, kept across resets
+  ArenaBlock *current; // Block allocations are bumped from
+} Arena;
+
+/* A point in an arena that allocations can be rolled back to */
+typedef struct
+{
+  size_t block; /* Index of the block that was current */
+  size_t used;
+} ArenaMark;
+
+void arena_init(Arena *arena, size_t size);
+void arena_reserve(Arena *arena, size_t size);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+void arena_reset(Arena *arena);
+ArenaMark arena_mark(Arena *arena);
+void arena_release(Arena *arena, ArenaMark mark);
+void arena_free(Arena *arena);
+#endif
@@ -0,0 +1,948 @@
+/*
+ * Micro-benchmarks for the lsh hot paths.
+ *
+ * Usage: lsh_bench all
+ *        lsh_bench parse [lines]
+ *        lsh_bench lex [lines]
+ *        lsh_bench dispatch [lookups]
+ *        lsh_bench spawn [iterations] [heap MiB]
+ *        lsh_bench pipeline [iterations] [stages]
+ *        lsh_bench copy [MiB] [rounds]
+ *        lsh_bench pipesize [MiB]
+ *        lsh_bench glob [files]
+ *        lsh_bench history [lines]
+ *
+ * all:      every benchmark below with its defaults, to compare builds.
+ * parse:    command lines per second through parse, over a small corpus
+ *           of typical lines.
+ * lex:      checks nexttoken and isidentifier against the character at a
+ *           time lexer they replaced on the corpus and on random lines,
+ *           then compares their speed on a generated script.
+ * dispatch: cost of finding the builtin for a command name, builtins and
+ *           external commands mixed.
+ * spawn: latency of starting one pipeline stage (`true`) with every
+ *        spawn mode. The heap argument grows the benchmark's own heap
+ *        first, to show how fork cost scales with the size of the shell.
+ * pipeline: spawn and wait latency of a whole `true | true | ...` pipeline
+ *           with its pipes, the way setup_command_chain starts one.
+ * copy:  throughput of `cat file > file` and `cat file | wc -c` with an
+ *        external cat started by fork + exec against the zero-copy cat
+ *        builtin (see mover.h). The test file is created in TMPDIR.
+ * pipesize: throughput and context switches of `gen | filter | sink`
+ *           for several pipe capacities (see pipe_size_parse). The
+ *           stages are forked children that move data in 4 KiB writes,
+ *           like programs writing to a pipe through stdio.
+ * glob:  time to expand `*.log` in a directory of files, half of them
+ *        .log, read for the first time, again from the listing cache,
+ *        right after a file was added and with glob(3) for comparison.
+ *        The directory is created in TMPDIR and removed afterwards.
+ * history: startup cost of the history file (open and read the recent
+ *          lines), the first search that builds the trigram index, the
+ *          first search of another shell started afterwards that finds
+ *          it in the sidecar and the latency of later searches, against
+ *          a newest first memmem scan of every line like readline's
+ *          search. The files are created in TMPDIR and removed
+ *          afterwards.
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+#include "zygote.h"
+#include "pathcache.h"
+#include "mover.h"
+#include "parse.h"
+#include "builtin.h"
+#include "wildcard.h"
+#include "histfile.h"
+
+// Typical interactive lines, from a single word to a long pipeline
+static const char* corpus[] = {
+  "ls",
+  "ls -la /usr/share/doc",
+  "cd ..",
+  "grep -n main < lsh.c > matches.txt",
+  "cat access.log | grep GET | cut -d ' ' -f 7 | sort | uniq -c | sort -rn | head",
+  "make -j8 all &",
+  "echo hello world | tr a-z A-Z | rev",
+  "find . -name '*.c' | xargs wc -l",
+  "mkdir -p out && cd out || echo failed; ls",
+};
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+// Volatile sink, keeps the compiler from dropping benchmarked calls
+static volatile int sink;
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int bench_spawn(int iterations, size_t heapMiB)
+{
+  char* argv[] = {"true", NULL};
+  SpawnStage stage = {
+    .inFd = -1,
+    .outFd = -1,
+    .background = 0,
+  };
+  const SpawnMode modes[] = {SPAWN_POSIX, SPAWN_VFORK, SPAWN_FORK, SPAWN_ZYGOTE};
+  const char* path = pathcache_lookup(argv[0]);
+  if(path == NULL){
+    printf("true: command not found\n");
+    return 1;
+  }
+
+  // Forked while the heap is small, like lsh does at startup
+  if(zygote_start() == -1){
+    perror("zygote");
+    return 1;
+  }
+
+  // Touch every page so fork has something to copy
+  char* ballast = NULL;
+  if(heapMiB > 0){
+    ballast = malloc(heapMiB << 20);
+    if(ballast == NULL){
+      printf("Failed to allocate %zu MiB\n", heapMiB);
+      return 1;
+    }
+    memset(ballast, 1, heapMiB << 20);
+  }
+
+  printf("spawn: %d iterations, %zu MiB heap\n", iterations, heapMiB);
+  printf("%-12s %14s %14s\n", "mode", "spawn (us)", "spawn+wait (us)");
+  for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++){
+    double spawnTotal = 0;
+    double start = now_us();
+    for(int i = 0; i < iterations; i++){
+      double t0 = now_us();
+      pid_t pid = spawn_stage(modes[m], path, argv, &stage);
+      spawnTotal += now_us() - t0;
+      if(pid == -1){
+        perror("spawn");
+        free(ballast);
+        return 1;
+      }
+      waitpid(pid, NULL, 0);
+    }
+    double total = now_us() - start;
+    printf("%-12s %14.1f %14.1f\n", spawn_mode_name(modes[m]),
+           spawnTotal / iterations, total / iterations);
+  }
+  free(ballast);
+  return 0;
+}
+
+static int bench_parse(long lines)
+{
+  char* copies[CORPUS_SIZE];
+  size_t bytes = 0;
+  for(size_t i = 0; i < CORPUS_SIZE; i++){
+    copies[i] = strdup(corpus[i]);
+    bytes += strlen(corpus[i]) + 1;
+  }
+
+  Arena arena;
+  arena_init(&arena, 4096);
+  Command cmd;
+  double start = now_us();
+  for(long i = 0; i < lines; i++){
+    if(parse(copies[i % CORPUS_SIZE], &cmd, &arena) != 1){
+      printf("parse failed: %s\n", copies[i % CORPUS_SIZE]);
+      return 1;
+    }
+    sink = cmd.background;
+    arena_reset(&arena);
+  }
+  double us = now_us() - start;
+  arena_free(&arena);
+  for(size_t i = 0; i < CORPUS_SIZE; i++){
+    free(copies[i]);
+  }
+
+  double perLine = us / lines;
+  printf("parse: %ld lines\n", lines);
+  printf("%12.0f lines/s %10.1f MB/s %10.3f us/line\n",
+         1e6 / perLine, (double)bytes / CORPUS_SIZE / perLine, perLine);
+  return 0;
+}
+
+/*
+ * The lexer as it was before the class table, the reference for lex.
+ * Returns the length of the next token of s and its start in *tok.
+ */
+static int reference_nexttoken(char* s, char** tok, int* len)
+{
+  char* s0 = s;
+#define REF_ISSPEC(c) ((c) == '|' || (c) == '&' || (c) == '<' || (c) == '>' || (c) == ';')
+  while(isspace((unsigned char)*s)){
+    s++;
+  }
+  if(*s == '\0'){
+    *tok = NULL;
+    return 0;
+  }
+  char* start = s;
+  if(REF_ISSPEC(*s)){
+    if((*s == '|' || *s == '&') && s[1] == *s){
+      s++;
+    }
+    s++;
+  }
+  else {
+    while(*s != '\0' && !isspace((unsigned char)*s) && !REF_ISSPEC(*s)){
+      if(s[0] == '$' && s[1] == '('){
+        int depth = 0;
+        s++;
+        do {
+          depth += *s == '(';
+          depth -= *s == ')';
+          s++;
+        } while(*s != '\0' && depth > 0);
+        continue;
+      }
+      s++;
+    }
+  }
+#undef REF_ISSPEC
+  *tok = start;
+  *len = (int)(s - start);
+  return (int)(s - s0);
+}
+
+static int reference_isidentifier(const char* s)
+{
+  while(*s){
+    const char* p = strrchr("_-.,/~+", *s);
+    if(!isalnum((unsigned char)*s++) && p == NULL){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Tokens of line from both lexers must match. Returns 0 if they do.
+ */
+static int check_line(char* line, Arena* arena)
+{
+  char* s = line;
+  char* r = line;
+  for(;;){
+    char* tok;
+    char* refTok;
+    int refLen = 0;
+    int n = nexttoken(arena, s, &tok);
+    int refN = reference_nexttoken(r, &refTok, &refLen);
+    if(n != refN || (n > 0 && (strlen(tok) != (size_t)refLen || memcmp(tok, refTok, refLen) != 0))
+       || (n > 0 && !isidentifier(tok) != !reference_isidentifier(tok))){
+      printf("lex mismatch at offset %ld of \"%s\"\n", (long)(s - line), line);
+      return 1;
+    }
+    if(n == 0){
+      return 0;
+    }
+    s += n;
+    r += refN;
+  }
+}
+
+/*
+ * Random line over the characters the lexer treats specially, with long
+ * words now and then
+ */
+static void random_line(char* line, size_t max, unsigned* seed)
+{
+  static const char alphabet[] = " \t\n|&<>;$()aZ09_-.,/~+=*'\"\x01\x7f\xc3\xa9";
+  size_t len = (size_t)rand_r(seed) % max;
+  for(size_t i = 0; i < len; i++){
+    if(rand_r(seed) % 8 == 0){
+      line[i] = 'a' + rand_r(seed) % 26;
+    }
+    else {
+      line[i] = alphabet[rand_r(seed) % (sizeof(alphabet) - 1)];
+    }
+  }
+  line[len] = '\0';
+}
+
+static int bench_lex(long lines)
+{
+  Arena arena;
+  arena_init(&arena, 4096);
+  char line[512];
+  unsigned seed = 1;
+  long checked = 0;
+
+  // Every corpus line at every alignment, then random lines
+  for(size_t i = 0; i < CORPUS_SIZE; i++){
+    for(size_t shift = 0; shift < 32; shift++){
+      memset(line, 'x', shift);
+      strcpy(line + shift, corpus[i]);
+      if(check_line(line + shift, &arena) != 0){
+        return 1;
+      }
+      arena_reset(&arena);
+      checked++;
+    }
+  }
+  for(int i = 0; i < 200000; i++){
+    random_line(line, sizeof(line) - 1, &seed);
+    if(check_line(line, &arena) != 0){
+      return 1;
+    }
+    arena_reset(&arena);
+    checked++;
+  }
+  printf("lex: %ld lines match the reference lexer\n", checked);
+
+  // A generated script: the corpus plus lines with long paths and options
+  enum { SCRIPT_LINES = 256 };
+  char* script[SCRIPT_LINES];
+  size_t bytes = 0;
+  for(int i = 0; i < SCRIPT_LINES; i++){
+    char buf[512];
+    if(i % 2 == 0){
+      snprintf(buf, sizeof(buf), "%s", corpus[(size_t)i / 2 % CORPUS_SIZE]);
+    }
+    else {
+      snprintf(buf, sizeof(buf), "gcc -O2 -Wall -I/usr/local/include/project-%d/generated/headers "
+               "-c src/module_%d/implementation_file_%d.c -o build/objects/module_%d/object_%d.o"
+               " > logs/build_%d.log", i, i, i, i, i, i);
+    }
+    script[i] = strdup(buf);
+    bytes += strlen(buf) + 1;
+  }
+
+  double times[2];
+  for(int impl = 0; impl < 2; impl++){
+    double start = now_us();
+    for(long i = 0; i < lines; i++){
+      char* s = script[i % SCRIPT_LINES];
+      char* tok;
+      int len;
+      int n;
+      if(impl == 0){
+        while((n = nexttoken(&arena, s, &tok)) > 0){
+          sink = isidentifier(tok);
+          s += n;
+        }
+        arena_reset(&arena);
+      }
+      else {
+        while((n = reference_nexttoken(s, &tok, &len)) > 0){
+          // The reference copied into the arena as well
+          char* copy = arena_strndup(&arena, tok, (size_t)len);
+          sink = reference_isidentifier(copy);
+          s += n;
+        }
+        arena_reset(&arena);
+      }
+    }
+    times[impl] = now_us() - start;
+  }
+  for(int impl = 0; impl < 2; impl++){
+    double perLine = times[impl] / lines;
+    printf("%-10s %12.0f lines/s %10.1f MB/s %10.3f us/line\n", impl == 0 ? "table" : "reference",
+           1e6 / perLine, (double)bytes / SCRIPT_LINES / perLine, perLine);
+  }
+  for(int i = 0; i < SCRIPT_LINES; i++){
+    free(script[i]);
+  }
+  arena_free(&arena);
+  return 0;
+}
+
+static int bench_dispatch(long lookups)
+{
+  const char* names[] = {"ls", "cd", "grep", "exit", "echo", "cat", "[", "sort", "test", "printf"};
+  const size_t numNames = sizeof(names) / sizeof(names[0]);
+
+  double start = now_us();
+  for(long i = 0; i < lookups; i++){
+    sink = builtin_lookup(names[i % numNames]);
+  }
+  double us = now_us() - start;
+  printf("dispatch: %ld lookups\n", lookups);
+  printf("%12.1f ns/lookup\n", us * 1e3 / lookups);
+  return 0;
+}
+
+static int bench_pipeline(int iterations, int stages)
+{
+  char* argv[] = {"true", NULL};
+  const char* path = pathcache_lookup(argv[0]);
+  if(path == NULL){
+    printf("true: command not found\n");
+    return 1;
+  }
+  pid_t pids[stages];
+  int pipes[stages][2];
+
+  double start = now_us();
+  for(int i = 0; i < iterations; i++){
+    for(int p = 0; p < stages - 1; p++){
+      if(pipe2(pipes[p], O_CLOEXEC) == -1){
+        perror("pipe2");
+        return 1;
+      }
+    }
+    for(int p = 0; p < stages; p++){
+      SpawnStage stage = {
+        .inFd = p > 0 ? pipes[p - 1][0] : -1,
+        .outFd = p < stages - 1 ? pipes[p][1] : -1,
+        .background = 0,
+      };
+      pids[p] = spawn_stage(SPAWN_POSIX, path, argv, &stage);
+    }
+    for(int p = 0; p < stages - 1; p++){
+      close(pipes[p][0]);
+      close(pipes[p][1]);
+    }
+    for(int p = 0; p < stages; p++){
+      waitpid(pids[p], NULL, 0);
+    }
+  }
+  double us = now_us() - start;
+  printf("pipeline: %d iterations, %d stages\n", iterations, stages);
+  printf("%12.1f us/pipeline %10.1f us/stage\n", us / iterations, us / iterations / stages);
+  return 0;
+}
+
+/*
+ * Copy src to dst (or into a pipe read by `wc -c` if dst is -1) once,
+ * with an external cat or the mover. Returns the time taken in us.
+ */
+static double copy_once(int useMover, int src, int dst, const char* catPath, const char* wcPath)
+{
+  char* catArgv[] = {"cat", NULL};
+  char* wcArgv[] = {"wc", "-c", NULL};
+  int pipeFds[2] = {-1, -1};
+  pid_t wc = -1;
+  int out = dst;
+
+  lseek(src, 0, SEEK_SET);
+  if(dst >= 0){
+    ftruncate(dst, 0);
+    lseek(dst, 0, SEEK_SET);
+  }
+  double start = now_us();
+  if(dst < 0){
+    int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    pipe2(pipeFds, O_CLOEXEC);
+    SpawnStage sink = {.inFd = pipeFds[0], .outFd = devNull, .background = 0};
+    wc = spawn_stage(SPAWN_FORK, wcPath, wcArgv, &sink);
+    close(pipeFds[0]);
+    close(devNull);
+    out = pipeFds[1];
+  }
+  if(useMover){
+    if(move_fd(src, out) == -1){
+      perror("move_fd");
+    }
+  }
+  else {
+    SpawnStage stage = {.inFd = src, .outFd = out, .background = 0};
+    pid_t cat = spawn_stage(SPAWN_FORK, catPath, catArgv, &stage);
+    waitpid(cat, NULL, 0);
+  }
+  if(dst < 0){
+    close(pipeFds[1]);
+    waitpid(wc, NULL, 0);
+  }
+  return now_us() - start;
+}
+
+static int bench_copy(size_t sizeMiB, int rounds)
+{
+  const char* tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  char srcName[4096];
+  char dstName[4096];
+  snprintf(srcName, sizeof(srcName), "%s/lsh_bench_src_XXXXXX", tmp);
+  snprintf(dstName, sizeof(dstName), "%s/lsh_bench_dst_XXXXXX", tmp);
+
+  // Resolve both before creating files, nothing to clean up on failure
+  char catPath[4096];
+  char wcPath[4096];
+  const char* found = pathcache_lookup("cat");
+  if(found == NULL){
+    printf("cat: command not found\n");
+    return 1;
+  }
+  snprintf(catPath, sizeof(catPath), "%s", found);
+  found = pathcache_lookup("wc");
+  if(found == NULL){
+    printf("wc: command not found\n");
+    return 1;
+  }
+  snprintf(wcPath, sizeof(wcPath), "%s", found);
+
+  int src = mkstemp(srcName);
+  int dst = mkstemp(dstName);
+  if(src == -1 || dst == -1){
+    perror("mkstemp");
+    return 1;
+  }
+  unlink(srcName);
+  unlink(dstName);
+
+  char* block = malloc(1 << 20);
+  memset(block, 'x', 1 << 20);
+  for(size_t i = 0; i < sizeMiB; i++){
+    if(write(src, block, 1 << 20) != 1 << 20){
+      perror("write");
+      return 1;
+    }
+  }
+  free(block);
+
+  double bytes = (double)(sizeMiB << 20) * rounds;
+  printf("copy: %zu MiB, %d rounds\n", sizeMiB, rounds);
+  printf("%-24s %12s %12s\n", "case", "fork (GB/s)", "mover (GB/s)");
+  const char* names[] = {"cat file > file", "cat file | wc -c"};
+  for(int c = 0; c < 2; c++){
+    double us[2] = {0, 0};
+    for(int useMover = 0; useMover < 2; useMover++){
+      // One round to warm the page cache
+      copy_once(useMover, src, c == 0 ? dst : -1, catPath, wcPath);
+      for(int r = 0; r < rounds; r++){
+        us[useMover] += copy_once(useMover, src, c == 0 ? dst : -1, catPath, wcPath);
+      }
+    }
+    printf("%-24s %12.2f %12.2f\n", names[c], bytes / us[0] / 1e3, bytes / us[1] / 1e3);
+  }
+  close(src);
+  close(dst);
+  return 0;
+}
+
+// Write size of the pipesize stages, stdio's buffer for a pipe
+#define PIPE_CHUNK 4096
+
+static void gen_stage(int out, size_t bytes)
+{
+  char buf[PIPE_CHUNK];
+  memset(buf, 'x', sizeof(buf));
+  for(size_t done = 0; done < bytes; done += sizeof(buf)){
+    if(write(out, buf, sizeof(buf)) != (ssize_t)sizeof(buf)){
+      _exit(1);
+    }
+  }
+  _exit(0);
+}
+
+// Uppercases its input, touching every byte like a real filter
+static void filter_stage(int in, int out)
+{
+  char buf[PIPE_CHUNK];
+  ssize_t n;
+  while((n = read(in, buf, sizeof(buf))) > 0){
+    for(ssize_t i = 0; i < n; i++){
+      buf[i] = (char)toupper((unsigned char)buf[i]);
+    }
+    if(write(out, buf, (size_t)n) != n){
+      _exit(1);
+    }
+  }
+  _exit(n == 0 ? 0 : 1);
+}
+
+static void sink_stage(int in)
+{
+  char buf[PIPE_CHUNK];
+  while(read(in, buf, sizeof(buf)) > 0);
+  _exit(0);
+}
+
+static int bench_pipesize(size_t sizeMiB)
+{
+  const long sizes[] = {0, 16 << 10, 256 << 10, 1 << 20};
+  size_t bytes = sizeMiB << 20;
+
+  printf("pipesize: gen | filter | sink, %zu MiB\n", sizeMiB);
+  printf("%-10s %12s %12s %12s\n", "pipe", "MB/s", "switches", "per MiB");
+  for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+    int pipes[2][2];
+    int resized = 1;
+    for(int p = 0; p < 2; p++){
+      if(pipe2(pipes[p], O_CLOEXEC) == -1){
+        perror("pipe2");
+        return 1;
+      }
+      resized &= pipe_resize(pipes[p][1], sizes[s]) == 0;
+    }
+    char name[32];
+    if(sizes[s] == 0){
+      snprintf(name, sizeof(name), "default");
+    }
+    else {
+      snprintf(name, sizeof(name), "%ldk", sizes[s] >> 10);
+    }
+    if(!resized){
+      // Above /proc/sys/fs/pipe-max-size for this user
+      printf("%-10s %12s\n", name, "n/a");
+      for(int p = 0; p < 2; p++){
+        close(pipes[p][0]);
+        close(pipes[p][1]);
+      }
+      continue;
+    }
+
+    double start = now_us();
+    pid_t pids[3];
+    for(int stage = 0; stage < 3; stage++){
+      pids[stage] = fork();
+      if(pids[stage] == -1){
+        perror("fork");
+        return 1;
+      }
+      if(pids[stage] == 0){
+        // Keep only the stage's own ends, or no reader sees end of file
+        int in = stage > 0 ? pipes[stage - 1][0] : -1;
+        int out = stage < 2 ? pipes[stage][1] : -1;
+        for(int p = 0; p < 2; p++){
+          for(int end = 0; end < 2; end++){
+            if(pipes[p][end] != in && pipes[p][end] != out){
+              close(pipes[p][end]);
+            }
+          }
+        }
+        switch(stage){
+        case 0:
+          gen_stage(out, bytes);
+          break;
+        case 1:
+          filter_stage(in, out);
+          break;
+        default:
+          sink_stage(in);
+        }
+      }
+    }
+    for(int p = 0; p < 2; p++){
+      close(pipes[p][0]);
+      close(pipes[p][1]);
+    }
+    long switches = 0;
+    for(int stage = 0; stage < 3; stage++){
+      struct rusage usage;
+      wait4(pids[stage], NULL, 0, &usage);
+      switches += usage.ru_nvcsw + usage.ru_nivcsw;
+    }
+    double us = now_us() - start;
+    printf("%-10s %12.1f %12ld %12.1f\n", name, (double)bytes / us, switches,
+           (double)switches / (double)sizeMiB);
+  }
+  return 0;
+}
+
+/*
+ * us per wildcard_expand of pattern, averaged over rounds
+ */
+static double time_expand(const char* pattern, int rounds, size_t* count)
+{
+  Arena arena;
+  arena_init(&arena, 1 << 20);
+  double start = now_us();
+  for(int r = 0; r < rounds; r++){
+    wildcard_expand(pattern, &arena, count);
+    arena_reset(&arena);
+  }
+  double us = (now_us() - start) / rounds;
+  arena_free(&arena);
+  return us;
+}
+
+static int bench_glob(long files)
+{
+  const char* tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  char dir[4096];
+  snprintf(dir, sizeof(dir), "%s/lsh_bench_glob_XXXXXX", tmp);
+  if(mkdtemp(dir) == NULL){
+    perror("mkdtemp");
+    return 1;
+  }
+  int dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  char name[64];
+  for(long i = 0; i < files; i++){
+    snprintf(name, sizeof(name), "file%07ld.%s", i, i % 2 ? "log" : "txt");
+    int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fd == -1){
+      perror("openat");
+      return 1;
+    }
+    close(fd);
+  }
+  char pattern[4200];
+  snprintf(pattern, sizeof(pattern), "%s/*.log", dir);
+  // Listings of a directory changed in the last second aren't reused
+  sleep(1);
+
+  size_t count;
+  printf("glob: *.log in %ld files\n", files);
+  printf("%-24s %12s %12s\n", "case", "ms", "matches");
+  double cold = time_expand(pattern, 1, &count);
+  printf("%-24s %12.3f %12zu\n", "first", cold / 1e3, count);
+  double warm = time_expand(pattern, 20, &count);
+  printf("%-24s %12.3f %12zu\n", "cached", warm / 1e3, count);
+  int fd = openat(dirFd, "added.log", O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  close(fd);
+  double changed = time_expand(pattern, 1, &count);
+  printf("%-24s %12.3f %12zu\n", "after a change", changed / 1e3, count);
+  glob_t g;
+  double start = now_us();
+  glob(pattern, 0, NULL, &g);
+  double libc = now_us() - start;
+  printf("%-24s %12.3f %12zu\n", "glob(3)", libc / 1e3, g.gl_pathc);
+  globfree(&g);
+
+  for(long i = 0; i < files; i++){
+    snprintf(name, sizeof(name), "file%07ld.%s", i, i % 2 ? "log" : "txt");
+    unlinkat(dirFd, name, 0);
+  }
+  unlinkat(dirFd, "added.log", 0);
+  close(dirFd);
+  rmdir(dir);
+  return 0;
+}
+
+/*
+ * Newest line of text with query, the way a search of a list of lines
+ * without an index goes
+ */
+static const char* scan_lines(const char* text, size_t size, const char* query)
+{
+  size_t len = strlen(query);
+  size_t end = size - 1;
+  while(end > 0){
+    const char* nl = memrchr(text, '\n', end);
+    size_t start = nl != NULL ? (size_t)(nl - text) + 1 : 0;
+    if(memmem(text + start, end - start, query, len) != NULL){
+      return text + start;
+    }
+    end = start > 0 ? start - 1 : 0;
+  }
+  return NULL;
+}
+
+static int bench_history(long lines)
+{
+  static const char* words[] = {"git status", "git commit -m fix", "make -j8", "ls -la", "cd src",
+                                "grep -rn TODO .", "vim main.c", "ssh build", "cat log | wc -l", "./run --fast"};
+  const char* tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/lsh_bench_history_XXXXXX", tmp);
+  int fd = mkstemp(path);
+  if(fd == -1){
+    perror("mkstemp");
+    return 1;
+  }
+  FILE* f = fdopen(fd, "w");
+  unsigned seed = 1;
+  for(long i = 0; i < lines; i++){
+    seed = seed * 1103515245 + 12345;
+    fprintf(f, "%s %s%05u\n", words[(seed >> 16) % 10], "arg", (seed >> 8) % 50000);
+  }
+  fclose(f);
+  setenv("LSH_HISTFILE", path, 1);
+
+  printf("history: %ld lines\n", lines);
+  printf("%-24s %12s\n", "case", "us");
+  fflush(stdout);
+  // Another shell started once the index exists, it shares the sidecar
+  int ready[2];
+  if(pipe2(ready, O_CLOEXEC) == -1){
+    perror("pipe2");
+    return 1;
+  }
+  pid_t other = fork();
+  if(other == 0){
+    char c;
+    close(ready[1]);
+    if(read(ready[0], &c, 1) != 1){
+      _exit(1);
+    }
+    double start = now_us();
+    size_t size;
+    histfile_open();
+    histfile_tail(1000, &size);
+    printf("%-24s %12.1f\n", "open, other shell", now_us() - start);
+    start = now_us();
+    sink += (int)histfile_search("arg01234", -1);
+    printf("%-24s %12.1f\n", "first search, other", now_us() - start);
+    fflush(stdout);
+    _exit(0);
+  }
+  close(ready[0]);
+  double start = now_us();
+  size_t size;
+  histfile_open();
+  histfile_tail(1000, &size);
+  printf("%-24s %12.1f\n", "open + 1000 recent", now_us() - start);
+  start = now_us();
+  long first = histfile_search("arg01234", -1);
+  printf("%-24s %12.1f\n", "first search (index)", now_us() - start);
+  fflush(stdout);
+  if(other > 0){
+    if(write(ready[1], "x", 1) == 1){
+      waitpid(other, NULL, 0);
+    }
+  }
+  close(ready[1]);
+
+  static const char* queries[][2] = {{"rare", "arg01234"}, {"common", "git commit"}, {"two bytes", "ls"}};
+  const int rounds = 1000;
+  for(size_t q = 0; q < 3; q++){
+    start = now_us();
+    for(int r = 0; r < rounds; r++){
+      sink += (int)histfile_search(queries[q][1], -1);
+    }
+    printf("%-24s %12.2f\n", queries[q][0], (now_us() - start) / rounds);
+  }
+  // Ctrl-R through every match of a rare query
+  start = now_us();
+  int matches = 0;
+  for(long id = first; id != -1; id = histfile_search("arg01234", id)){
+    matches++;
+  }
+  printf("%-24s %12.2f (%d matches)\n", "every match, rare", now_us() - start, matches);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  off_t fileSize = lseek(fd, 0, SEEK_END);
+  char* text = malloc((size_t)fileSize);
+  size = (size_t)pread(fd, text, (size_t)fileSize, 0);
+  close(fd);
+  start = now_us();
+  for(int r = 0; r < 10; r++){
+    sink += scan_lines(text, size, "arg01234") != NULL;
+  }
+  printf("%-24s %12.2f\n", "scan, rare", (now_us() - start) / 10);
+  free(text);
+  unlink(path);
+  strcat(path, ".idx");
+  unlink(path);
+  return 0;
+}
+
+static void usage(void)
+{
+  printf("usage: lsh_bench all\n");
+  printf("       lsh_bench parse [lines]\n");
+  printf("       lsh_bench lex [lines]\n");
+  printf("       lsh_bench dispatch [lookups]\n");
+  printf("       lsh_bench spawn [iterations] [heap MiB]\n");
+  printf("       lsh_bench pipeline [iterations] [stages]\n");
+  printf("       lsh_bench copy [MiB] [rounds]\n");
+  printf("       lsh_bench pipesize [MiB]\n");
+  printf("       lsh_bench glob [files]\n");
+  printf("       lsh_bench history [lines]\n");
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2){
+    usage();
+    return 1;
+  }
+  if(strcmp(argv[1], "all") == 0){
+    int failed = bench_parse(1000000);
+    failed |= bench_lex(1000000);
+    failed |= bench_dispatch(10000000);
+    failed |= bench_spawn(500, 0);
+    failed |= bench_pipeline(200, 4);
+    failed |= bench_copy(64, 5);
+    failed |= bench_pipesize(256);
+    failed |= bench_glob(100000);
+    failed |= bench_history(100000);
+    return failed;
+  }
+  if(strcmp(argv[1], "parse") == 0){
+    long lines = argc > 2 ? atol(argv[2]) : 1000000;
+    if(lines <= 0){
+      usage();
+      return 1;
+    }
+    return bench_parse(lines);
+  }
+  if(strcmp(argv[1], "lex") == 0){
+    long lines = argc > 2 ? atol(argv[2]) : 1000000;
+    if(lines <= 0){
+      usage();
+      return 1;
+    }
+    return bench_lex(lines);
+  }
+  if(strcmp(argv[1], "dispatch") == 0){
+    long lookups = argc > 2 ? atol(argv[2]) : 10000000;
+    if(lookups <= 0){
+      usage();
+      return 1;
+    }
+    return bench_dispatch(lookups);
+  }
+  if(strcmp(argv[1], "pipeline") == 0){
+    int iterations = argc > 2 ? atoi(argv[2]) : 500;
+    int stages = argc > 3 ? atoi(argv[3]) : 4;
+    if(iterations <= 0 || stages <= 0){
+      usage();
+      return 1;
+    }
+    return bench_pipeline(iterations, stages);
+  }
+  if(strcmp(argv[1], "spawn") == 0){
+    int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+    size_t heapMiB = argc > 3 ? (size_t)atol(argv[3]) : 0;
+    if(iterations <= 0){
+      usage();
+      return 1;
+    }
+    return bench_spawn(iterations, heapMiB);
+  }
+  if(strcmp(argv[1], "copy") == 0){
+    size_t sizeMiB = argc > 2 ? (size_t)atol(argv[2]) : 256;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if(sizeMiB == 0 || rounds <= 0){
+      usage();
+      return 1;
+    }
+    return bench_copy(sizeMiB, rounds);
+  }
+  if(strcmp(argv[1], "pipesize") == 0){
+    size_t sizeMiB = argc > 2 ? (size_t)atol(argv[2]) : 1024;
+    if(sizeMiB == 0){
+      usage();
+      return 1;
+    }
+    return bench_pipesize(sizeMiB);
+  }
+  if(strcmp(argv[1], "glob") == 0){
+    long files = argc > 2 ? atol(argv[2]) : 100000;
+    if(files <= 0){
+      usage();
+      return 1;
+    }
+    return bench_glob(files);
+  }
+  if(strcmp(argv[1], "history") == 0){
+    long lines = argc > 2 ? atol(argv[2]) : 100000;
+    if(lines <= 0){
+      usage();
+      return 1;
+    }
+    return bench_history(lines);
+  }
+  usage();
+  return 1;
+}
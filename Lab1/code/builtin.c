@@ -0,0 +1,857 @@
+/*
+ * Builtin registry and the builtins that don't need the shell's state.
+ *
+ * Every command line used to go through a chain of strcmp calls, one per
+ * handler, and echo or test forked and exec'd a program for a few bytes
+ * of output. The names now hash straight to their slot: the hash of each
+ * name is computed by the compiler in the table's designated initializers,
+ * and two names on the same slot fail the build. A lookup is one hash and
+ * one strcmp.
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "builtin.h"
+#include "cwd.h"
+#include "histfile.h"
+
+// Two builtins on the same slot would silently replace one another
+#pragma GCC diagnostic error "-Woverride-init"
+
+#define BUILTIN_SLOTS 64
+// First and last character and length of a name, picked so that every
+// builtin gets its own slot
+#define BUILTIN_HASH(first, last, len) \
+  (((unsigned)(first) + 3u * (unsigned)(last) + 5u * (unsigned)(len)) & (BUILTIN_SLOTS - 1))
+#define SLOT(name, first, last) [BUILTIN_HASH(first, last, sizeof(name) - 1)]
+
+static int builtin_echo(char** argv, FILE* out);
+static int builtin_pwd(char** argv, FILE* out);
+static int builtin_true(char** argv, FILE* out);
+static int builtin_false(char** argv, FILE* out);
+static int builtin_test(char** argv, FILE* out);
+static int builtin_printf(char** argv, FILE* out);
+static int builtin_ulimit(char** argv, FILE* out);
+static int builtin_history(char** argv, FILE* out);
+
+static const Builtin table[BUILTIN_SLOTS] = {
+  SLOT("exit", 'e', 't') = {"exit", BUILTIN_EXIT, NULL},
+  SLOT("cd", 'c', 'd') = {"cd", BUILTIN_CD, NULL},
+  SLOT("hash", 'h', 'h') = {"hash", BUILTIN_HASH, NULL},
+  SLOT("jobs", 'j', 's') = {"jobs", BUILTIN_JOBS, NULL},
+  SLOT("fg", 'f', 'g') = {"fg", BUILTIN_FG, NULL},
+  SLOT("bg", 'b', 'g') = {"bg", BUILTIN_BG, NULL},
+  SLOT("wait", 'w', 't') = {"wait", BUILTIN_WAIT, NULL},
+  SLOT("kill", 'k', 'l') = {"kill", BUILTIN_KILL, NULL},
+  SLOT("parallel", 'p', 'l') = {"parallel", BUILTIN_PARALLEL, NULL},
+  SLOT("set", 's', 't') = {"set", BUILTIN_SET, NULL},
+  SLOT("export", 'e', 't') = {"export", BUILTIN_EXPORT, NULL},
+  SLOT("unset", 'u', 't') = {"unset", BUILTIN_UNSET, NULL},
+  SLOT("break", 'b', 'k') = {"break", BUILTIN_BREAK, NULL},
+  SLOT("continue", 'c', 'e') = {"continue", BUILTIN_CONTINUE, NULL},
+  SLOT("return", 'r', 'n') = {"return", BUILTIN_RETURN, NULL},
+  SLOT("echo", 'e', 'o') = {"echo", BUILTIN_ECHO, builtin_echo},
+  SLOT("pwd", 'p', 'd') = {"pwd", BUILTIN_PWD, builtin_pwd},
+  SLOT("true", 't', 'e') = {"true", BUILTIN_TRUE, builtin_true},
+  SLOT("false", 'f', 'e') = {"false", BUILTIN_FALSE, builtin_false},
+  SLOT("test", 't', 't') = {"test", BUILTIN_TEST, builtin_test},
+  SLOT("[", '[', '[') = {"[", BUILTIN_TEST, builtin_test},
+  SLOT("printf", 'p', 'f') = {"printf", BUILTIN_PRINTF, builtin_printf},
+  SLOT("ulimit", 'u', 't') = {"ulimit", BUILTIN_ULIMIT, builtin_ulimit},
+  SLOT("history", 'h', 'y') = {"history", BUILTIN_HISTORY, builtin_history},
+};
+
+/*
+ * Builtin called name, NULL if there is none
+ */
+const Builtin* builtin_find(const char* name)
+{
+  size_t len = strlen(name);
+  if(len == 0){
+    return NULL;
+  }
+  const Builtin* b = &table[BUILTIN_HASH(name[0], name[len - 1], len)];
+  if(b->name == NULL || strcmp(b->name, name) != 0){
+    return NULL;
+  }
+  return b;
+}
+
+BuiltinId builtin_lookup(const char* name)
+{
+  const Builtin* b = builtin_find(name);
+  return b != NULL ? b->id : BUILTIN_NONE;
+}
+
+/*
+ * Entry point of a builtin in a forked pipeline stage, see spawn_call
+ */
+int builtin_main(char** argv)
+{
+  const Builtin* b = builtin_find(argv[0]);
+  if(b == NULL || b->fn == NULL){
+    return 127;
+  }
+  int status = b->fn(argv, stdout);
+  fflush(stdout);
+  return status;
+}
+
+/*
+ * Print the backslash escape at s (s[0] is the backslash), returns the
+ * number of characters used. *stop is set by \c, which ends all output.
+ * inPrintf: octal escapes are \NNN as in printf formats, else \0NNN.
+ */
+static size_t print_escape(const char* s, FILE* out, int inPrintf, int* stop)
+{
+  const char* p = s + 1;
+  int c;
+  switch(*p){
+  case 'a': c = '\a'; break;
+  case 'b': c = '\b'; break;
+  case 'e': c = 033; break;
+  case 'f': c = '\f'; break;
+  case 'n': c = '\n'; break;
+  case 'r': c = '\r'; break;
+  case 't': c = '\t'; break;
+  case 'v': c = '\v'; break;
+  case '\\': c = '\\'; break;
+  case 'c':
+    *stop = 1;
+    return 2;
+  case 'x': {
+    c = 0;
+    int digits = 0;
+    while(digits < 2 && isxdigit((unsigned char)p[1])){
+      p++;
+      c = c * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+      digits++;
+    }
+    if(digits == 0){
+      fputs("\\x", out);
+      return 2;
+    }
+    fputc(c, out);
+    return (size_t)(p - s) + 1;
+  }
+  case '\0':
+    fputc('\\', out);
+    return 1;
+  default:
+    if(*p >= '0' && *p <= '7' && (inPrintf || *p == '0')){
+      // \0NNN for echo, \NNN for printf
+      int maxDigits = 3;
+      if(!inPrintf){
+        p++;
+      }
+      else {
+        p--;
+      }
+      c = 0;
+      while(maxDigits-- > 0 && p[1] >= '0' && p[1] <= '7'){
+        p++;
+        c = c * 8 + (*p - '0');
+      }
+      fputc(c, out);
+      return (size_t)(p - s) + 1;
+    }
+    // Unknown escapes are printed as they are
+    fputc('\\', out);
+    fputc(*p, out);
+    return 2;
+  }
+  fputc(c, out);
+  return 2;
+}
+
+/*
+ * echo [-neE] [arg ...], the options of GNU echo
+ */
+static int builtin_echo(char** argv, FILE* out)
+{
+  int newline = 1;
+  int escapes = 0;
+  int i = 1;
+
+  for(; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    if(strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)){
+      break;
+    }
+    for(const char* f = argv[i] + 1; *f != '\0'; f++){
+      if(*f == 'n'){
+        newline = 0;
+      }
+      else {
+        escapes = *f == 'e';
+      }
+    }
+  }
+  for(int first = i; argv[i] != NULL; i++){
+    if(i > first){
+      fputc(' ', out);
+    }
+    if(!escapes){
+      fputs(argv[i], out);
+      continue;
+    }
+    for(const char* s = argv[i]; *s != '\0';){
+      if(*s != '\\'){
+        fputc(*s++, out);
+        continue;
+      }
+      int stop = 0;
+      s += print_escape(s, out, 0, &stop);
+      if(stop){
+        return 0;
+      }
+    }
+  }
+  if(newline){
+    fputc('\n', out);
+  }
+  return 0;
+}
+
+/*
+ * pwd [-L | -P]: the tracked path, or the physical one with -P
+ */
+static int builtin_pwd(char** argv, FILE* out)
+{
+  int physical = 0;
+  for(int i = 1; argv[i] != NULL; i++){
+    if(strcmp(argv[i], "-P") == 0){
+      physical = 1;
+    }
+    else if(strcmp(argv[i], "-L") == 0){
+      physical = 0;
+    }
+    else {
+      fprintf(stderr, "pwd: %s: invalid option\n", argv[i]);
+      return 2;
+    }
+  }
+  if(!physical){
+    fprintf(out, "%s\n", cwd_path());
+    return 0;
+  }
+  char* real = getcwd(NULL, 0);
+  if(real == NULL){
+    fprintf(stderr, "pwd: %s\n", strerror(errno));
+    return 1;
+  }
+  fprintf(out, "%s\n", real);
+  free(real);
+  return 0;
+}
+
+static int builtin_true(char** argv, FILE* out)
+{
+  (void)argv;
+  (void)out;
+  return 0;
+}
+
+static int builtin_false(char** argv, FILE* out)
+{
+  (void)argv;
+  (void)out;
+  return 1;
+}
+
+/*
+ * Expression parser of test: a cursor over the arguments and the error
+ * flag, set for bad syntax or a non-integer to -eq and friends
+ */
+typedef struct
+{
+  char** args;
+  int pos;
+  int count;
+  int error;
+} TestParser;
+
+static int test_or(TestParser* t);
+
+static const char* test_peek(TestParser* t, int ahead)
+{
+  return t->pos + ahead < t->count ? t->args[t->pos + ahead] : NULL;
+}
+
+static int is_binary_op(const char* op)
+{
+  static const char* ops[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                              "-nt", "-ot", "-ef", NULL};
+  for(int i = 0; op != NULL && ops[i] != NULL; i++){
+    if(strcmp(op, ops[i]) == 0){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int is_unary_op(const char* op)
+{
+  return op != NULL && op[0] == '-' && op[1] != '\0' && op[2] == '\0'
+    && strchr("bcdefghkLnprsStuwxz", op[1]) != NULL;
+}
+
+static long long test_integer(TestParser* t, const char* s)
+{
+  char* end;
+  errno = 0;
+  long long n = strtoll(s, &end, 10);
+  while(*end == ' ' || *end == '\t'){
+    end++;
+  }
+  if(*s == '\0' || *end != '\0' || errno == ERANGE){
+    fprintf(stderr, "test: %s: integer expression expected\n", s);
+    t->error = 1;
+  }
+  return n;
+}
+
+static int test_unary(char op, const char* arg)
+{
+  struct stat st;
+  switch(op){
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 't':
+    return isatty(atoi(arg));
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  case 'r':
+    return access(arg, R_OK) == 0;
+  case 'w':
+    return access(arg, W_OK) == 0;
+  case 'x':
+    return access(arg, X_OK) == 0;
+  }
+  if(stat(arg, &st) != 0){
+    return 0;
+  }
+  switch(op){
+  case 'b': return S_ISBLK(st.st_mode);
+  case 'c': return S_ISCHR(st.st_mode);
+  case 'd': return S_ISDIR(st.st_mode);
+  case 'f': return S_ISREG(st.st_mode);
+  case 'g': return (st.st_mode & S_ISGID) != 0;
+  case 'k': return (st.st_mode & S_ISVTX) != 0;
+  case 'p': return S_ISFIFO(st.st_mode);
+  case 's': return st.st_size > 0;
+  case 'S': return S_ISSOCK(st.st_mode);
+  case 'u': return (st.st_mode & S_ISUID) != 0;
+  default: return 1; // -e
+  }
+}
+
+static int test_binary(TestParser* t, const char* a, const char* op, const char* b)
+{
+  if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0){
+    return strcmp(a, b) == 0;
+  }
+  if(strcmp(op, "!=") == 0){
+    return strcmp(a, b) != 0;
+  }
+  if(op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')){
+    struct stat sa;
+    struct stat sb;
+    int okA = stat(a, &sa) == 0;
+    int okB = stat(b, &sb) == 0;
+    if(strcmp(op, "-ef") == 0){
+      return okA && okB && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+    if(strcmp(op, "-nt") == 0){
+      return okA && (!okB || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+                     || (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+    }
+    return okB && (!okA || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec
+                   || (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+  }
+  long long x = test_integer(t, a);
+  long long y = test_integer(t, b);
+  if(strcmp(op, "-eq") == 0) return x == y;
+  if(strcmp(op, "-ne") == 0) return x != y;
+  if(strcmp(op, "-lt") == 0) return x < y;
+  if(strcmp(op, "-le") == 0) return x <= y;
+  if(strcmp(op, "-gt") == 0) return x > y;
+  return x >= y;
+}
+
+static int test_primary(TestParser* t)
+{
+  const char* arg = test_peek(t, 0);
+  if(arg == NULL){
+    fprintf(stderr, "test: argument expected\n");
+    t->error = 1;
+    return 0;
+  }
+  // A binary operator wins, so that `[ -n = -n ]` compares strings
+  if(is_binary_op(test_peek(t, 1)) && test_peek(t, 2) != NULL){
+    t->pos += 3;
+    return test_binary(t, arg, t->args[t->pos - 2], t->args[t->pos - 1]);
+  }
+  if(strcmp(arg, "(") == 0 && test_peek(t, 1) != NULL){
+    t->pos++;
+    int value = test_or(t);
+    const char* close = test_peek(t, 0);
+    if(close == NULL || strcmp(close, ")") != 0){
+      fprintf(stderr, "test: ')' expected\n");
+      t->error = 1;
+      return 0;
+    }
+    t->pos++;
+    return value;
+  }
+  if(is_unary_op(arg) && test_peek(t, 1) != NULL){
+    t->pos += 2;
+    return test_unary(arg[1], t->args[t->pos - 1]);
+  }
+  t->pos++;
+  return arg[0] != '\0';
+}
+
+static int test_not(TestParser* t)
+{
+  const char* arg = test_peek(t, 0);
+  if(arg != NULL && strcmp(arg, "!") == 0 && test_peek(t, 1) != NULL){
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static int test_and(TestParser* t)
+{
+  int value = test_not(t);
+  while(test_peek(t, 0) != NULL && strcmp(test_peek(t, 0), "-a") == 0){
+    t->pos++;
+    // Both sides are parsed, errors in the right one are still reported
+    int right = test_not(t);
+    value = value && right;
+  }
+  return value;
+}
+
+static int test_or(TestParser* t)
+{
+  int value = test_and(t);
+  while(test_peek(t, 0) != NULL && strcmp(test_peek(t, 0), "-o") == 0){
+    t->pos++;
+    int right = test_and(t);
+    value = value || right;
+  }
+  return value;
+}
+
+/*
+ * test expr and [ expr ]. Exit status 0 if true, 1 if false, 2 on error.
+ */
+static int builtin_test(char** argv, FILE* out)
+{
+  (void)out;
+  int count = 0;
+  while(argv[count + 1] != NULL){
+    count++;
+  }
+  if(strcmp(argv[0], "[") == 0){
+    if(count == 0 || strcmp(argv[count], "]") != 0){
+      fprintf(stderr, "[: missing ']'\n");
+      return 2;
+    }
+    count--;
+  }
+  if(count == 0){
+    return 1;
+  }
+
+  TestParser t = {.args = argv + 1, .pos = 0, .count = count, .error = 0};
+  int value = test_or(&t);
+  if(!t.error && t.pos < t.count){
+    fprintf(stderr, "test: %s: unexpected argument\n", t.args[t.pos]);
+    t.error = 1;
+  }
+  if(t.error){
+    return 2;
+  }
+  return value ? 0 : 1;
+}
+
+/*
+ * Numeric argument of printf, 'c gives the code of c like in other shells
+ */
+static int printf_number(const char* arg, long long* value, unsigned long long* uvalue)
+{
+  if(arg[0] == '\'' || arg[0] == '"'){
+    *value = (unsigned char)arg[1];
+    *uvalue = (unsigned char)arg[1];
+    return 0;
+  }
+  char* end;
+  errno = 0;
+  if(arg[0] == '-'){
+    *value = strtoll(arg, &end, 0);
+    *uvalue = (unsigned long long)*value;
+  }
+  else {
+    *uvalue = strtoull(arg, &end, 0);
+    *value = (long long)*uvalue;
+  }
+  if(*arg != '\0' && (*end != '\0' || errno == ERANGE)){
+    fprintf(stderr, "printf: %s: invalid number\n", arg);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * One pass over the format. Returns 1 if arguments were used, *status is
+ * set to 1 for a bad argument and *stop by \c.
+ */
+static int printf_format(const char* format, char*** args, FILE* out, int* status, int* stop)
+{
+  int used = 0;
+  for(const char* f = format; *f != '\0' && !*stop;){
+    if(*f == '\\'){
+      f += print_escape(f, out, 1, stop);
+      continue;
+    }
+    if(*f != '%'){
+      fputc(*f++, out);
+      continue;
+    }
+    if(f[1] == '%'){
+      fputc('%', out);
+      f += 2;
+      continue;
+    }
+
+    // Copy the conversion spec, *s become numbers from the arguments
+    char spec[64];
+    size_t len = 0;
+    spec[len++] = *f++;
+    while(*f != '\0' && strchr("-+ #0", *f) != NULL && len < 20){
+      spec[len++] = *f++;
+    }
+    for(int part = 0; part < 2; part++){
+      if(*f == '*'){
+        long long n = 0;
+        unsigned long long un;
+        if(**args != NULL){
+          *status |= printf_number(*(*args)++, &n, &un);
+          used = 1;
+        }
+        len += (size_t)snprintf(spec + len, sizeof(spec) - len, "%d", (int)n);
+        f++;
+      }
+      else {
+        while(isdigit((unsigned char)*f) && len < 40){
+          spec[len++] = *f++;
+        }
+      }
+      if(part == 0 && *f == '.'){
+        spec[len++] = *f++;
+      }
+      else if(part == 0){
+        break;
+      }
+    }
+
+    char conv = *f;
+    if(conv == '\0' || strchr("diouxXcsbeEfFgGaA", conv) == NULL){
+      fprintf(stderr, "printf: %%%c: invalid directive\n", conv ? conv : ' ');
+      *status = 1;
+      return used;
+    }
+    f++;
+    const char* arg = **args != NULL ? *(*args)++ : NULL;
+    used |= arg != NULL;
+
+    switch(conv){
+    case 'd':
+    case 'i': {
+      long long n = 0;
+      unsigned long long un;
+      if(arg != NULL){
+        *status |= printf_number(arg, &n, &un);
+      }
+      strcpy(spec + len, "ll");
+      spec[len + 2] = conv;
+      spec[len + 3] = '\0';
+      fprintf(out, spec, n);
+      break;
+    }
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+      long long n;
+      unsigned long long un = 0;
+      if(arg != NULL){
+        *status |= printf_number(arg, &n, &un);
+      }
+      strcpy(spec + len, "ll");
+      spec[len + 2] = conv;
+      spec[len + 3] = '\0';
+      fprintf(out, spec, un);
+      break;
+    }
+    case 'c':
+      spec[len] = 'c';
+      spec[len + 1] = '\0';
+      fprintf(out, spec, arg != NULL && arg[0] != '\0' ? arg[0] : '\0');
+      break;
+    case 's':
+      spec[len] = 's';
+      spec[len + 1] = '\0';
+      fprintf(out, spec, arg != NULL ? arg : "");
+      break;
+    case 'b':
+      // Escapes in the argument, field width and precision are ignored
+      for(const char* s = arg != NULL ? arg : ""; *s != '\0' && !*stop;){
+        if(*s == '\\'){
+          s += print_escape(s, out, 0, stop);
+        }
+        else {
+          fputc(*s++, out);
+        }
+      }
+      break;
+    default: {
+      double d = 0;
+      if(arg != NULL){
+        char* end;
+        d = strtod(arg, &end);
+        if(*end != '\0'){
+          fprintf(stderr, "printf: %s: invalid number\n", arg);
+          *status = 1;
+        }
+      }
+      spec[len] = conv;
+      spec[len + 1] = '\0';
+      fprintf(out, spec, d);
+    }
+    }
+  }
+  return used;
+}
+
+/*
+ * printf format [arguments], the format is reused while arguments remain
+ */
+static int builtin_printf(char** argv, FILE* out)
+{
+  if(argv[1] == NULL){
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    return 2;
+  }
+  char** args = argv + 2;
+  int status = 0;
+  int stop = 0;
+  int used;
+  do {
+    used = printf_format(argv[1], &args, out, &status, &stop);
+  } while(used && *args != NULL && !stop);
+  return status;
+}
+
+typedef struct
+{
+  char option;
+  int resource;
+  rlim_t unit; // Bytes per unit shown, 1 for counts and seconds
+  const char* name;
+} UlimitResource;
+
+// The resources of bash's ulimit that Linux has, in the order of ulimit -a
+static const UlimitResource ulimitResources[] = {
+  {'c', RLIMIT_CORE, 1024, "core file size (kbytes)"},
+  {'d', RLIMIT_DATA, 1024, "data seg size (kbytes)"},
+  {'e', RLIMIT_NICE, 1, "scheduling priority"},
+  {'f', RLIMIT_FSIZE, 1024, "file size (kbytes)"},
+  {'i', RLIMIT_SIGPENDING, 1, "pending signals"},
+  {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (kbytes)"},
+  {'m', RLIMIT_RSS, 1024, "max memory size (kbytes)"},
+  {'n', RLIMIT_NOFILE, 1, "open files"},
+  {'q', RLIMIT_MSGQUEUE, 1, "POSIX message queues (bytes)"},
+  {'r', RLIMIT_RTPRIO, 1, "real-time priority"},
+  {'s', RLIMIT_STACK, 1024, "stack size (kbytes)"},
+  {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+  {'u', RLIMIT_NPROC, 1, "max user processes"},
+  {'v', RLIMIT_AS, 1024, "virtual memory (kbytes)"},
+};
+#define ULIMIT_COUNT (sizeof(ulimitResources) / sizeof(ulimitResources[0]))
+
+static const UlimitResource* ulimit_resource(char option)
+{
+  for(size_t r = 0; r < ULIMIT_COUNT; r++){
+    if(ulimitResources[r].option == option){
+      return &ulimitResources[r];
+    }
+  }
+  return NULL;
+}
+
+static void print_limit(FILE* out, const UlimitResource* r, rlim_t value, int withName)
+{
+  if(withName){
+    fprintf(out, "%-30s(-%c) ", r->name, r->option);
+  }
+  if(value == RLIM_INFINITY){
+    fprintf(out, "unlimited\n");
+  }
+  else {
+    fprintf(out, "%llu\n", (unsigned long long)(value / r->unit));
+  }
+}
+
+// Changes with every limit ulimit sets, see builtin_limits_generation
+static unsigned limitsGeneration;
+
+/*
+ * Changes whenever ulimit changes the shell's limits, so that a process
+ * started before (the zygote) can tell whether it still has them
+ */
+unsigned builtin_limits_generation(void)
+{
+  return limitsGeneration;
+}
+
+/*
+ * ulimit [-SH] [-a | -resource [limit]], like bash. The limits are the
+ * shell's own, so they hold for every command started after them. Without
+ * -S or -H both the soft and the hard limit are set and the soft one is
+ * shown.
+ */
+static int builtin_ulimit(char** argv, FILE* out)
+{
+  int soft = 0;
+  int hard = 0;
+  int all = 0;
+  const UlimitResource* resource = NULL;
+  int i = 1;
+  for(; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    for(const char* o = argv[i] + 1; *o != '\0'; o++){
+      if(*o == 'S'){
+        soft = 1;
+      }
+      else if(*o == 'H'){
+        hard = 1;
+      }
+      else if(*o == 'a'){
+        all = 1;
+      }
+      else {
+        resource = ulimit_resource(*o);
+        if(resource == NULL){
+          fprintf(stderr, "ulimit: -%c: invalid option\n", *o);
+          fprintf(stderr, "ulimit: usage: ulimit [-SH] [-a | -cdefilmnqrstuv [limit]]\n");
+          return 2;
+        }
+      }
+    }
+  }
+  if(all){
+    for(size_t r = 0; r < ULIMIT_COUNT; r++){
+      struct rlimit limit;
+      if(getrlimit(ulimitResources[r].resource, &limit) == 0){
+        print_limit(out, &ulimitResources[r], hard ? limit.rlim_max : limit.rlim_cur, 1);
+      }
+    }
+    return 0;
+  }
+  if(resource == NULL){
+    resource = ulimit_resource('f');
+  }
+  struct rlimit limit;
+  if(getrlimit(resource->resource, &limit) == -1){
+    fprintf(stderr, "ulimit: %s\n", strerror(errno));
+    return 1;
+  }
+  if(argv[i] == NULL){
+    print_limit(out, resource, hard && !soft ? limit.rlim_max : limit.rlim_cur, 0);
+    return 0;
+  }
+
+  rlim_t value;
+  if(strcmp(argv[i], "unlimited") == 0){
+    value = RLIM_INFINITY;
+  }
+  else if(strcmp(argv[i], "hard") == 0){
+    value = limit.rlim_max;
+  }
+  else if(strcmp(argv[i], "soft") == 0){
+    value = limit.rlim_cur;
+  }
+  else {
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(argv[i], &end, 10);
+    if(end == argv[i] || *end != '\0' || argv[i][0] == '-' || errno != 0
+       || n > RLIM_INFINITY / resource->unit){
+      fprintf(stderr, "ulimit: %s: invalid number\n", argv[i]);
+      return 1;
+    }
+    value = (rlim_t)n * resource->unit;
+  }
+  if(!soft && !hard){
+    soft = hard = 1;
+  }
+  if(soft){
+    limit.rlim_cur = value;
+  }
+  if(hard){
+    limit.rlim_max = value;
+  }
+  if(setrlimit(resource->resource, &limit) == -1){
+    fprintf(stderr, "ulimit: %s: cannot modify limit: %s\n", resource->name, strerror(errno));
+    return 1;
+  }
+  limitsGeneration++;
+  return 0;
+}
+
+/*
+ * history [pattern]: the numbered lines of the history file, every shell's,
+ * or only those containing pattern. Status 1 if there are none.
+ */
+static int builtin_history(char** argv, FILE* out)
+{
+  const char* pattern = argv[1] != NULL ? argv[1] : "";
+  if(argv[1] != NULL && argv[2] != NULL){
+    fprintf(stderr, "history: usage: history [pattern]\n");
+    return 2;
+  }
+  if(histfile_open() == -1){
+    fprintf(stderr, "history: no history file\n");
+    return 1;
+  }
+  // Searches go newest first, the lines are printed oldest first
+  size_t count = 0;
+  size_t cap = 64;
+  long* ids = malloc(cap * sizeof(long));
+  for(long id = histfile_search(pattern, -1); id != -1; id = histfile_search(pattern, id)){
+    if(count == cap){
+      cap *= 2;
+      ids = realloc(ids, cap * sizeof(long));
+    }
+    ids[count++] = id;
+  }
+  for(size_t i = count; i-- > 0;){
+    size_t len;
+    const char* line = histfile_line(ids[i], &len);
+    fprintf(out, "%5ld  %.*s\n", ids[i] + 1, (int)len, line);
+  }
+  free(ids);
+  return count > 0 ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#ifndef BUILTIN_INC
+#define BUILTIN_INC
+#include <stdio.h>
+
+/*
+ * Commands the shell runs itself, found through a perfect hash table
+ * (builtin.c).
+ *
+ * Builtins with a function (echo, test, ...) run in the shell when they
+ * are a whole command line, and in a forked child without an exec when
+ * they are part of a pipeline. The others change the state of the shell
+ * and are dispatched by run_command to their handlers: jobs.c,
+ * settings.c, parallel.c, script.c for break, continue and return, and
+ * lsh.c for the rest.
+ */
+typedef enum
+{
+  BUILTIN_NONE, // Not a builtin, run it from PATH
+  BUILTIN_EXIT,
+  BUILTIN_CD,
+  BUILTIN_HASH,
+  BUILTIN_JOBS,
+  BUILTIN_FG,
+  BUILTIN_BG,
+  BUILTIN_WAIT,
+  BUILTIN_KILL,
+  BUILTIN_PARALLEL,
+  BUILTIN_SET,
+  BUILTIN_EXPORT,
+  BUILTIN_UNSET,
+  BUILTIN_BREAK,
+  BUILTIN_CONTINUE,
+  BUILTIN_RETURN,
+  BUILTIN_ECHO,
+  BUILTIN_PWD,
+  BUILTIN_TRUE,
+  BUILTIN_FALSE,
+  BUILTIN_TEST,
+  BUILTIN_PRINTF,
+  BUILTIN_ULIMIT,
+  BUILTIN_HISTORY
+} BuiltinId;
+
+// Runs the builtin with its output going to out, returns the exit status
+typedef int (*BuiltinFn)(char** argv, FILE* out);
+
+typedef struct
+{
+  const char* name;
+  BuiltinId id;
+  BuiltinFn fn; // NULL for builtins with a handler of their own
+} Builtin;
+
+const Builtin* builtin_find(const char* name);
+BuiltinId builtin_lookup(const char* name);
+int builtin_main(char** argv);
+unsigned builtin_limits_generation(void);
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Cached working directory and prompt.
+ *
+ * The prompt used to call getcwd into a 1 KiB buffer before every line.
+ * Now the path is only computed by cd, kept in PWD for the children, and
+ * the prompt string is rebuilt when the path has changed. Showing a
+ * prompt makes no syscall.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cwd.h"
+#include "vars.h"
+
+static char* path = NULL;
+static char* prompt = NULL;
+static int promptValid = 0;
+
+static void set_path(char* newPath)
+{
+  free(path);
+  path = newPath;
+  promptValid = 0;
+  vars_export("PWD", path);
+}
+
+/*
+ * Absolute path dir relative to base with ".", ".." and repeated slashes
+ * removed without looking at the file system. The caller frees it.
+ */
+static char* logical_join(const char* base, const char* dir)
+{
+  size_t size = strlen(base) + strlen(dir) + 3;
+  char* out = malloc(size);
+  size_t len = 0;
+  const char* parts[2] = {dir[0] == '/' ? "" : base, dir};
+
+  out[len++] = '/';
+  for(int p = 0; p < 2; p++){
+    const char* s = parts[p];
+    while(*s != '\0'){
+      while(*s == '/'){
+        s++;
+      }
+      const char* end = strchrnul(s, '/');
+      size_t n = (size_t)(end - s);
+      if(n == 0 || (n == 1 && s[0] == '.')){
+        // Nothing to add
+      }
+      else if(n == 2 && s[0] == '.' && s[1] == '.'){
+        while(len > 1 && out[len - 1] != '/'){
+          len--;
+        }
+        if(len > 1){
+          len--;
+        }
+      }
+      else {
+        if(len > 1){
+          out[len++] = '/';
+        }
+        memcpy(out + len, s, n);
+        len += n;
+      }
+      s = end;
+    }
+  }
+  out[len] = '\0';
+  return out;
+}
+
+/*
+ * Take PWD from the environment if it really names the current directory,
+ * otherwise ask the kernel
+ */
+void cwd_init(void)
+{
+  const char* pwd = getenv("PWD");
+  struct stat fromEnv;
+  struct stat dot;
+
+  if(pwd != NULL && pwd[0] == '/' && stat(pwd, &fromEnv) == 0 && stat(".", &dot) == 0
+     && fromEnv.st_dev == dot.st_dev && fromEnv.st_ino == dot.st_ino){
+    set_path(logical_join("/", pwd));
+    return;
+  }
+  char* real = getcwd(NULL, 0);
+  set_path(real != NULL ? real : strdup("."));
+}
+
+const char* cwd_path(void)
+{
+  if(path == NULL){
+    cwd_init();
+  }
+  return path;
+}
+
+/*
+ * chdir to dir and update the tracked path. Returns -1 with errno set if
+ * the directory could not be entered.
+ */
+int cwd_change(const char* dir)
+{
+  char* logical = logical_join(cwd_path(), dir);
+  if(chdir(logical) == 0){
+    set_path(logical);
+    return 0;
+  }
+  free(logical);
+
+  // The logical path may not exist, e.g. ".." out of a removed directory
+  if(chdir(dir) == -1){
+    return -1;
+  }
+  char* real = getcwd(NULL, 0);
+  if(real == NULL){
+    return -1;
+  }
+  set_path(real);
+  return 0;
+}
+
+/*
+ * The prompt: '$', the last two components of the path and "> ", e.g.
+ * "$/repo/Lab1> ", or "$home> " for a shorter path. Rebuilt only when
+ * the path or PWD has changed.
+ */
+const char* cwd_prompt(void)
+{
+  // PWD may have been assigned by the user, show what it says
+  const char* pwd = getenv("PWD");
+  if(path == NULL){
+    cwd_init();
+  }
+  else if(pwd != NULL && strcmp(pwd, path) != 0){
+    free(path);
+    path = strdup(pwd);
+    promptValid = 0;
+  }
+  if(promptValid){
+    return prompt;
+  }
+
+  size_t len = strlen(path);
+  const char* tail = len > 0 ? path + 1 : path;
+  int numSlashes = 0;
+  for(const char* p = path + len; p > path; p--){
+    if(*p == '/' && ++numSlashes == 2){
+      tail = p;
+      break;
+    }
+  }
+  free(prompt);
+  prompt = malloc(strlen(tail) + 4);
+  prompt[0] = '$';
+  strcpy(prompt + 1, tail);
+  strcat(prompt, "> ");
+  promptValid = 1;
+  return prompt;
+}
@@ -0,0 +1,14 @@
+#ifndef CWD_INC
+#define CWD_INC
+
+/*
+ * Working directory tracked by the shell instead of asked for with
+ * getcwd, and the prompt built from it. The path is logical like in
+ * bash: cd follows the path as typed, so `cd link/..` returns to where
+ * it started.
+ */
+void cwd_init(void);
+const char* cwd_path(void);
+int cwd_change(const char* dir);
+const char* cwd_prompt(void);
+#endif
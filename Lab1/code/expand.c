@@ -0,0 +1,350 @@
+/*
+ * Expansion of command words, see expand.h.
+ *
+ * A word without a '$' is only split and globbed. In one with a '$' the
+ * parameters and $(...) are replaced first, a $(...) by running its
+ * commands with their output going to a Capture instead of stdout: a
+ * builtin writes to it through a memory stream, the last stage of a
+ * pipeline through a pipe the shell drains (see setup_command_chain).
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expand.h"
+#include "lsh.h"
+#include "interrupt.h"
+#include "script.h"
+#include "vars.h"
+#include "wildcard.h"
+
+Capture* shell_capture = NULL;
+char** shell_positional = NULL;
+int shell_positionalCount = 0;
+
+static void capture_reserve(Capture* c, size_t extra)
+{
+  if(c->len + extra <= c->cap){
+    return;
+  }
+  size_t cap = c->cap ? c->cap : 4096;
+  while(cap < c->len + extra){
+    cap *= 2;
+  }
+  c->data = realloc(c->data, cap);
+  c->cap = cap;
+}
+
+void capture_append(Capture* c, const char* data, size_t len)
+{
+  capture_reserve(c, len);
+  memcpy(c->data + c->len, data, len);
+  c->len += len;
+}
+
+/*
+ * Append everything read from fd until end of file or Ctrl+C
+ */
+void capture_read(Capture* c, int fd)
+{
+  for(;;){
+    capture_reserve(c, 16384);
+    ssize_t n = read(fd, c->data + c->len, c->cap - c->len);
+    if(n > 0){
+      c->len += (size_t)n;
+    }
+    else if(n == 0 || errno != EINTR || shell_interrupted){
+      return;
+    }
+  }
+}
+
+/*
+ * Run the commands of a $(...) and append their output to out, without
+ * the trailing newlines
+ */
+static void run_substitution(char* text, Arena* arena, Capture* out)
+{
+  Command inner;
+  int plain = script_plain(text);
+  if(plain && parse(text, &inner, arena) != 1){
+    printf("Parse ERROR\n");
+    return;
+  }
+  size_t start = out->len;
+  Capture* outer = shell_capture;
+  shell_capture = out;
+  if(plain){
+    run_list(&inner, arena);
+  }
+  else if(script_run(text, arena) != 1){
+    printf("Parse ERROR\n");
+  }
+  shell_capture = outer;
+  while(out->len > start && out->data[out->len - 1] == '\n'){
+    out->len--;
+  }
+}
+
+/*
+ * Append word to *argv, growing it in the arena like acmd
+ */
+static void append_word(Arena* arena, char* word, char*** argv, size_t* argc, size_t* cap)
+{
+  // Keep room for the terminating NULL
+  if(*argc + 1 >= *cap){
+    char** grown = arena_alloc(arena, 2 * *cap * sizeof(char*));
+    memcpy(grown, *argv, *argc * sizeof(char*));
+    *argv = grown;
+    *cap *= 2;
+  }
+  (*argv)[(*argc)++] = word;
+}
+
+/*
+ * Append to *argv the words of text. A word with wildcards is replaced by
+ * the paths it matches, if there are any, otherwise it loses the
+ * backslashes that escape wildcards.
+ */
+static void split_words(Arena* arena, const char* text, size_t len,
+                        char*** argv, size_t* argc, size_t* cap)
+{
+  size_t i = 0;
+  while(i < len){
+    while(i < len && isspace((unsigned char)text[i])){
+      i++;
+    }
+    size_t start = i;
+    while(i < len && !isspace((unsigned char)text[i])){
+      i++;
+    }
+    if(i == start){
+      break;
+    }
+    char* word = arena_strndup(arena, text + start, i - start);
+    size_t count = 0;
+    char** matches = wildcard_has(word) ? wildcard_expand(word, arena, &count) : NULL;
+    if(matches == NULL){
+      wildcard_unescape(word);
+      append_word(arena, word, argv, argc, cap);
+    }
+    for(size_t m = 0; m < count; m++){
+      append_word(arena, matches[m], argv, argc, cap);
+    }
+  }
+}
+
+/*
+ * Append to word the value of the parameter named at s, just after a
+ * '$': a name, {name}, a digit, #, @, * or ?. Returns the characters of
+ * s it used, 0 if there is no parameter and the '$' stays.
+ */
+static size_t expand_parameter(const char* s, Capture* word)
+{
+  char number[32];
+  const char* value = NULL;
+  size_t used = 1;
+  if(*s >= '1' && *s <= '9'){
+    value = *s - '0' <= shell_positionalCount ? shell_positional[*s - '1'] : NULL;
+  }
+  else if(*s == '#' || *s == '?'){
+    snprintf(number, sizeof(number), "%d", *s == '#' ? shell_positionalCount : shell_status);
+    value = number;
+  }
+  else if(*s == '@' || *s == '*'){
+    for(int i = 0; i < shell_positionalCount; i++){
+      capture_append(word, " ", i > 0);
+      capture_append(word, shell_positional[i], strlen(shell_positional[i]));
+    }
+  }
+  else if(*s == '{'){
+    const char* close = strchr(s, '}');
+    if(close == NULL || !vars_valid_name(s + 1, (size_t)(close - s - 1))){
+      return 0;
+    }
+    value = vars_get(s + 1, (size_t)(close - s - 1));
+    used = (size_t)(close - s) + 1;
+  }
+  else {
+    used = 0;
+    while(isalnum((unsigned char)s[used]) || s[used] == '_'){
+      used++;
+    }
+    if(!vars_valid_name(s, used)){
+      return 0;
+    }
+    value = vars_get(s, used);
+  }
+  if(value != NULL){
+    capture_append(word, value, strlen(value));
+  }
+  return used;
+}
+
+/*
+ * Expand the $name parameters and $(...) of words, the commands inside a
+ * $(...) are run and replaced by their output. The results are split into
+ * words at whitespace, a word that expands to nothing disappears and one
+ * with wildcards becomes the paths it matches. With assignments the
+ * NAME=value words at the start are kept whole.
+ * Returns the new NULL-terminated list, NULL on an unterminated $(.
+ */
+char** expand_words(char** words, int assignments, Arena* arena, size_t* count)
+{
+  size_t argc = 0;
+  size_t cap = 8;
+  char** argv = arena_alloc(arena, cap * sizeof(char*));
+  for(char** arg = words; *arg != NULL; arg++){
+    const char* s = *arg;
+    assignments = assignments && isassignment(s);
+    if(strchr(s, '$') == NULL){
+      if(assignments){
+        append_word(arena, *arg, &argv, &argc, &cap);
+      }
+      else {
+        split_words(arena, s, strlen(s), &argv, &argc, &cap);
+      }
+      continue;
+    }
+    Capture word = {NULL, 0, 0};
+    while(*s != '\0'){
+      if(s[0] != '$'){
+        capture_append(&word, s++, 1);
+        continue;
+      }
+      if(s[1] != '('){
+        size_t used = expand_parameter(s + 1, &word);
+        if(used == 0){
+          capture_append(&word, s, 1);
+        }
+        s += 1 + used;
+        continue;
+      }
+      int depth = 1;
+      const char* end = s + 2;
+      for(; *end != '\0'; end++){
+        depth += *end == '(';
+        depth -= *end == ')';
+        if(depth == 0){
+          break;
+        }
+      }
+      if(*end == '\0'){
+        printf("lsh: unterminated $(\n");
+        free(word.data);
+        return NULL;
+      }
+      char* text = arena_strndup(arena, s + 2, (size_t)(end - s - 2));
+      run_substitution(text, arena, &word);
+      s = end + 1;
+    }
+    if(assignments){
+      append_word(arena, arena_strndup(arena, word.data, word.len), &argv, &argc, &cap);
+    }
+    else {
+      split_words(arena, word.data, word.len, &argv, &argc, &cap);
+    }
+    free(word.data);
+  }
+  argv[argc] = NULL;
+  *count = argc;
+  return argv;
+}
+
+/*
+ * Expand the arguments of every command of cmd that has a '$' or a
+ * wildcard in one, the tokenizer has flagged them with PGM_EXPAND.
+ * Returns -1 on an unterminated $(.
+ */
+int expand_substitutions(Command* cmd, Arena* arena)
+{
+  for(Pgm* pgm = cmd->pgm; pgm != NULL; pgm = pgm->next){
+    if(!(pgm->flags & PGM_EXPAND)){
+      continue;
+    }
+    size_t argc;
+    char** argv = expand_words(pgm->pgmlist, pgm->flags & PGM_ASSIGN, arena, &argc);
+    if(argv == NULL){
+      return -1;
+    }
+    pgm->pgmlist = argv;
+    // An empty stage of a pipeline passes nothing on, like true
+    if(argc == 0 && (pgm != cmd->pgm || pgm->next != NULL)){
+      static char* empty[] = {"true", NULL};
+      pgm->pgmlist = empty;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Remove the NAME=value words from the front of pgm. Without a command
+ * after them they set shell variables, unless pgm is a stage of a
+ * pipeline. Otherwise they are exported for the command only: the
+ * variables' old values go to *saved for restore_vars and their count is
+ * returned.
+ */
+size_t take_assignments(Pgm* pgm, int pipeline, SavedVar** saved)
+{
+  char** argv = pgm->pgmlist;
+  size_t count = 0;
+  while(argv[count] != NULL && isassignment(argv[count])){
+    count++;
+  }
+  pgm->pgmlist = argv + count;
+  *saved = NULL;
+  if(argv[count] == NULL && pipeline){
+    static char* empty[] = {"true", NULL};
+    pgm->pgmlist = empty;
+    return 0;
+  }
+  if(argv[count] == NULL){
+    for(size_t i = 0; i < count; i++){
+      size_t len = (size_t)(strchr(argv[i], '=') - argv[i]);
+      char* name = strndup(argv[i], len);
+      vars_set(name, argv[i] + len + 1);
+      free(name);
+    }
+    return 0;
+  }
+  *saved = malloc(count * sizeof(SavedVar));
+  for(size_t i = 0; i < count; i++){
+    size_t len = (size_t)(strchr(argv[i], '=') - argv[i]);
+    SavedVar* v = &(*saved)[i];
+    v->name = strndup(argv[i], len);
+    const char* value = vars_get(v->name, len);
+    v->value = value != NULL ? strdup(value) : NULL;
+    v->exported = vars_exported(v->name);
+    vars_export(v->name, argv[i] + len + 1);
+  }
+  return count;
+}
+
+/*
+ * Put back the variables take_assignments exported for a command
+ */
+void restore_vars(SavedVar* saved, size_t count)
+{
+  // Backwards, so a name given twice gets its first old value
+  for(size_t i = count; i-- > 0;){
+    SavedVar* v = &saved[i];
+    if(v->value == NULL || !v->exported){
+      vars_unset(v->name);
+    }
+    if(v->value != NULL){
+      if(v->exported){
+        vars_export(v->name, v->value);
+      }
+      else {
+        vars_set(v->name, v->value);
+      }
+    }
+    free(v->name);
+    free(v->value);
+  }
+  free(saved);
+}
@@ -0,0 +1,43 @@
+#ifndef EXPAND_INC
+#define EXPAND_INC
+#include <stddef.h>
+
+#include "arena.h"
+#include "parse.h"
+
+/*
+ * Expansion of the words of a command before it runs (expand.c): $name
+ * and the other parameters, $(...) with the output of the commands in
+ * it, splitting at whitespace and wildcards. Also the NAME=value words
+ * in front of a command.
+ */
+
+// Growable buffer for the output of a $(...) and for input lines
+typedef struct
+{
+  char* data;
+  size_t len;
+  size_t cap;
+} Capture;
+
+// A variable exported for one command by a NAME=value in front of it
+typedef struct
+{
+  char* name;
+  char* value; // Before the command, NULL if it was unset
+  int exported;
+} SavedVar;
+
+// Output of the commands run for a $(...) goes here, NULL otherwise
+extern Capture* shell_capture;
+// $1, $2, ... of the function or script being run
+extern char** shell_positional;
+extern int shell_positionalCount;
+
+void capture_append(Capture* c, const char* data, size_t len);
+void capture_read(Capture* c, int fd);
+char** expand_words(char** words, int assignments, Arena* arena, size_t* count);
+int expand_substitutions(Command* cmd, Arena* arena);
+size_t take_assignments(Pgm* pgm, int pipeline, SavedVar** saved);
+void restore_vars(SavedVar* saved, size_t count);
+#endif
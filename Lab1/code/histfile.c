@@ -0,0 +1,591 @@
+/*
+ * Persistent history, see histfile.h.
+ *
+ * The file is plain text, a line per command. It is mapped with room to
+ * grow, lines appended later by this or another shell show up in the
+ * mapping and only a file larger than the mapping needs a new one. A
+ * partial line at the end, a write still in progress, is left alone.
+ *
+ * The index lives in a sidecar file next to it (<history>.idx), mapped
+ * MAP_SHARED by every shell. It holds the offset of every line and, for
+ * every trigram (three consecutive bytes) of the lines, the ascending
+ * numbers of the lines that have it. A query of three or more bytes can
+ * only match lines that have all of its trigrams, so only the lines of
+ * its rarest trigram are compared with it, newest first.
+ *
+ * Whoever appends a line, or finds lines that aren't indexed yet, indexes
+ * them under an exclusive flock of the sidecar; searches hold a shared
+ * one. So opening the index and every search cost O(lines appended since
+ * the index was last brought up to date, by any shell), the whole file is
+ * only indexed when the sidecar is new. The sidecar only grows: the
+ * trigram table is an open addressing hash table that is copied to a new
+ * place when it fills up, the lines of a trigram are a chain of blocks of
+ * growing size, newest block first. An index that doesn't match the
+ * history file, or that a crashed shell left half updated, is rebuilt.
+ * Where the sidecar can't be created the same index is kept in anonymous
+ * memory, for this shell only.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "histfile.h"
+
+// Mapped beyond the end of the history file, for the lines appended later
+#define MAP_SLACK (4 << 20)
+
+#define INDEX_MAGIC 0x6c736869u // "ihsl"
+#define INDEX_VERSION 1
+// Size of a new index, it grows by doubling
+#define INDEX_INITIAL (1 << 20)
+// Entries of the first line offset chunk, chunk c has LINE_CHUNK << c
+#define LINE_CHUNK 1024
+#define LINE_CHUNKS 40
+// Slots of a new trigram table
+#define TABLE_INITIAL 4096
+// Ids in the first block of a trigram, each further block has twice as many
+#define FIRST_BLOCK 4
+
+// Start of the sidecar. Offsets are from the start of the file, 0 for none.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t dirty;         // Set while an update is in progress
+  uint32_t unused;
+  uint64_t historyIno;    // Inode of the history file the index is for
+  uint64_t indexedBytes;  // Bytes of the history file indexed, whole lines
+  uint64_t lineCount;
+  uint64_t size;          // Bytes of the index file
+  uint64_t used;          // Bytes allocated, the rest is zero
+  uint64_t table;         // The trigram table
+  uint64_t tableCap;
+  uint64_t tableUsed;
+  uint64_t lineChunks[LINE_CHUNKS]; // Start offsets of the lines
+} IndexHeader;
+
+typedef struct
+{
+  uint32_t key;   // Trigram + 1, 0 for a free slot
+  uint32_t count; // Lines with the trigram
+  uint64_t tail;  // Newest block
+} Posting;
+
+typedef struct
+{
+  uint64_t prev; // Older block
+  uint32_t cap;
+  uint32_t count;
+  uint32_t ids[]; // Ascending
+} Block;
+
+// 0 until opened, 1 if open, -1 if there is no history file
+static int state = 0;
+static int fd = -1;
+static char* map = NULL;
+static size_t mapSize = 0;
+static size_t fileSize = 0;
+static ino_t fileIno = 0;
+
+// The sidecar, -1 if the index is in anonymous memory
+static int indexFd = -1;
+static char* idx = NULL;
+static size_t idxMapSize = 0;
+
+#define HEADER ((IndexHeader*)idx)
+
+static void* at(uint64_t offset)
+{
+  return idx + offset;
+}
+
+/*
+ * Follow the index file after another shell grew it
+ */
+static int map_index(void)
+{
+  if(HEADER->size <= idxMapSize){
+    return 0;
+  }
+  size_t newSize = HEADER->size;
+  char* moved = mremap(idx, idxMapSize, newSize, MREMAP_MAYMOVE);
+  if(moved == MAP_FAILED){
+    return -1;
+  }
+  idx = moved;
+  idxMapSize = newSize;
+  return 0;
+}
+
+/*
+ * size zeroed bytes in the index, returns their offset. Pointers into the
+ * index are invalid afterwards, it may have moved.
+ */
+static uint64_t alloc(size_t size)
+{
+  size = (size + 7) & ~(size_t)7;
+  if(HEADER->used + size > HEADER->size){
+    size_t newSize = HEADER->size * 2;
+    while(newSize < HEADER->used + size){
+      newSize *= 2;
+    }
+    if(indexFd != -1 && ftruncate(indexFd, (off_t)newSize) == -1){
+      return 0;
+    }
+    HEADER->size = newSize;
+    if(map_index() == -1){
+      return 0;
+    }
+  }
+  uint64_t offset = HEADER->used;
+  HEADER->used += size;
+  // Left over from before a rebuild
+  memset(at(offset), 0, size);
+  return offset;
+}
+
+/*
+ * Start an empty index for the history file, in place
+ */
+static void reset_index(void)
+{
+  size_t size = HEADER->size;
+  memset(HEADER, 0, sizeof(IndexHeader));
+  HEADER->magic = INDEX_MAGIC;
+  HEADER->version = INDEX_VERSION;
+  HEADER->historyIno = (uint64_t)fileIno;
+  HEADER->size = size;
+  HEADER->used = sizeof(IndexHeader);
+}
+
+static int index_valid(void)
+{
+  return HEADER->magic == INDEX_MAGIC && HEADER->version == INDEX_VERSION && !HEADER->dirty
+         && HEADER->historyIno == (uint64_t)fileIno && HEADER->used <= HEADER->size
+         && HEADER->size >= sizeof(IndexHeader);
+}
+
+static void lock_index(int how)
+{
+  if(indexFd != -1){
+    while(flock(indexFd, how) == -1 && errno == EINTR);
+  }
+}
+
+/*
+ * Open or create the sidecar of the history file path, or keep the index
+ * in anonymous memory
+ */
+static void open_index(const char* path)
+{
+  char idxPath[PATH_MAX];
+  if(snprintf(idxPath, sizeof(idxPath), "%s.idx", path) < (int)sizeof(idxPath)){
+    indexFd = open(idxPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  }
+  if(indexFd != -1){
+    struct stat st;
+    lock_index(LOCK_EX);
+    if(fstat(indexFd, &st) == 0
+       && (st.st_size >= INDEX_INITIAL || ftruncate(indexFd, INDEX_INITIAL) == 0)){
+      idxMapSize = st.st_size >= INDEX_INITIAL ? (size_t)st.st_size : INDEX_INITIAL;
+      idx = mmap(NULL, idxMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+    }
+    if(idx != NULL && idx != MAP_FAILED){
+      if(!index_valid() || HEADER->size != idxMapSize){
+        HEADER->size = idxMapSize;
+        reset_index();
+      }
+      lock_index(LOCK_UN);
+      return;
+    }
+    close(indexFd);
+    indexFd = -1;
+  }
+  idxMapSize = INDEX_INITIAL;
+  idx = mmap(NULL, idxMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(idx == MAP_FAILED){
+    idx = NULL;
+    return;
+  }
+  HEADER->size = idxMapSize;
+  reset_index();
+}
+
+/*
+ * Open the history file once, returns -1 if there is none
+ */
+int histfile_open(void)
+{
+  if(state != 0){
+    return state == 1 ? 0 : -1;
+  }
+  state = -1;
+  char path[PATH_MAX];
+  const char* file = getenv("LSH_HISTFILE");
+  const char* home = getenv("HOME");
+  if(file != NULL){
+    // LSH_HISTFILE= turns the file off
+    if(*file == '\0' || snprintf(path, sizeof(path), "%s", file) >= (int)sizeof(path)){
+      return -1;
+    }
+  }
+  else if(home == NULL || snprintf(path, sizeof(path), "%s/.lsh_history", home) >= (int)sizeof(path)){
+    return -1;
+  }
+  fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  struct stat st;
+  if(fd == -1 || fstat(fd, &st) == -1){
+    if(fd != -1){
+      close(fd);
+      fd = -1;
+    }
+    return -1;
+  }
+  fileSize = (size_t)st.st_size;
+  fileIno = st.st_ino;
+  mapSize = (fileSize + MAP_SLACK) & ~(size_t)(MAP_SLACK - 1);
+  map = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED){
+    close(fd);
+    fd = -1;
+    return -1;
+  }
+  open_index(path);
+  state = 1;
+  return 0;
+}
+
+/*
+ * Pick up what has been appended to the file since it was last looked at
+ */
+static void refresh(void)
+{
+  struct stat st;
+  if(fstat(fd, &st) == -1 || (size_t)st.st_size <= fileSize){
+    return;
+  }
+  size_t size = (size_t)st.st_size;
+  if(size > mapSize){
+    size_t newSize = (size + MAP_SLACK) & ~(size_t)(MAP_SLACK - 1);
+    char* moved = mremap(map, mapSize, newSize, MREMAP_MAYMOVE);
+    if(moved == MAP_FAILED){
+      return;
+    }
+    map = moved;
+    mapSize = newSize;
+  }
+  fileSize = size;
+}
+
+static uint32_t trigram(const char* s)
+{
+  return ((uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8
+          | (uint32_t)(unsigned char)s[2]) + 1;
+}
+
+static Posting* find_posting(uint32_t key)
+{
+  Posting* table = at(HEADER->table);
+  size_t mask = HEADER->tableCap - 1;
+  for(size_t i = (key * 2654435761u) & mask;; i = (i + 1) & mask){
+    if(table[i].key == key || table[i].key == 0){
+      return &table[i];
+    }
+  }
+}
+
+/*
+ * Copy the trigram table to a new one of twice the size, the old one is
+ * left behind
+ */
+static int grow_table(void)
+{
+  uint64_t oldCap = HEADER->tableCap;
+  uint64_t newCap = oldCap ? oldCap * 2 : TABLE_INITIAL;
+  uint64_t table = alloc(newCap * sizeof(Posting));
+  if(table == 0){
+    return -1;
+  }
+  uint64_t old = HEADER->table;
+  HEADER->table = table;
+  HEADER->tableCap = newCap;
+  for(uint64_t i = 0; i < oldCap; i++){
+    Posting* p = (Posting*)at(old) + i;
+    if(p->key != 0){
+      *find_posting(p->key) = *p;
+    }
+  }
+  return 0;
+}
+
+static int add_trigram(uint32_t key, uint32_t id)
+{
+  if(HEADER->tableUsed + 1 > HEADER->tableCap * 7 / 10 && grow_table() == -1){
+    return -1;
+  }
+  Posting* p = find_posting(key);
+  Block* b = p->tail ? at(p->tail) : NULL;
+  // Lines are added in order, a repeated trigram is the last id
+  if(b != NULL && b->ids[b->count - 1] == id){
+    return 0;
+  }
+  if(b == NULL || b->count == b->cap){
+    uint32_t cap = b != NULL ? b->cap * 2 : FIRST_BLOCK;
+    uint64_t block = alloc(sizeof(Block) + cap * sizeof(uint32_t));
+    if(block == 0){
+      return -1;
+    }
+    p = find_posting(key);
+    if(p->key == 0){
+      p->key = key;
+      HEADER->tableUsed++;
+    }
+    b = at(block);
+    b->prev = p->tail;
+    b->cap = cap;
+    p->tail = block;
+  }
+  b->ids[b->count++] = id;
+  p->count++;
+  return 0;
+}
+
+/*
+ * Where the start offset of line id is kept, the chunk is allocated if
+ * it isn't yet. NULL if the index can't grow.
+ */
+static uint64_t* line_slot(uint64_t id)
+{
+  uint64_t n = id / LINE_CHUNK + 1;
+  int c = 63 - __builtin_clzll(n);
+  if(HEADER->lineChunks[c] == 0){
+    uint64_t chunk = alloc(((size_t)LINE_CHUNK << c) * sizeof(uint64_t));
+    if(chunk == 0){
+      return NULL;
+    }
+    HEADER->lineChunks[c] = chunk;
+  }
+  return (uint64_t*)at(HEADER->lineChunks[c]) + (id - LINE_CHUNK * ((1ull << c) - 1));
+}
+
+static uint64_t line_start(uint64_t id)
+{
+  return id == HEADER->lineCount ? HEADER->indexedBytes : *line_slot(id);
+}
+
+/*
+ * Index the complete lines after the indexed part of the file, with the
+ * index locked exclusively
+ */
+static void index_lines(void)
+{
+  refresh();
+  if(!index_valid() || HEADER->indexedBytes > fileSize){
+    reset_index();
+  }
+  HEADER->dirty = 1;
+  size_t pos = HEADER->indexedBytes;
+  while(pos < fileSize){
+    const char* nl = memchr(map + pos, '\n', fileSize - pos);
+    if(nl == NULL){
+      break;
+    }
+    size_t end = (size_t)(nl - map);
+    uint32_t id = (uint32_t)HEADER->lineCount;
+    uint64_t* slot = line_slot(id);
+    if(slot == NULL){
+      return;
+    }
+    *slot = pos;
+    for(size_t i = pos; i + 3 <= end; i++){
+      if(add_trigram(trigram(map + i), id) == -1){
+        return;
+      }
+    }
+    HEADER->lineCount++;
+    HEADER->indexedBytes = end + 1;
+    pos = end + 1;
+  }
+  HEADER->dirty = 0;
+}
+
+/*
+ * Lock the index for reading, up to date with the history file. Returns
+ * -1 if there is no usable index.
+ */
+static int lock_current(void)
+{
+  if(idx == NULL){
+    return -1;
+  }
+  lock_index(LOCK_SH);
+  refresh();
+  if(map_index() == 0 && index_valid() && HEADER->indexedBytes == fileSize){
+    return 0;
+  }
+  // Lines to index, or an index to rebuild
+  lock_index(LOCK_UN);
+  lock_index(LOCK_EX);
+  if(map_index() == -1){
+    lock_index(LOCK_UN);
+    return -1;
+  }
+  index_lines();
+  if(HEADER->dirty){
+    // Out of space, the next shell to try starts over
+    lock_index(LOCK_UN);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Append line to the history file and index it. Returns -1 if it couldn't
+ * be written.
+ */
+int histfile_add(const char* line)
+{
+  if(histfile_open() == -1){
+    return -1;
+  }
+  size_t len = strlen(line);
+  char* record = malloc(len + 1);
+  if(record == NULL){
+    return -1;
+  }
+  memcpy(record, line, len);
+  record[len] = '\n';
+  // One write, O_APPEND keeps it in one piece next to other shells' lines
+  ssize_t n = write(fd, record, len + 1);
+  free(record);
+  if(lock_current() == 0){
+    lock_index(LOCK_UN);
+  }
+  return n == (ssize_t)(len + 1) ? 0 : -1;
+}
+
+/*
+ * The last max complete lines of the file, oldest first, as size bytes
+ * of text. Only the end of the file is read.
+ */
+const char* histfile_tail(size_t max, size_t* size)
+{
+  *size = 0;
+  if(histfile_open() == -1){
+    return NULL;
+  }
+  refresh();
+  const char* last = memrchr(map, '\n', fileSize);
+  if(last == NULL){
+    return NULL;
+  }
+  // From the end of the last complete line back to the start of a line
+  size_t end = (size_t)(last - map) + 1;
+  size_t start = end;
+  for(size_t n = 0; n < max && start > 0; n++){
+    const char* prev = start >= 2 ? memrchr(map, '\n', start - 1) : NULL;
+    start = prev != NULL ? (size_t)(prev - map) + 1 : 0;
+  }
+  *size = end - start;
+  return map + start;
+}
+
+/*
+ * Line id of the file, not NUL-terminated. Valid until the next search
+ * of every line.
+ */
+const char* histfile_line(long id, size_t* len)
+{
+  uint64_t start = line_start((uint64_t)id);
+  *len = (size_t)(line_start((uint64_t)id + 1) - start - 1);
+  return map + start;
+}
+
+static int line_has(long id, const char* query, size_t len)
+{
+  size_t lineLen;
+  const char* line = histfile_line(id, &lineLen);
+  return memmem(line, lineLen, query, len) != NULL;
+}
+
+/*
+ * Newest line before end with query, compared with the lines of its
+ * rarest trigram only
+ */
+static long search_trigrams(const char* query, size_t len, long end)
+{
+  Posting* rarest = NULL;
+  for(size_t i = 0; i + 3 <= len; i++){
+    Posting* p = HEADER->tableCap > 0 ? find_posting(trigram(query + i)) : NULL;
+    if(p == NULL || p->key == 0){
+      return -1;
+    }
+    if(rarest == NULL || p->count < rarest->count){
+      rarest = p;
+    }
+  }
+  for(uint64_t block = rarest->tail; block != 0;){
+    Block* b = at(block);
+    block = b->prev;
+    if((long)b->ids[0] >= end){
+      continue;
+    }
+    for(uint32_t i = b->count; i-- > 0;){
+      long id = b->ids[i];
+      if(id < end && line_has(id, query, len)){
+        return id;
+      }
+    }
+  }
+  return -1;
+}
+
+/*
+ * Number of the newest line before line before that contains query, -1
+ * if there is none. A search of every line, before -1, first indexes the
+ * lines appended since the last one; continuing it with the number of
+ * its match leaves the lines where they are.
+ */
+long histfile_search(const char* query, long before)
+{
+  if(histfile_open() == -1){
+    return -1;
+  }
+  if(before < 0){
+    if(lock_current() == -1){
+      return -1;
+    }
+  }
+  else {
+    lock_index(LOCK_SH);
+    if(map_index() == -1){
+      lock_index(LOCK_UN);
+      return -1;
+    }
+  }
+  size_t len = strlen(query);
+  long lines = (long)HEADER->lineCount;
+  long end = before < 0 || before > lines ? lines : before;
+  long found = -1;
+  if(len < 3){
+    for(long id = end - 1; id >= 0 && found == -1; id--){
+      if(line_has(id, query, len)){
+        found = id;
+      }
+    }
+  }
+  else {
+    found = search_trigrams(query, len, end);
+  }
+  lock_index(LOCK_UN);
+  return found;
+}
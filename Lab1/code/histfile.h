@@ -0,0 +1,23 @@
+#ifndef HISTFILE_INC
+#define HISTFILE_INC
+#include <stddef.h>
+
+/*
+ * Command history in a file shared by every lsh (histfile.c),
+ * LSH_HISTFILE or ~/.lsh_history.
+ *
+ * Lines are only ever appended, each with a single O_APPEND write, so
+ * shells running at the same time never overwrite each other's lines.
+ * The file is read through mmap: opening it reads nothing, the recent
+ * lines for the arrow keys are found from its end and the rest is only
+ * looked at by a search. Searches use a trigram index in a sidecar file,
+ * <history>.idx, that every shell maps and brings up to date with the
+ * lines it appends, so neither opening it nor a search reads more than
+ * the lines not indexed yet.
+ */
+int histfile_open(void);
+int histfile_add(const char* line);
+const char* histfile_tail(size_t max, size_t* size);
+long histfile_search(const char* query, long before);
+const char* histfile_line(long id, size_t* len);
+#endif
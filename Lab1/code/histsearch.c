@@ -0,0 +1,222 @@
+/*
+ * Ctrl-R search of the history file, see histsearch.h.
+ *
+ * While a search is active every key goes through a keymap of its own:
+ * printable keys extend the query, Backspace shortens it, Ctrl-R steps to
+ * an older match and the keys that end the search restore readline's
+ * keymap and prompt. Each step is a histfile_search, so a search covers
+ * the lines other shells appended while this one was open.
+ */
+#define _GNU_SOURCE
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histsearch.h"
+#include "histfile.h"
+
+// Lines of the history file the arrow keys go through
+#define HISTORY_RECENT 1000
+
+// The search being shown, see start_search
+static struct
+{
+  int active;
+  char query[256];
+  size_t len;
+  long match;    // Line of the history file shown, -1 if none yet
+  char* line;    // What had been typed before Ctrl-R
+  int point;
+  char* prompt;  // Prompt before Ctrl-R
+  Keymap keymap; // Keymap before the search
+} search;
+// Every key of the search goes to the search functions
+static Keymap searchKeymap = NULL;
+
+/*
+ * Show the query of the search and the line it found
+ */
+static void show_search(int failed)
+{
+  char prompt[sizeof(search.query) + 32];
+  snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%s': ", failed ? "failed " : "", search.query);
+  rl_set_prompt(prompt);
+  if(search.match != -1){
+    size_t len;
+    const char* text = histfile_line(search.match, &len);
+    char* line = strndup(text, len);
+    char* at = strstr(line, search.query);
+    rl_replace_line(line, 0);
+    rl_point = at != NULL ? (int)(at - line) : 0;
+    free(line);
+  }
+  rl_redisplay();
+}
+
+/*
+ * Show the newest line before line before with the query, the line shown
+ * stays if there is none
+ */
+static void find_match(long before)
+{
+  long id = histfile_search(search.query, before);
+  if(id != -1){
+    search.match = id;
+  }
+  show_search(id == -1);
+}
+
+/*
+ * Ctrl-R: search the history file, every shell's lines, for the line typed
+ * from now on. The trigram index of histfile.c finds a line in the time
+ * readline's own search takes to look at a few hundred of its list.
+ */
+static int start_search(int count, int key)
+{
+  (void)count;
+  (void)key;
+  search.active = 1;
+  search.len = 0;
+  search.query[0] = '\0';
+  search.match = -1;
+  search.line = rl_copy_text(0, rl_end);
+  search.point = rl_point;
+  search.prompt = strdup(rl_prompt != NULL ? rl_prompt : "");
+  search.keymap = rl_get_keymap();
+  rl_set_keymap(searchKeymap);
+  show_search(0);
+  return 0;
+}
+
+static int search_insert(int count, int key)
+{
+  (void)count;
+  if(search.len + 1 < sizeof(search.query)){
+    search.query[search.len++] = (char)key;
+    search.query[search.len] = '\0';
+  }
+  // The line shown may have the longer query as well
+  find_match(search.match != -1 ? search.match + 1 : -1);
+  return 0;
+}
+
+static int search_erase(int count, int key)
+{
+  (void)count;
+  (void)key;
+  if(search.len > 0){
+    search.query[--search.len] = '\0';
+  }
+  search.match = -1;
+  find_match(-1);
+  return 0;
+}
+
+// Ctrl-R again: the next older line
+static int search_older(int count, int key)
+{
+  (void)count;
+  (void)key;
+  find_match(search.match);
+  return 0;
+}
+
+/*
+ * Leave the search with the line found, or with the line typed before it
+ * if restore is set or nothing was found
+ */
+static void end_search(int restore)
+{
+  rl_set_keymap(search.keymap);
+  search.active = 0;
+  rl_set_prompt(search.prompt);
+  free(search.prompt);
+  search.prompt = NULL;
+  if(restore || search.match == -1){
+    rl_replace_line(search.line, 0);
+    rl_point = search.point;
+  }
+  free(search.line);
+  search.line = NULL;
+  rl_redisplay();
+}
+
+/*
+ * Ctrl+C during a search: back to the line typed before it
+ */
+void histsearch_cancel(void)
+{
+  if(search.active){
+    end_search(1);
+  }
+}
+
+// Escape and the cursor keys keep the line found for editing, the key
+// itself is then handled as usual
+static int search_accept(int count, int key)
+{
+  (void)count;
+  end_search(0);
+  rl_execute_next(key);
+  return 0;
+}
+
+// Ctrl-G goes back to the line typed before the search
+static int search_abort(int count, int key)
+{
+  (void)count;
+  (void)key;
+  end_search(1);
+  return 0;
+}
+
+// Enter runs the line found
+static int search_run(int count, int key)
+{
+  end_search(0);
+  return rl_newline(count, key);
+}
+
+/*
+ * Give readline's list, for the arrow keys, the newest lines of the
+ * history file and bind Ctrl-R to the search of all of them. Only the end
+ * of the file is read.
+ */
+void histsearch_load(void)
+{
+  if(histfile_open() == -1){
+    return;
+  }
+  size_t size;
+  const char* text = histfile_tail(HISTORY_RECENT, &size);
+  for(const char* end = text + size; text < end;){
+    const char* nl = memchr(text, '\n', (size_t)(end - text));
+    char* line = strndup(text, (size_t)(nl - text));
+    add_history(line);
+    free(line);
+    text = nl + 1;
+  }
+
+  searchKeymap = rl_make_bare_keymap();
+  // Set directly, binding a byte above 127 may make it Meta, an Escape
+  // prefix, depending on the locale
+  for(int c = ' '; c < 256; c++){
+    if(c != RUBOUT){
+      searchKeymap[c].type = ISFUNC;
+      searchKeymap[c].function = search_insert;
+    }
+  }
+  rl_bind_key_in_map(RUBOUT, search_erase, searchKeymap);
+  rl_bind_key_in_map(CTRL('H'), search_erase, searchKeymap);
+  rl_bind_key_in_map(CTRL('R'), search_older, searchKeymap);
+  rl_bind_key_in_map(CTRL('G'), search_abort, searchKeymap);
+  rl_bind_key_in_map(RETURN, search_run, searchKeymap);
+  rl_bind_key_in_map(NEWLINE, search_run, searchKeymap);
+  const int keep[] = {ESC, CTRL('A'), CTRL('E'), CTRL('B'), CTRL('F'), TAB};
+  for(size_t i = 0; i < sizeof(keep) / sizeof(keep[0]); i++){
+    rl_bind_key_in_map(keep[i], search_accept, searchKeymap);
+  }
+  rl_bind_key(CTRL('R'), start_search);
+}
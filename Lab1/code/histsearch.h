@@ -0,0 +1,15 @@
+#ifndef HISTSEARCH_INC
+#define HISTSEARCH_INC
+
+/*
+ * Ctrl-R at the readline prompt (histsearch.c): an incremental search of
+ * the whole history file, every shell's lines, through the trigram index
+ * of histfile.h instead of readline's search of its own list.
+ *
+ * histsearch_load gives readline's list the newest lines of the file, for
+ * the arrow keys, and binds Ctrl-R. histsearch_cancel ends a search in
+ * progress, for Ctrl+C at the prompt.
+ */
+void histsearch_load(void);
+void histsearch_cancel(void);
+#endif
@@ -0,0 +1,6 @@
+/*
+ * Ctrl+c flag of the shell, see interrupt.h
+ */
+#include "interrupt.h"
+
+volatile sig_atomic_t shell_interrupted = 0;
@@ -0,0 +1,14 @@
+#ifndef INTERRUPT_INC
+#define INTERRUPT_INC
+#include <signal.h>
+
+/*
+ * Ctrl+c in the shell itself (interrupt.c).
+ *
+ * The SIGINT handler only sets shell_interrupted. Whatever the shell is
+ * busy with checks it and stops: a cat or tee running in the shell, a
+ * loop, the rest of a command list, parallel or a $(...) being read. It
+ * is cleared before each command line.
+ */
+extern volatile sig_atomic_t shell_interrupted;
+#endif
@@ -0,0 +1,417 @@
+/*
+ * Per-job resource limits, see joblimits.h.
+ *
+ * cgroup v2 only lets a cgroup hand controllers to its children when it
+ * has no processes of its own. cgroups are only used when every process
+ * in the shell's cgroup is the shell or one it started, as in a scope of
+ * its own (systemd-run --scope -p Delegate=yes). The first time a limited
+ * job starts, those processes move to a leaf "lsh-<shell pid>" below it,
+ * then cpu, memory and io are enabled for the subtree and each job gets a
+ * sibling "job-<shell pid>-<n>". When the shell exits the controllers it
+ * enabled are disabled again and its processes move back. Where any of
+ * this fails (no cgroup v2, a subtree that isn't delegated, processes the
+ * shell didn't start in the cgroup) the stages are reniced and get an
+ * address space limit instead; nothing of anyone else's is moved.
+ *
+ * Stages join their cgroup right after they are spawned, like the CPU
+ * placement, so it works the same in every spawn mode.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "joblimits.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+// Period of cpu.max in us, a percent of one CPU is 1000 us of it
+#define CPU_PERIOD 100000
+// Added to the shell's nice value when cgroups can't limit a job
+#define FALLBACK_NICE 10
+
+// The shell's cgroup, job cgroups are created in it. Valid if baseState is 1
+static char basePath[PATH_MAX];
+// 0 until checked, 1 if cgroups can be used, -1 if not
+static int baseState = 0;
+// Names the job cgroups
+static unsigned groupCount = 0;
+// Controllers init_base enabled, disabled again by restore_base
+static char enabled[64];
+// Leaf the shell's processes moved to, empty if they didn't
+static char leafPath[PATH_MAX + 16];
+// The shell, forked children mustn't undo its setup when they exit
+static pid_t ownerPid;
+
+static int write_file(const char* path, const char* text)
+{
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if(fd == -1){
+    return -1;
+  }
+  ssize_t len = (ssize_t)strlen(text);
+  ssize_t n = write(fd, text, (size_t)len);
+  int err = errno;
+  close(fd);
+  errno = err;
+  return n == len ? 0 : -1;
+}
+
+/*
+ * Read a small file into buf, NUL-terminated. Returns -1 on failure.
+ */
+static int read_file(const char* path, char* buf, size_t size)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1){
+    return -1;
+  }
+  ssize_t n = read(fd, buf, size - 1);
+  close(fd);
+  if(n < 0){
+    return -1;
+  }
+  buf[n] = '\0';
+  return 0;
+}
+
+/*
+ * 1 if word is one of the space separated words of list
+ */
+static int has_word(const char* list, const char* word)
+{
+  size_t len = strlen(word);
+  for(const char* p = list; (p = strstr(p, word)) != NULL; p += len){
+    if((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0')){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * 1 if pid is the shell or a descendant of it
+ */
+static int started_by_shell(pid_t pid)
+{
+  char path[64];
+  char stat[512];
+  // Depth limit, a pid reused meanwhile could otherwise loop
+  for(int depth = 0; depth < 64; depth++){
+    if(pid == ownerPid){
+      return 1;
+    }
+    if(pid <= 1){
+      return 0;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if(read_file(path, stat, sizeof(stat)) == -1){
+      return 0;
+    }
+    // The name in parentheses may contain anything, the parent pid
+    // follows the state after the last ')'
+    char* end = strrchr(stat, ')');
+    int ppid;
+    if(end == NULL || sscanf(end + 1, " %*c %d", &ppid) != 1){
+      return 0;
+    }
+    pid = ppid;
+  }
+  return 0;
+}
+
+/*
+ * Move the processes of cgroup from into cgroup to, one pid per write as
+ * the kernel wants it. Fails without moving any if one of them wasn't
+ * started by the shell.
+ */
+static int move_procs(const char* from, const char* to)
+{
+  char path[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s/cgroup.procs", from);
+  FILE* procs = fopen(path, "re");
+  if(procs == NULL){
+    return -1;
+  }
+  size_t count = 0;
+  size_t cap = 16;
+  pid_t* pids = malloc(cap * sizeof(pid_t));
+  int pid;
+  int status = 0;
+  while(fscanf(procs, "%d", &pid) == 1){
+    if(!started_by_shell(pid)){
+      status = -1;
+      break;
+    }
+    if(count == cap){
+      cap *= 2;
+      pids = realloc(pids, cap * sizeof(pid_t));
+    }
+    pids[count++] = pid;
+  }
+  fclose(procs);
+
+  snprintf(path, sizeof(path), "%s/cgroup.procs", to);
+  char value[32];
+  for(size_t i = 0; status == 0 && i < count; i++){
+    snprintf(value, sizeof(value), "%d", (int)pids[i]);
+    // Processes that exited meanwhile don't matter
+    if(write_file(path, value) == -1 && errno != ESRCH){
+      status = -1;
+    }
+  }
+  free(pids);
+  return status;
+}
+
+/*
+ * Undo init_base when the shell exits: disable the controllers it
+ * enabled and move its processes back. Jobs still running keep their
+ * cgroups.
+ */
+static void restore_base(void)
+{
+  if(getpid() != ownerPid){
+    return;
+  }
+  char path[PATH_MAX + 32];
+  if(enabled[0] != '\0'){
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", basePath);
+    write_file(path, enabled);
+  }
+  if(leafPath[0] != '\0' && move_procs(leafPath, basePath) == 0){
+    rmdir(leafPath);
+  }
+}
+
+/*
+ * Find the shell's cgroup and enable the controllers for its children
+ */
+static int init_base(void)
+{
+  char self[PATH_MAX];
+  if(read_file("/proc/self/cgroup", self, sizeof(self)) == -1){
+    return -1;
+  }
+  // The v2 hierarchy is the line "0::/path"
+  char* line = strstr(self, "0::");
+  if(line == NULL || (line != self && line[-1] != '\n')){
+    return -1;
+  }
+  line += 3;
+  line[strcspn(line, "\n")] = '\0';
+  // The root cgroup is the whole system's, never delegated to a shell
+  if(strcmp(line, "/") == 0){
+    return -1;
+  }
+  snprintf(basePath, sizeof(basePath), CGROUP_ROOT "%s", line);
+
+  char path[PATH_MAX + 32];
+  char controllers[256];
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", basePath);
+  if(read_file(path, controllers, sizeof(controllers)) == -1){
+    return -1;
+  }
+  // A missing io controller just drops io.weight
+  if(!has_word(controllers, "cpu") || !has_word(controllers, "memory")){
+    return -1;
+  }
+  // Only the controllers that aren't enabled yet, they are disabled again
+  char subtree[256];
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", basePath);
+  if(read_file(path, subtree, sizeof(subtree)) == -1){
+    return -1;
+  }
+  char enable[64] = "";
+  const char* wanted[] = {"cpu", "memory", "io"};
+  for(int i = 0; i < 3; i++){
+    if(has_word(controllers, wanted[i]) && !has_word(subtree, wanted[i])){
+      size_t len = strlen(enable);
+      snprintf(enable + len, sizeof(enable) - len, "%s+%s", len ? " " : "", wanted[i]);
+    }
+  }
+  ownerPid = getpid();
+  if(enable[0] == '\0'){
+    return 0;
+  }
+
+  if(write_file(path, enable) == -1){
+    if(errno != EBUSY){
+      return -1;
+    }
+    // The shell's cgroup has processes, they go to a leaf first, as long
+    // as they are all the shell's
+    snprintf(leafPath, sizeof(leafPath), "%s/lsh-%d", basePath, (int)ownerPid);
+    if(mkdir(leafPath, 0755) == -1){
+      leafPath[0] = '\0';
+      return -1;
+    }
+    if(move_procs(basePath, leafPath) == -1 || write_file(path, enable) == -1){
+      move_procs(leafPath, basePath);
+      rmdir(leafPath);
+      leafPath[0] = '\0';
+      return -1;
+    }
+  }
+  // "+cpu +memory" becomes "-cpu -memory"
+  for(char* c = strcpy(enabled, enable); (c = strchr(c, '+')) != NULL;){
+    *c = '-';
+  }
+  atexit(restore_base);
+  return 0;
+}
+
+static int use_cgroups(void)
+{
+  if(baseState == 0){
+    baseState = init_base() == 0 ? 1 : -1;
+  }
+  return baseState == 1;
+}
+
+int joblimits_active(const JobLimits* limits)
+{
+  return limits->cpu != 0 || limits->memory != 0 || limits->ioWeight != 0;
+}
+
+/*
+ * Set the limit name (cpu, memory or io) from value. cpu is a percentage
+ * of one CPU, memory bytes with an optional k, m or g suffix and io a
+ * weight from 1 to 10000; "max" and "default" remove a limit.
+ * Returns -1 if value is invalid.
+ */
+int joblimits_parse(JobLimits* limits, const char* name, const char* value)
+{
+  int none = strcmp(value, "max") == 0 || strcmp(value, "default") == 0;
+  char* end;
+  errno = 0;
+  long long n = none ? 0 : strtoll(value, &end, 10);
+  if(!none && (end == value || n <= 0 || errno != 0)){
+    return -1;
+  }
+  if(strcmp(name, "cpu") == 0){
+    if(!none && ((*end != '\0' && strcmp(end, "%") != 0) || n > 100000)){
+      return -1;
+    }
+    limits->cpu = (int)n;
+    return 0;
+  }
+  if(strcmp(name, "memory") == 0){
+    int shift = 0;
+    if(!none && *end != '\0'){
+      const char* units = "kmg";
+      const char* unit = strchr(units, *end | 0x20);
+      if(unit == NULL || end[1] != '\0'){
+        return -1;
+      }
+      shift = 10 * (int)(unit - units + 1);
+    }
+    if(n > LLONG_MAX >> shift){
+      return -1;
+    }
+    limits->memory = n << shift;
+    return 0;
+  }
+  if(strcmp(name, "io") == 0){
+    if(!none && (*end != '\0' || n > 10000)){
+      return -1;
+    }
+    limits->ioWeight = (int)n;
+    return 0;
+  }
+  return -1;
+}
+
+/*
+ * How limits are enforced, checks the cgroup setup the first time
+ */
+const char* joblimits_mode(void)
+{
+  return use_cgroups() ? "cgroup" : "nice/rlimit";
+}
+
+/*
+ * Create a cgroup for a job with limits. Returns its directory, to be
+ * freed with joblimits_remove_group, or NULL if cgroups can't be used.
+ */
+char* joblimits_create_group(const JobLimits* limits)
+{
+  if(!use_cgroups()){
+    return NULL;
+  }
+  char* group;
+  if(asprintf(&group, "%s/job-%d-%u", basePath, (int)getpid(), ++groupCount) == -1){
+    return NULL;
+  }
+  if(mkdir(group, 0755) == -1){
+    free(group);
+    return NULL;
+  }
+  char path[PATH_MAX + 32];
+  char value[64];
+  int failed = 0;
+  if(limits->cpu != 0){
+    snprintf(path, sizeof(path), "%s/cpu.max", group);
+    snprintf(value, sizeof(value), "%d %d", limits->cpu * (CPU_PERIOD / 100), CPU_PERIOD);
+    failed |= write_file(path, value);
+  }
+  if(limits->memory != 0){
+    snprintf(path, sizeof(path), "%s/memory.max", group);
+    snprintf(value, sizeof(value), "%lld", limits->memory);
+    failed |= write_file(path, value);
+  }
+  if(limits->ioWeight != 0){
+    snprintf(path, sizeof(path), "%s/io.weight", group);
+    snprintf(value, sizeof(value), "default %d", limits->ioWeight);
+    // Without the io controller the other limits still hold
+    write_file(path, value);
+  }
+  if(failed){
+    rmdir(group);
+    free(group);
+    return NULL;
+  }
+  return group;
+}
+
+/*
+ * Put a stage of a limited job into group, or without a group renice it
+ * and limit its address space. Returns -1 if that failed.
+ */
+int joblimits_apply(pid_t pid, const char* group, const JobLimits* limits)
+{
+  if(group != NULL){
+    char path[PATH_MAX + 32];
+    char value[32];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", group);
+    snprintf(value, sizeof(value), "%d", (int)pid);
+    return write_file(path, value);
+  }
+  int status = 0;
+  if(limits->cpu != 0 || limits->ioWeight != 0){
+    // The io priority of a process without one follows its nice value
+    int nice = getpriority(PRIO_PROCESS, 0) + FALLBACK_NICE;
+    status |= setpriority(PRIO_PROCESS, (id_t)pid, nice < 19 ? nice : 19);
+  }
+  if(limits->memory != 0){
+    struct rlimit limit = {(rlim_t)limits->memory, (rlim_t)limits->memory};
+    status |= prlimit(pid, RLIMIT_AS, &limit, NULL);
+  }
+  return status;
+}
+
+/*
+ * Remove the cgroup of a job that is done, group may be NULL
+ */
+void joblimits_remove_group(char* group)
+{
+  if(group != NULL){
+    rmdir(group);
+    free(group);
+  }
+}
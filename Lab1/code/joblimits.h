@@ -0,0 +1,27 @@
+#ifndef JOBLIMITS_INC
+#define JOBLIMITS_INC
+#include <sys/types.h>
+
+/*
+ * Resource limits for background jobs (joblimits.c), so that batch work
+ * started with & can't starve the foreground.
+ *
+ * When the shell's cgroup v2 subtree is delegated to it, every limited
+ * job gets a cgroup of its own with cpu.max, memory.max and io.weight,
+ * created when the job is launched and removed when it is done. Without
+ * cgroups the stages are reniced and get an RLIMIT_AS instead.
+ */
+typedef struct
+{
+  int cpu;          // Percent of one CPU, 0 for no limit
+  long long memory; // Bytes, 0 for no limit
+  int ioWeight;     // 1 to 10000, 0 for the default of 100
+} JobLimits;
+
+int joblimits_active(const JobLimits* limits);
+int joblimits_parse(JobLimits* limits, const char* name, const char* value);
+const char* joblimits_mode(void);
+char* joblimits_create_group(const JobLimits* limits);
+int joblimits_apply(pid_t pid, const char* group, const JobLimits* limits);
+void joblimits_remove_group(char* group);
+#endif
@@ -0,0 +1,215 @@
+/*
+ * Job control builtins, see jobs.h
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jobs.h"
+
+/*
+ * If jobs, fg, bg or wait command -> run it against the job table,
+ * store its exit status in status and return 1, else return 0
+ */
+int handle_jobs(ProgramState* state, Command* cmd, int* status)
+{
+  char** argv = cmd->pgm->pgmlist;
+  Job* job;
+
+  if(strcmp(argv[0], "jobs") == 0)
+  {
+    print_jobs(state, stdout);
+    *status = 0;
+    return 1;
+  }
+  if(strcmp(argv[0], "fg") == 0 || strcmp(argv[0], "bg") == 0)
+  {
+    job = find_job(state, argv[1]);
+    if(job == NULL)
+    {
+      printf("%s: %s: no such job\n", argv[0], argv[1] ? argv[1] : "current");
+      *status = 1;
+      return 1;
+    }
+    if(job->state == JOB_STOPPED)
+    {
+      continue_job(job);
+    }
+    if(argv[0][0] == 'b')
+    {
+      printf("[%d] %s\n", job->id, job->cmdline);
+      job->background = 1;
+      *status = 0;
+      return 1;
+    }
+    // Note that a job started with & still ignores Ctrl+c
+    printf("%s\n", job->cmdline);
+    job->background = 0;
+    *status = wait_job(state, job);
+    if(job->state == JOB_DONE)
+    {
+      remove_job(state, job);
+    }
+    return 1;
+  }
+  if(strcmp(argv[0], "wait") == 0)
+  {
+    *status = 0;
+    if(argv[1] == NULL)
+    {
+      // Wait for every running job, stopped jobs would never finish
+      for(size_t i = 0; i < state->numJobs;)
+      {
+        job = state->jobs[i];
+        if(job->state == JOB_STOPPED)
+        {
+          i++;
+          continue;
+        }
+        *status = wait_job(state, job);
+        if(job->state == JOB_DONE)
+        {
+          remove_job(state, job);
+          continue;
+        }
+        i++;
+      }
+      return 1;
+    }
+    for(int i = 1; argv[i] != NULL; i++)
+    {
+      if(argv[i][0] == '%')
+      {
+        job = find_job(state, argv[i]);
+      }
+      else
+      {
+        job = find_job_by_pid(state, (pid_t)atoi(argv[i]));
+      }
+      if(job == NULL)
+      {
+        printf("wait: %s: no such job\n", argv[i]);
+        *status = 127;
+        continue;
+      }
+      *status = wait_job(state, job);
+      if(job->state == JOB_DONE)
+      {
+        remove_job(state, job);
+      }
+    }
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+ * Signal number of a name like TERM, SIGTERM or 15, -1 if unknown
+ */
+static int signal_number(const char* name)
+{
+  if(isdigit((unsigned char)name[0])){
+    char* end;
+    long sig = strtol(name, &end, 10);
+    return *end == '\0' && sig >= 0 && sig < NSIG ? (int)sig : -1;
+  }
+  if(strncasecmp(name, "SIG", 3) == 0){
+    name += 3;
+  }
+  for(int sig = 1; sig < NSIG; sig++){
+    const char* abbrev = sigabbrev_np(sig);
+    if(abbrev != NULL && strcasecmp(abbrev, name) == 0){
+      return sig;
+    }
+  }
+  return -1;
+}
+
+/*
+ * kill [-s sig | -sig] pid | %job ... sends SIGTERM or sig, a job gets it
+ * in all of its processes. kill -l lists the signal names.
+ */
+int handle_kill(ProgramState* state, Command* cmd)
+{
+  char** argv = cmd->pgm->pgmlist;
+  int sig = SIGTERM;
+  int i = 1;
+
+  if(argv[1] != NULL && strcmp(argv[1], "-l") == 0)
+  {
+    for(int n = 1; n < NSIG; n++)
+    {
+      const char* abbrev = sigabbrev_np(n);
+      if(abbrev != NULL)
+      {
+        printf("%2d) SIG%s\n", n, abbrev);
+      }
+    }
+    return 0;
+  }
+  if(argv[1] != NULL && argv[1][0] == '-' && argv[1][1] != '\0')
+  {
+    const char* name = argv[1] + 1;
+    i = 2;
+    if(strcmp(argv[1], "-s") == 0)
+    {
+      name = argv[2] != NULL ? argv[2] : "";
+      i = 3;
+    }
+    sig = signal_number(name);
+    if(sig == -1)
+    {
+      printf("kill: %s: invalid signal specification\n", name);
+      return 2;
+    }
+  }
+  if(argv[i] == NULL)
+  {
+    printf("kill: usage: kill [-s sig | -sig] pid | %%job ... or kill -l\n");
+    return 2;
+  }
+
+  int status = 0;
+  for(; argv[i] != NULL; i++)
+  {
+    if(argv[i][0] == '%')
+    {
+      Job* job = find_job(state, argv[i]);
+      if(job == NULL)
+      {
+        printf("kill: %s: no such job\n", argv[i]);
+        status = 1;
+        continue;
+      }
+      if(signal_job(job, sig) == -1)
+      {
+        printf("kill: %s: %s\n", argv[i], strerror(errno));
+        status = 1;
+      }
+      else if(sig == SIGCONT && job->state == JOB_STOPPED)
+      {
+        job->state = JOB_RUNNING;
+      }
+      continue;
+    }
+    char* end;
+    long pid = strtol(argv[i], &end, 10);
+    if(*end != '\0' || end == argv[i])
+    {
+      printf("kill: %s: arguments must be process or job IDs\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    if(kill((pid_t)pid, sig) == -1)
+    {
+      printf("kill: (%ld) - %s\n", pid, strerror(errno));
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,13 @@
+#ifndef JOBS_INC
+#define JOBS_INC
+#include "parse.h"
+#include "ProgramState.h"
+
+/*
+ * Builtins that work on the job table (jobs.c): jobs, fg, bg, wait and
+ * kill. handle_jobs returns 1 if cmd was one of the first four, with its
+ * exit status in *status.
+ */
+int handle_jobs(ProgramState* state, Command* cmd, int* status);
+int handle_kill(ProgramState* state, Command* cmd);
+#endif
@@ -16,6 +16,7 @@
  *
  * All the best!
  */
+#define _GNU_SOURCE
 #include <assert.h>
 #include <ctype.h>
 #include <readline/readline.h>
@@ -29,72 +30,603 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 
 
 #include "lsh.h"
 #include "parse.h"
 #include "ProgramState.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "reader.h"
+#include "mover.h"
+#include "interrupt.h"
+#include "trace.h"
+#include "builtin.h"
+#include "cwd.h"
+#include "zygote.h"
+#include "placement.h"
+#include "joblimits.h"
+#include "script.h"
+#include "expand.h"
+#include "histfile.h"
+#include "histsearch.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "settings.h"
 
 //static void print_cmd(Command *cmd);
 //static void print_pgm(Pgm *p);
+// Usage of the shell and its children when `time cmd` started
+typedef struct
+{
+  double wall;
+  struct rusage self;
+  struct rusage children;
+} TimeStart;
+
+static pid_t spawn_command(char** argv, const SpawnStage* stage);
+static void run_interactive(Arena* arena);
+static int run_batch(int fd, Arena* arena);
+static int run_string(const char* commands, Arena* arena);
+static void run_input(char* line, Arena* arena);
+static void finish_input(void);
+static void run_line(char* line, Arena* arena);
+static int (*create_pipes(int count, long size))[2];
+static void close_pipes(int (*pipes)[2], int count, int keepIn, int keepOut);
+static int count_movers(Command* cmd);
+static void rusage_delta(const struct rusage* before, struct rusage* after);
+static int strip_time(Command* cmd);
+static int strip_pipesize(Command* cmd);
+static void time_start(TimeStart* start);
+static void time_report(const TimeStart* start, FILE* out);
+static int wait_input(int fd);
+static void handle_line(char* line);
+static void start_input_timer(void);
+static void cancel_input(void);
+static const char* input_prompt(void);
+static void report_jobs(void);
+
+// Jobs started by the shell, see ProgramState.h
+static ProgramState state;
+// Set when reading commands from a terminal
+static int interactive = 0;
+// Where handle_line parses lines, readline's handler takes no arguments
+static Arena* interactiveArena = NULL;
+// Set by handle_line at EOF
+static int inputDone = 0;
+// Monotonic seconds when TMOUT runs out, 0 without TMOUT
+static double inputDeadline = 0;
 
+// How pipeline stages are started, see spawn.h
+static SpawnMode spawnMode = SPAWN_POSIX;
+// Status of the last command, returned by lsh -c and scripts
+int shell_status = 0;
+// Print the usage of every stage, set while running `time cmd`
+static int timeStages = 0;
+// Print a summary line after every pipeline, LSH_STATS=1
+static int stageSummary = 0;
+// Capacity for the pipeline being started, settings_pipe_size() unless
+// the command line starts with `pipesize size`
+static long pipelinePipeSize = 0;
 
-int main(void)
+// Lines of a compound command that isn't complete yet
+static Capture pendingInput = {NULL, 0, 0};
+
+int main(int argc, char** argv)
 {
   // Setup signal handlers
   pid_t pid = getpid();
   init_signals();
+  if(init_state(&state) == -1)
+  {
+    printf("Unable to initialize job table: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  spawnMode = spawn_mode_from_env();
+  cwd_init();
+  stageSummary = getenv("LSH_STATS") != NULL && strcmp(getenv("LSH_STATS"), "0") != 0;
+  settings_init();
+  trace_init();
   // All subsequent child processes will inherit this pgid -> 
   // Ctrl+c should kill all processes in pgid except pid
   setpgid(pid, pid);
+  // Forked now, while the shell is small, and in its process group
+  if(spawnMode == SPAWN_ZYGOTE && zygote_start() == -1)
+  {
+    printf("Unable to start the zygote: %s\n", strerror(errno));
+    spawnMode = SPAWN_POSIX;
+  }
 
-  char cwd[1024];
+  // Holds the parsed command, reset once the command has been handled
+  Arena arena;
+  arena_init(&arena, 4096);
 
-  for (;;)
+  int status = EXIT_SUCCESS;
+  if(argc > 1 && strcmp(argv[1], "-c") == 0)
+  {
+    if(argc < 3)
+    {
+      printf("usage: lsh [-c command | script]\n");
+      return 2;
+    }
+    status = run_string(argv[2], &arena);
+  }
+  else if(argc > 1)
   {
-    char *line;
-    char* start = get_path(cwd);
-    line = readline(start);
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+    {
+      printf("%s: %s\n", argv[1], strerror(errno));
+      return 127;
+    }
+    shell_positional = argv + 2;
+    shell_positionalCount = argc - 2;
+    status = run_batch(fd, &arena);
+    close(fd);
+  }
+  else if(isatty(STDIN_FILENO))
+  {
+    interactive = 1;
+    run_interactive(&arena);
+  }
+  else
+  {
+    // Commands piped to lsh, EOF still means a clean exit
+    run_batch(STDIN_FILENO, &arena);
+  }
 
-    if(line == NULL){
-      printf("Detected EOF\n");
-      kill(0, SIGHUP);
+  // Gracefully terminate the jobs still running
+  signal_jobs(&state, SIGHUP);
+  arena_free(&arena);
+  return status;
+}
+
+/*
+ * Read commands with readline, with prompt and history, until EOF.
+ * readline gets a character only when poll says stdin has one, and the
+ * same poll reaps children: a background job that finishes is reported
+ * right away, above the line being typed. TMOUT in the environment logs
+ * out after that many seconds without a line, like in bash.
+ */
+static void run_interactive(Arena* arena)
+{
+  interactiveArena = arena;
+  notify_jobs(&state, stdout);
+  // LINES and COLUMNS would go around vars.c, which owns the environment
+  rl_change_environment = 0;
+  histsearch_load();
+  rl_callback_handler_install(cwd_prompt(), handle_line);
+  start_input_timer();
+
+  struct pollfd fds[2] = {
+    {.fd = STDIN_FILENO, .events = POLLIN},
+    {.fd = state.sigfd, .events = POLLIN},
+  };
+  while(!inputDone)
+  {
+    int timeout = -1;
+    if(inputDeadline > 0)
+    {
+      double left = inputDeadline - monotonic_seconds();
+      timeout = left > 0 ? (int)(left * 1000) + 1 : 0;
+    }
+    int ready = poll(fds, 2, timeout);
+    if(ready == -1)
+    {
+      if(errno != EINTR)
+      {
+        break;
+      }
+      if(shell_interrupted)
+      {
+        cancel_input();
+      }
+      continue;
+    }
+    if(ready == 0)
+    {
+      printf("\ntimed out waiting for input: auto-logout\n");
       break;
     }
-    // Remove leading and trailing whitespace from the line
+    if(fds[1].revents & POLLIN)
+    {
+      reap_children(&state);
+      report_jobs();
+    }
+    if(fds[0].revents)
+    {
+      // Calls handle_line once the line is complete
+      rl_callback_read_char();
+    }
+  }
+  if(!inputDone)
+  {
+    rl_callback_handler_remove();
+  }
+}
+
+/*
+ * readline's line handler, runs a line as soon as it has been typed.
+ * readline shows the prompt again when it returns.
+ */
+static void handle_line(char* line)
+{
+  if(line == NULL){
+    finish_input();
+    printf("Detected EOF\n");
+    rl_callback_handler_remove();
+    inputDone = 1;
+    return;
+  }
+  // Remove leading and trailing whitespace from the line
+  stripwhite(line);
+
+  // If stripped line not blank
+  if (*line)
+  {
+    add_history(line);
+    histfile_add(line);
+    run_input(line, interactiveArena);
+  }
+  free(line);
+  notify_jobs(&state, stdout);
+  rl_set_prompt(input_prompt());
+  start_input_timer();
+}
+
+/*
+ * The lines after the first of a compound command get a prompt like PS2
+ */
+static const char* input_prompt(void)
+{
+  return pendingInput.len > 0 ? "> " : cwd_prompt();
+}
+
+/*
+ * Arm the TMOUT timer for the prompt being shown
+ */
+static void start_input_timer(void)
+{
+  const char* tmout = getenv("TMOUT");
+  long seconds = tmout != NULL ? strtol(tmout, NULL, 10) : 0;
+  inputDeadline = seconds > 0 ? monotonic_seconds() + (double)seconds : 0;
+}
+
+/*
+ * Ctrl+C at the prompt drops the line being typed and starts a new one
+ */
+static void cancel_input(void)
+{
+  histsearch_cancel();
+  shell_interrupted = 0;
+  pendingInput.len = 0;
+  rl_set_prompt(cwd_prompt());
+  rl_callback_sigcleanup();
+  rl_echo_signal_char(SIGINT);
+  rl_replace_line("", 0);
+  rl_crlf();
+  rl_on_new_line();
+  rl_redisplay();
+  start_input_timer();
+}
+
+/*
+ * Print the background jobs that finished or stopped while the user is
+ * typing, then draw the prompt and the partial line again below them
+ */
+static void report_jobs(void)
+{
+  char* text = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&text, &len);
+  if(out == NULL)
+  {
+    return;
+  }
+  notify_jobs(&state, out);
+  fclose(out);
+  if(len > 0)
+  {
+    rl_clear_visible_line();
+    fwrite(text, 1, len, stdout);
+    fflush(stdout);
+    rl_on_new_line();
+    rl_redisplay();
+  }
+  free(text);
+}
+
+/*
+ * Run every line read from fd back to back, no prompt and no history.
+ * Returns the status of the last command.
+ */
+static int run_batch(int fd, Arena* arena)
+{
+  LineReader reader;
+  reader_init(&reader, fd, READER_BUFSIZE);
+  reader.wait = wait_input;
+
+  char* line;
+  while((line = reader_next(&reader)) != NULL)
+  {
     stripwhite(line);
+    if (*line)
+    {
+      // Commands reading our stdin continue after this line
+      if(fd == STDIN_FILENO)
+      {
+        reader_sync(&reader);
+      }
+      run_input(line, arena);
+      notify_jobs(&state, NULL);
+    }
+  }
+  finish_input();
+  reader_free(&reader);
+  return shell_status;
+}
 
-    // If stripped line not blank
+/*
+ * Run the lines of a -c argument, returns the status of the last command
+ */
+static int run_string(const char* commands, Arena* arena)
+{
+  char* copy = strdup(commands);
+  char* line = copy;
+  while(line != NULL)
+  {
+    char* nl = strchr(line, '\n');
+    if(nl != NULL)
+    {
+      *nl = 0;
+    }
+    stripwhite(line);
     if (*line)
     {
-      add_history(line);
+      run_input(line, arena);
+      notify_jobs(&state, NULL);
+    }
+    line = nl ? nl + 1 : NULL;
+  }
+  finish_input();
+  free(copy);
+  return shell_status;
+}
+
+/*
+ * Run one stripped, non-blank line of input. A line that starts a
+ * compound command or a function waits with the lines after it until the
+ * command is complete, then they are parsed once and run together.
+ */
+static void run_input(char* line, Arena* arena)
+{
+  if(pendingInput.len == 0 && script_plain(line)){
+    run_line(line, arena);
+    return;
+  }
+  capture_append(&pendingInput, line, strlen(line));
+  // Kept NUL-terminated for run_script, the NUL isn't part of len
+  capture_append(&pendingInput, "\n", 2);
+  pendingInput.len--;
+  shell_interrupted = 0;
+  int parsed = script_run(pendingInput.data, arena);
+  if(parsed == 0){
+    return;
+  }
+  pendingInput.len = 0;
+  if(parsed == -1){
+    printf("Parse ERROR\n");
+    shell_status = 2;
+  }
+  arena_reset(arena);
+}
 
-      Command cmd;
-      if (parse(line, &cmd) == 1)
+/*
+ * End of input, a compound command still open is an error
+ */
+static void finish_input(void)
+{
+  if(pendingInput.len > 0){
+    printf("Parse ERROR\n");
+    shell_status = 2;
+    pendingInput.len = 0;
+  }
+}
+
+/*
+ * Parse and run one stripped, non-blank line
+ */
+static void run_line(char* line, Arena* arena)
+{
+  Command cmd;
+  double parseStart = TRACE_ON ? trace_now() : 0;
+  int parsed = parse(line, &cmd, arena);
+  if(TRACE_ON){
+    trace_complete("parse", line, 0, parseStart, trace_now());
+  }
+  if (parsed == 1)
+  {
+    run_list(&cmd, arena);
+  }
+  else
+  {
+    printf("Parse ERROR\n");
+    shell_status = 2;
+  }
+  arena_reset(arena);
+}
+
+/*
+ * Run the commands of a parsed line in order, returns the last status
+ */
+int run_list(Command* cmd, Arena* arena)
+{
+  // Ctrl+C abandons the rest of the line
+  shell_interrupted = 0;
+  for(Command* c = cmd; c != NULL; c = c->next)
+  {
+    shell_status = run_command(c, arena);
+    if(shell_interrupted)
+    {
+      break;
+    }
+    // Skip commands until one whose connector matches the status,
+    // so `a && b || c` runs c when a fails
+    while(c->next != NULL && ((c->connector == CONNECT_AND && shell_status != 0)
+                              || (c->connector == CONNECT_OR && shell_status == 0)))
+    {
+      c = c->next;
+    }
+  }
+  return shell_status;
+}
+
+/*
+ * Run one command of a line, a pipeline or a builtin, and return its
+ * exit status
+ */
+int run_command(Command* cmd, Arena* arena)
+{
+  if(expand_substitutions(cmd, arena) == -1){
+    return 2;
+  }
+  if(shell_interrupted){
+    return 128 + SIGINT;
+  }
+  if(cmd->pgm->pgmlist[0] == NULL){
+    // Only a $(...) that printed nothing, its status is the result
+    return shell_status;
+  }
+  // The stages of a pipeline take their NAME=value when they are started
+  SavedVar* saved = NULL;
+  size_t savedCount = 0;
+  if((cmd->pgm->flags & PGM_ASSIGN) && cmd->pgm->next == NULL){
+    savedCount = take_assignments(cmd->pgm, 0, &saved);
+    if(cmd->pgm->pgmlist[0] == NULL){
+      return 0;
+    }
+  }
+  TimeStart start;
+  int timed = strip_time(cmd);
+  if(timed){
+    time_start(&start);
+    timeStages = 1;
+  }
+  //print_cmd(cmd);
+  // If a foreground process is started, it should be terminated on SIGINT
+  int status = 0;
+  if(strip_pipesize(cmd) == -1){
+    status = 2;
+  }
+  // No command left for `time` on its own
+  else if(cmd->pgm->pgmlist[0] != NULL)
+  {
+    // A function runs in the shell, it has to be a command of its own
+    ShellFunction* function = NULL;
+    if(script_has_functions() && cmd->pgm->next == NULL && !cmd->background){
+      function = script_function(cmd->pgm->pgmlist[0]);
+    }
+    const Builtin* builtin = builtin_find(cmd->pgm->pgmlist[0]);
+    if(function != NULL){
+      status = script_call(cmd, function, arena);
+    }
+    else {
+      switch(builtin != NULL ? builtin->id : BUILTIN_NONE)
       {
-        exit_handler(&cmd);
-        //print_cmd(&cmd);
-        // If a foreground process is started, it should be terminated on SIGINT
-        if(handle_cd(&cmd) == 0)
-        {
-          //print_cmd(&cmd);
-          int retCode = handle_command(&cmd);
-          if(retCode == -1){
-            printf("Command failed\n");
-          }
+      case BUILTIN_EXIT:
+        exit_handler(cmd);
+        break;
+      case BUILTIN_CD:
+        handle_cd(cmd, &status);
+        break;
+      case BUILTIN_HASH:
+        handle_hash(cmd);
+        break;
+      case BUILTIN_JOBS:
+      case BUILTIN_FG:
+      case BUILTIN_BG:
+      case BUILTIN_WAIT:
+        handle_jobs(&state, cmd, &status);
+        break;
+      case BUILTIN_KILL:
+        status = handle_kill(&state, cmd);
+        break;
+      case BUILTIN_PARALLEL:
+        status = handle_parallel(&state, cmd);
+        break;
+      case BUILTIN_SET:
+        status = handle_set(cmd);
+        break;
+      case BUILTIN_EXPORT:
+        status = handle_export(cmd);
+        break;
+      case BUILTIN_UNSET:
+        status = handle_unset(cmd);
+        break;
+      case BUILTIN_BREAK:
+      case BUILTIN_CONTINUE:
+      case BUILTIN_RETURN:
+        status = handle_flow(cmd, builtin->id);
+        break;
+      default:
+        //print_cmd(cmd);
+        if(builtin != NULL && cmd->pgm->next == NULL && !cmd->background){
+          // Nothing to run concurrently with, no need for a child
+          status = run_builtin(cmd, builtin);
+          break;
+        }
+        status = handle_command(cmd);
+        if(status == -1){
+          printf("Command failed\n");
+          status = 1;
         }
       }
-      else
+    }
+  }
+  if(timed){
+    timeStages = 0;
+    time_report(&start, stderr);
+  }
+  if(saved != NULL){
+    restore_vars(saved, savedCount);
+  }
+  return status;
+}
+
+/*
+ * Wait until fd has input, reaping children that change state meanwhile.
+ * Returns -1 if polling failed.
+ */
+static int wait_input(int fd)
+{
+  struct pollfd fds[2] = {
+    {.fd = fd, .events = POLLIN},
+    {.fd = state.sigfd, .events = POLLIN},
+  };
+  for(;;)
+  {
+    if(poll(fds, 2, -1) == -1)
+    {
+      if(errno == EINTR)
       {
-        printf("Parse ERROR\n");
+        continue;
       }
+      return -1;
+    }
+    if(fds[1].revents & POLLIN)
+    {
+      reap_children(&state);
+    }
+    if(fds[0].revents)
+    {
+      return 0;
     }
-
-    // Clear memory
-    free(line);
   }
-  return EXIT_SUCCESS;
 }
 
 /*
@@ -102,15 +634,25 @@ int main(void)
  */
 void init_signals()
 {
-  // Ctrl+c should not terminate shell
-  if(signal(SIGINT, handle_sigint) == SIG_ERR)
+  // Ctrl+c should not terminate shell. No SA_RESTART, a cat running in
+  // the shell has to see EINTR to stop.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigint;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGINT, &action, NULL) == -1)
   {
     printf("Unable to initialize SIGINT handler\n");
   }
-  // On child change wait for them and kill
-  if(signal(SIGCHLD, handle_child) == SIG_ERR)
+  // A cat or tee in the shell gets EPIPE instead of killing the shell
+  if(signal(SIGPIPE, SIG_IGN) == SIG_ERR)
   {
-    printf("Unable to initialize SIGCHLD handler\n");
+    printf("Couldn't ignore SIGPIPE signal\n");
+  }
+  // Ctrl+z stops the foreground job, not the shell
+  if(signal(SIGTSTP, SIG_IGN) == SIG_ERR)
+  {
+    printf("Couldn't ignore SIGTSTP signal\n");
   }
   // Used to kill child processes when terminal exits, 
   // but should not kill the terminal itself i.e terminal should exit gracefully
@@ -120,65 +662,107 @@ void init_signals()
   }
 }
 
-char* get_path(char* cwd)
-{
-  char* end = cwd;
-  getcwd(cwd, 1024 * sizeof(char));
-  while(*end++ != 0);
-  end--;
-  *end++ = '>';
-  *end++ = ' ';
-  *end++ = 0;
-  int numSlashes = 0;
-  while(numSlashes < 2 && end > cwd)
-  {
-    if(*end-- == '/')
-    {
-      numSlashes++;
-    }
-  }
-  *end = '$';
-  //printf(end);
-  return end;
-}
-
 /*
  * If cd command -> execute cd and return 1
  * else return 0
  */
-int handle_cd(Command* cmd)
+int handle_cd(Command* cmd, int* status)
 {
   if(strcmp(cmd->pgm->pgmlist[0], "cd") == 0)
   {
-    int retVal = chdir(cmd->pgm->pgmlist[1]);
+    // Without an argument go home, like other shells
+    const char* dir = cmd->pgm->pgmlist[1];
+    if(dir == NULL)
+    {
+      dir = getenv("HOME") != NULL ? getenv("HOME") : "/";
+    }
+    int retVal = cwd_change(dir);
     if(retVal == -1)
     {
       printf("cd: No such file or directory\n");
     }
+    *status = retVal == -1 ? 1 : 0;
     return 1;
   }
   return 0;
 }
 
-
-
 /*
- * Handle command passed to the shell
- * Returns a foreground process pid if started,
- * if a background process is started 0 is returned
-*/
-int execute_command(Pgm* pgm)
+ * If hash command -> list, clear or fill the command location cache
+ * and return 1, else return 0
+ */
+int handle_hash(Command* cmd)
 {
-  // Remove signal handlers for child processes -> handled by shell process
-  signal(SIGCHLD, SIG_IGN);
-  // All child processes can be gracefully terminated when the shell exits
-  signal(SIGHUP, child_exit);
-  int status = execvp(pgm->pgmlist[0], pgm->pgmlist);
-  exit(status);
+  char** argv = cmd->pgm->pgmlist;
+  if(strcmp(argv[0], "hash") != 0)
+  {
+    return 0;
+  }
+  if(argv[1] == NULL)
+  {
+    pathcache_print(stdout);
+    return 1;
+  }
+  for(int i = 1; argv[i] != NULL; i++)
+  {
+    if(strcmp(argv[i], "-r") == 0)
+    {
+      pathcache_clear();
+    }
+    else if(pathcache_remember(argv[i]) == NULL)
+    {
+      printf("hash: %s: not found\n", argv[i]);
+    }
+  }
+  return 1;
 }
 
 
+/*
+ * Run a builtin that is the whole command line in the shell, with its
+ * redirections. Returns its exit status.
+ */
+int run_builtin(Command* cmd, const Builtin* builtin)
+{
+  int fileIn = -1;
+  int fileOut = -1;
+  if(setInputOutput(cmd, &fileIn, &fileOut) == -1){
+    return 1;
+  }
+  // None of the builtins read their input
+  close_fd(fileIn);
 
+  FILE* out = stdout;
+  char* captured = NULL;
+  size_t capturedLen = 0;
+  if(fileOut >= 0){
+    out = fdopen(fileOut, "w");
+    if(out == NULL){
+      printf("%s: %s\n", cmd->rstdout, strerror(errno));
+      close(fileOut);
+      return 1;
+    }
+  }
+  else if(shell_capture != NULL){
+    out = open_memstream(&captured, &capturedLen);
+  }
+  double start = TRACE_ON ? trace_now() : 0;
+  int status = builtin->fn(cmd->pgm->pgmlist, out);
+  if(TRACE_ON){
+    trace_complete("builtin", builtin->name, 0, start, trace_now());
+  }
+  if(out != stdout){
+    fclose(out);
+    if(captured != NULL){
+      capture_append(shell_capture, captured, capturedLen);
+      free(captured);
+    }
+  }
+  else {
+    fflush(stdout);
+  }
+  return status;
+}
 int handle_command(Command* cmd)
 {  
   return setup_command_chain(cmd);
@@ -189,105 +773,420 @@ int setup_command_chain(Command* cmd)
 {
   int size = (int)get_numberOfCommands(cmd);
   int index = size;
-  // Safe guard
-  assert(size < 16);
   
   Pgm* pgm = cmd->pgm;
   
-  int prevPipefd[2];
-  int newPipefd[2];
-  pid_t children[size];
+  // Output of the shell must come before the output of its children
+  fflush(stdout);
+
+  int fileIn = -1;
+  int fileOut = -1;
+  if(setInputOutput(cmd, &fileIn, &fileOut) == -1){
+    return -1;
+  }
+
+  // In a $(...) the last command writes to a pipe the shell drains
+  int captureIn = -1;
+  if(fileOut == -1 && shell_capture != NULL){
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) == -1){
+      printf("Failed to create pipe: %s\n", strerror(errno));
+      close_fd(fileIn);
+      return -1;
+    }
+    captureIn = fds[0];
+    fileOut = fds[1];
+  }
+
+  // pipes[i] connects command i + 1 to command i + 2
+  int (*pipes)[2] = create_pipes(size - 1, pipelinePipeSize);
+  if(pipes == NULL){
+    struct rlimit limit;
+    // The limit is left alone, raising it would raise it for every command
+    if(errno == EMFILE && getrlimit(RLIMIT_NOFILE, &limit) == 0){
+      printf("Too many stages: %d stages need more open files than ulimit -n %lu allows\n",
+             size, (unsigned long)limit.rlim_cur);
+    }
+    else {
+      printf("Failed to create pipe: %s\n", strerror(errno));
+    }
+    close_fd(fileIn);
+    close_fd(fileOut);
+    close_fd(captureIn);
+    return -1;
+  }
+
+  char* cmdline = command_string(cmd);
+  Job* job = add_job(&state, cmdline, cmd->background);
+  free(cmdline);
+  // The cgroup of a limited job exists before its first stage starts
+  const JobLimits* limits = settings_bg_limits();
+  int limited = cmd->background && joblimits_active(limits);
+  if(limited){
+    job->cgroup = joblimits_create_group(limits);
+  }
+  // Status of a pipeline is the status of its last command
+  int lastFailed = 0;
+
+  // A single cat or tee of a foreground pipeline runs in the shell itself,
+  // any other mover gets a forked child without an exec. Not in a $(...),
+  // the shell couldn't drain the capture pipe while it copies.
+  int moverInShell = !cmd->background && shell_capture == NULL && count_movers(cmd) == 1;
+  char** moverArgv = NULL;
+  SpawnStage moverStage = {-1, -1, 0};
+  size_t moverIndex = 0;
   
+  placement_start(size);
+  // The Pgm list is in reversed order, start with the last command
   while(index > 0){
-    // Create new pipe
-    pipe(newPipefd);
-    //Fork shell process
-    pid_t process = fork();
-    
-    if(process == -1){
-      printf("Failed to fork\n");
-      exit(-1);
-    }
-
-    if(process == 0){
-      // Background processes will ignore SIGINT
-      childProc_setSig(cmd);
-      setInputOutput(cmd, index, size);
-
-      //newPipe-> w|r **currCmd** w|r <-prevPipe
-      close(prevPipefd[0]); //Close read end - not used by this command
-      close(newPipefd[1]); //Close new write end - not used by this command
-      if(index > 1 && size != 1){
-        // process - should redirect sdtin to read end of pipe.
-        dup2(newPipefd[0], STDIN_FILENO);
+    // The pipes are close-on-exec, each command only keeps the two ends
+    // that become its stdin and stdout
+    SpawnStage stage = {
+      .inFd = index > 1 ? pipes[index - 2][0] : fileIn,
+      .outFd = index < size ? pipes[index - 1][1] : fileOut,
+      .background = cmd->background,
+    };
+    SavedVar* saved = NULL;
+    size_t savedCount = 0;
+    if((pgm->flags & PGM_ASSIGN) && size > 1){
+      savedCount = take_assignments(pgm, 1, &saved);
+    }
+    if(moverInShell && saved == NULL && mover_kind(pgm->pgmlist) != MOVER_NONE){
+      // Started once the other stages are running
+      moverArgv = pgm->pgmlist;
+      moverStage = stage;
+      moverIndex = add_shell_stage(job, pgm->pgmlist[0]);
+      if(index == size){
+        job->lastStage = (long)moverIndex;
+      }
+      pgm = pgm->next;
+      index--;
+      continue;
+    }
+    pid_t process = spawn_any(pgm->pgmlist, &stage);
+    if(saved != NULL){
+      restore_vars(saved, savedCount);
+    }
+    if(process != -1){
+      placement_apply(process, index - 1, size);
+      if(limited){
+        joblimits_apply(process, job->cgroup, limits);
       }
-      if(index < size && size != 1){
-        // process - should redirect sdtin to read end of pipe.
-        dup2(prevPipefd[1], STDOUT_FILENO); //Redir stdout to write end of pipe
+      if(index == size){
+        job->lastStage = (long)job->numChildren;
       }
-      return execute_command(pgm);
+      add_child(&state, job, process, pgm->pgmlist[0]);
+    }
+    else if(index == size){
+      // jobs, wait and fg report 127 like the foreground does
+      job->lastStage = -1;
+      lastFailed = 1;
     }
-    
-    // Close prev fds for shell process
-    close(prevPipefd[0]);
-    close(prevPipefd[1]);
-    prevPipefd[0] = newPipefd[0];
-    prevPipefd[1] = newPipefd[1];
 
     pgm = pgm->next;
-    children[--index] = process;
+    index--;
   }
-  // Close new fds for shell process
-  close(newPipefd[0]);
-  close(newPipefd[1]);
-  if(cmd->background == 0){
-    return wait_children(children, size);
+
+  if(moverArgv != NULL){
+    // The mover only sees end of file once the shell holds no other
+    // write end of its input pipe
+    close_pipes(pipes, size - 1, moverStage.inFd, moverStage.outFd);
+    struct rusage before;
+    struct rusage after;
+    getrusage(RUSAGE_THREAD, &before);
+    double moverStart = TRACE_ON ? trace_now() : 0;
+    int moverStatus = mover_run(moverArgv,
+                                moverStage.inFd >= 0 ? moverStage.inFd : STDIN_FILENO,
+                                moverStage.outFd >= 0 ? moverStage.outFd : STDOUT_FILENO);
+    if(shell_interrupted){
+      moverStatus = 128 + SIGINT;
+    }
+    if(TRACE_ON){
+      trace_complete("mover", moverArgv[0], 0, moverStart, trace_now());
+    }
+    getrusage(RUSAGE_THREAD, &after);
+    rusage_delta(&before, &after);
+    finish_shell_stage(job, moverIndex, moverStatus, &after);
   }
-  return 0;
+  // Close all fds for shell process
+  close_pipes(pipes, size - 1, -1, -1);
+  close_fd(fileIn);
+  close_fd(fileOut);
+  if(captureIn != -1){
+    // End of file once every stage holding the write end has exited
+    capture_read(shell_capture, captureIn);
+    close(captureIn);
+  }
+
+  if(job->numChildren == 0){
+    remove_job(&state, job);
+    return 127;
+  }
+  if(cmd->background){
+    if(interactive){
+      printf("[%d] %d\n", job->id, job->children[0].pid);
+    }
+    return 0;
+  }
+  double waitStart = TRACE_ON ? trace_now() : 0;
+  int status = wait_job(&state, job);
+  if(TRACE_ON){
+    trace_complete("wait", job->cmdline, 0, waitStart, trace_now());
+  }
+  if(job->state == JOB_DONE){
+    if(timeStages){
+      print_job_usage(job, stderr);
+    }
+    if(stageSummary){
+      print_job_summary(job, stderr);
+    }
+    remove_job(&state, job);
+  }
+  else {
+    // Stopped with Ctrl+z, reported before the next prompt
+    printf("\n");
+  }
+  return lastFailed ? 127 : status;
 }
 
 /*
- * Wait for all child processes specified in children
-*/
-int wait_children(const pid_t* children, int size)
+ * Remove a leading `time` from the first command of a pipeline.
+ * Returns 1 if there was one. The first command is the last Pgm.
+ */
+static int strip_time(Command* cmd)
 {
-  int retStatus = 0;
-  int status = 0;
-  for(int i = 0; i < size; i++){
-    pid_t cpid = children[i];
-    waitpid(cpid, &status, 0);
-    if(status != 0 && status != SIGINT){
-      printf("%s\n", strerror(status));
-      retStatus = status;
+  Pgm* first = cmd->pgm;
+  while(first->next != NULL){
+    first = first->next;
+  }
+  if(strcmp(first->pgmlist[0], "time") != 0){
+    return 0;
+  }
+  // Other stages can't be fed by an empty command, leave it to PATH
+  if(first->pgmlist[1] == NULL && first != cmd->pgm){
+    return 0;
+  }
+  first->pgmlist++;
+  return 1;
+}
+
+/*
+ * Remove a leading `pipesize size` from the first command of a pipeline
+ * and use that size for its pipes. Returns 1 if there was one, -1 after
+ * printing an error.
+ */
+static int strip_pipesize(Command* cmd)
+{
+  Pgm* first = cmd->pgm;
+  while(first->next != NULL){
+    first = first->next;
+  }
+  pipelinePipeSize = settings_pipe_size();
+  if(first->pgmlist[0] == NULL || strcmp(first->pgmlist[0], "pipesize") != 0){
+    return 0;
+  }
+  if(first->pgmlist[1] == NULL || first->pgmlist[2] == NULL){
+    printf("pipesize: usage: pipesize size command [| command ...]\n");
+    return -1;
+  }
+  long size = pipe_size_parse(first->pgmlist[1]);
+  if(size == -1){
+    printf("pipesize: %s: invalid size\n", first->pgmlist[1]);
+    return -1;
+  }
+  pipelinePipeSize = size;
+  first->pgmlist += 2;
+  return 1;
+}
+
+static void time_start(TimeStart* start)
+{
+  start->wall = monotonic_seconds();
+  getrusage(RUSAGE_SELF, &start->self);
+  getrusage(RUSAGE_CHILDREN, &start->children);
+}
+
+static double timeval_seconds(struct timeval tv)
+{
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/*
+ * Print what the timed command line used, the shell's own work (cat, tee
+ * and builtins) included. Same format as bash.
+ */
+static void time_report(const TimeStart* start, FILE* out)
+{
+  struct rusage self;
+  struct rusage children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+
+  double times[3];
+  times[0] = monotonic_seconds() - start->wall;
+  times[1] = timeval_seconds(self.ru_utime) - timeval_seconds(start->self.ru_utime)
+    + timeval_seconds(children.ru_utime) - timeval_seconds(start->children.ru_utime);
+  times[2] = timeval_seconds(self.ru_stime) - timeval_seconds(start->self.ru_stime)
+    + timeval_seconds(children.ru_stime) - timeval_seconds(start->children.ru_stime);
+
+  const char* names[] = {"real", "user", "sys"};
+  fprintf(out, "\n");
+  for(int i = 0; i < 3; i++){
+    int minutes = (int)(times[i] / 60);
+    fprintf(out, "%s\t%dm%.3fs\n", names[i], minutes, times[i] - minutes * 60);
+  }
+}
+
+/*
+ * Turn after into the usage between before and after. Max RSS is a peak,
+ * it is kept as is.
+ */
+static void rusage_delta(const struct rusage* before, struct rusage* after)
+{
+  timersub(&after->ru_utime, &before->ru_utime, &after->ru_utime);
+  timersub(&after->ru_stime, &before->ru_stime, &after->ru_stime);
+  after->ru_nvcsw -= before->ru_nvcsw;
+  after->ru_nivcsw -= before->ru_nivcsw;
+}
+
+/*
+ * Close the pipes of a pipeline, except the two ends a mover running in
+ * the shell still uses. Closed ends are set to -1.
+ */
+static void close_pipes(int (*pipes)[2], int count, int keepIn, int keepOut)
+{
+  for(int i = 0; i < count; i++){
+    for(int end = 0; end < 2; end++){
+      int fd = pipes[i][end];
+      if(fd >= 0 && fd != keepIn && fd != keepOut){
+        close(fd);
+        pipes[i][end] = -1;
+      }
     }
   }
-  return retStatus;
 }
 
-void childProc_setSig(Command* cmd)
+/*
+ * Number of stages that are cat or tee builtins, see mover.h
+ */
+static int count_movers(Command* cmd)
 {
-  if(cmd->background){
-    signal(SIGINT, SIG_IGN);
+  int movers = 0;
+  for(Pgm* pgm = cmd->pgm; pgm != NULL; pgm = pgm->next){
+    if(mover_kind(pgm->pgmlist) != MOVER_NONE){
+      movers++;
+    }
   }
-  else {
-    signal(SIGINT, SIG_DFL);
+  return movers;
+}
+
+/*
+ * Create all pipes of a pipeline up front, with O_CLOEXEC and a capacity
+ * of size bytes (0 for the default). A pipe that can't be resized keeps
+ * its default capacity. The array is reused and grows with the longest
+ * pipeline seen. Returns NULL if the pipes could not be created.
+ */
+static int (*create_pipes(int count, long size))[2]
+{
+  static int (*pipes)[2] = NULL;
+  static int capacity = 0;
+
+  // Never NULL on success, even for a single command without pipes
+  if(count > capacity || pipes == NULL){
+    capacity = count > 2 * capacity ? count : 2 * capacity + 4;
+    pipes = realloc(pipes, (size_t)capacity * sizeof(*pipes));
   }
+  for(int i = 0; i < count; i++){
+    if(pipe2(pipes[i], O_CLOEXEC) == -1){
+      int err = errno;
+      while(i-- > 0){
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+      }
+      errno = err;
+      return NULL;
+    }
+    if(pipe_resize(pipes[i][1], size) == -1){
+      // Once per pipeline, the others fail the same way
+      printf("pipesize: %ld: %s\n", size, strerror(errno));
+      fflush(stdout);
+      size = 0;
+    }
+  }
+  return pipes;
 }
 
-void setInputOutput(Command* cmd, int index, int size)
+/*
+ * Text of a parsed command line, as shown by jobs.
+ * The caller frees the returned string.
+ */
+char* command_string(Command* cmd)
 {
-  if(cmd->rstdout && index == size){
+  char* text = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&text, &size);
+
+  // The Pgm list is in reversed order
+  size_t numPgms = get_numberOfCommands(cmd);
+  Pgm* pgms[numPgms];
+  Pgm* pgm = cmd->pgm;
+  for(size_t i = numPgms; i > 0; i--){
+    pgms[i - 1] = pgm;
+    pgm = pgm->next;
+  }
+  for(size_t i = 0; i < numPgms; i++){
+    for(char** arg = pgms[i]->pgmlist; *arg; arg++){
+      fprintf(out, arg == pgms[i]->pgmlist ? "%s" : " %s", *arg);
+    }
+    if(i + 1 < numPgms){
+      fprintf(out, " | ");
+    }
+  }
+  if(cmd->rstdin){
+    fprintf(out, " < %s", cmd->rstdin);
+  }
+  if(cmd->rstdout){
+    fprintf(out, " > %s", cmd->rstdout);
+  }
+  if(cmd->background){
+    fprintf(out, " &");
+  }
+  fclose(out);
+  return text;
+}
+
+/*
+ * Open the redirection files of cmd in the shell, the spawned commands
+ * get them through dup2. Returns -1 if a file could not be opened.
+ */
+int setInputOutput(Command* cmd, int* fileIn, int* fileOut)
+{
+  if(cmd->rstdout){
     //Redirect output to file
-    int fileOut = open(cmd->rstdout, O_WRONLY | O_CREAT, S_IRWXU);
-    dup2(fileOut, STDOUT_FILENO);
-    close(fileOut);
+    *fileOut = open(cmd->rstdout, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+    if(*fileOut == -1){
+      printf("%s: %s\n", cmd->rstdout, strerror(errno));
+      return -1;
+    }
   }
 
-  if(index == 1 && cmd->rstdin){
+  if(cmd->rstdin){
     // Input file content to command
-    int fileIn = open(cmd->rstdin, O_RDONLY, S_IRWXU);
-    dup2(fileIn, STDIN_FILENO);
-    close(fileIn);
+    *fileIn = open(cmd->rstdin, O_RDONLY | O_CLOEXEC);
+    if(*fileIn == -1){
+      printf("%s: %s\n", cmd->rstdin, strerror(errno));
+      close_fd(*fileOut);
+      *fileOut = -1;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void close_fd(int fd)
+{
+  if(fd >= 0){
+    close(fd);
   }
 }
 
@@ -303,52 +1202,99 @@ size_t get_numberOfCommands(Command* cmd)
 }
 
 
+/*
+ * Returns 1 if the command can be found in PATH
+ */
 int check_command(Pgm* pgm)
 {
-  char* dupEnv = strdup(getenv("PATH"));
-  char* startSearch = dupEnv;
-  char* colon = NULL;
-  struct stat buf;
-  int found = 0;
-  char file[100];
-  do{
-    colon = strchr(startSearch, ':');
-    if(colon != NULL){
-      *colon = 0; //End string at colon
-    }
-    snprintf(file, 100, "%s/%s", startSearch, pgm->pgmlist[0]);
-   
-    stat(file, &buf);
-    found |= S_ISREG(buf.st_mode);
-    startSearch = colon + 1;
-  } while(colon != NULL);
-
-  free(dupEnv);
-  return found;
+  return pathcache_lookup(pgm->pgmlist[0]) != NULL;
 }
 
+/*
+ * Start argv as a process of its own: movers and builtins in a forked
+ * copy of the shell, there is nothing to exec, anything else from PATH
+ */
+pid_t spawn_any(char** argv, const SpawnStage* stage)
+{
+  int (*fn)(char** argv) = NULL;
+  const Builtin* builtin;
+  if(mover_kind(argv) != MOVER_NONE){
+    fn = mover_main;
+  }
+  else if((builtin = builtin_find(argv[0])) != NULL && builtin->fn != NULL){
+    fn = builtin_main;
+  }
+  if(fn == NULL){
+    return spawn_command(argv, stage);
+  }
+  pid_t process = spawn_call(fn, argv, stage);
+  if(process == -1){
+    printf("%s: %s\n", argv[0], strerror(errno));
+  }
+  return process;
+}
 
 /*
- * If a child process changes its state it's handled here
+ * Resolve argv[0] through the path cache and spawn it.
+ * A cached location that has disappeared is dropped and PATH is
+ * searched once more before giving up.
  */
-void handle_child()
+static pid_t spawn_command(char** argv, const SpawnStage* stage)
 {
-  //Kills background processes when they finish
-  pid_t child = 0;
-  int status = 0;
-  while((child = waitpid(0, &status, WNOHANG)) > 0){
-    // Should we do something with exit status of child process?
-    kill(child, SIGKILL);
+  double start = TRACE_ON ? trace_now() : 0;
+  const char* path = pathcache_lookup(argv[0]);
+  if(TRACE_ON){
+    double resolved = trace_now();
+    trace_complete("resolve", argv[0], 0, start, resolved);
+    start = resolved;
+  }
+  if(path == NULL){
+    printf("%s: command not found\n", argv[0]);
+    return -1;
   }
+  pid_t process = spawn_stage(spawnMode, path, argv, stage);
+  if(process == -1 && errno == ENOENT && strchr(argv[0], '/') == NULL){
+    pathcache_forget(argv[0]);
+    path = pathcache_lookup(argv[0]);
+    if(path != NULL){
+      process = spawn_stage(spawnMode, path, argv, stage);
+    }
+    else {
+      errno = ENOENT;
+    }
+  }
+  if(TRACE_ON){
+    int err = errno;
+    trace_complete("spawn", argv[0], 0, start, trace_now());
+    errno = err;
+  }
+  if(process == -1){
+    printf("%s: %s\n", argv[0], strerror(errno));
+  }
+  return process;
 }
 
+
+/*
+ * exit [status]: leave with status, or with the status of the last
+ * command without one, so that -c and scripts report it
+ */
 void exit_handler(Command* cmd)
 {
-  if(strcmp(cmd->pgm->pgmlist[0], "exit") == 0)
+  char** argv = cmd->pgm->pgmlist;
+  long status = shell_status;
+  if(argv[1] != NULL)
   {
-    killpg(0, SIGHUP);
-    exit(0);
+    char* end;
+    status = strtol(argv[1], &end, 10);
+    if(end == argv[1] || *end != '\0')
+    {
+      printf("exit: %s: invalid number\n", argv[1]);
+      status = 2;
+    }
   }
+  signal_jobs(&state, SIGHUP);
+  exit((int)(status & 0xff));
 }
 
 /* 
@@ -356,14 +1302,8 @@ void exit_handler(Command* cmd)
  * and kill foreground child processes.
  */
 void handle_sigint()
-{}
-
-/*
- * Gracefully terminate child processes when shell exits
- */
-void child_exit()
 {
-  _exit(0); // Not sure if som status should be used here??
+  shell_interrupted = 1;
 }
 
 /*
@@ -425,6 +1365,11 @@ void stripwhite(char *string)
 {
   size_t i = 0;
 
+  if (*string == '\0')
+  {
+    return;
+  }
+
   while (isspace(string[i]))
   {
     i++;
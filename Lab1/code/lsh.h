@@ -5,6 +5,8 @@
 #include <time.h>
 
 #include "parse.h"
+#include "builtin.h"
+#include "spawn.h"
 
 
 
@@ -13,23 +15,26 @@ void stripwhite(char *);
 void init_signals();
 //Signal handlers
 void handle_sigint();
-void child_exit();
-void handle_child();
 void exit_handler(Command* cmd);
 
-int execute_command(Pgm* pgm);
-int execute_command_background(Pgm* pgm);
+// Status of the last command, $?
+extern int shell_status;
+
+int run_list(Command* cmd, Arena* arena);
+int run_command(Command* cmd, Arena* arena);
 int handle_command(Command* cmd);
 int check_command(Pgm* pgm);
-int handle_cd(Command* cmd);
+int handle_cd(Command* cmd, int* status);
+int handle_hash(Command* cmd);
+int run_builtin(Command* cmd, const Builtin* builtin);
 
-// Fork form shell
+// Spawn from shell
 int setup_command_chain(Command* cmd);
-void childProc_setSig(Command* cmd);
-void setInputOutput(Command* cmd, int index, int size);
-int wait_children(const pid_t* children, int size);
+int setInputOutput(Command* cmd, int* fileIn, int* fileOut);
+pid_t spawn_any(char** argv, const SpawnStage* stage);
+char* command_string(Command* cmd);
+void close_fd(int fd);
 
 
 size_t get_numberOfCommands(Command* cmd);
-char* get_path(char* cwd);
-#endif
\ No newline at end of file
+#endif
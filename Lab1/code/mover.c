@@ -0,0 +1,502 @@
+/*
+ * Zero-copy cat and tee.
+ *
+ * `cat file | cmd` or `cat < in > out` would otherwise fork and exec an
+ * external cat and copy every byte through user space twice. Here the
+ * bytes stay in the kernel: copy_file_range between regular files,
+ * splice when one side is a pipe, sendfile from a regular file to
+ * anything else, and read/write only as the last resort.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "mover.h"
+#include "interrupt.h"
+
+// Bytes asked for per splice/tee, the pipe capacity limits it anyway
+#define SPLICE_CHUNK (1 << 20)
+// Bytes asked for per copy_file_range/sendfile call
+#define COPY_CHUNK (1 << 30)
+#define RW_BUFSIZE (128 * 1024)
+
+// Result of a fast path that can't handle the fds, nothing was moved yet
+#define MOVE_UNSUPPORTED 1
+
+/*
+ * Retry an interrupted call unless the user pressed Ctrl+c
+ */
+static int retry(void)
+{
+  return errno == EINTR && !shell_interrupted;
+}
+
+/*
+ * Checked between calls, a copy between fast fds never blocks and so
+ * never sees EINTR
+ */
+static int interrupted(void)
+{
+  if (shell_interrupted)
+  {
+    errno = EINTR;
+    return 1;
+  }
+  return 0;
+}
+
+static int copy_range(int inFd, int outFd)
+{
+  size_t moved = 0;
+  for (;;)
+  {
+    if (interrupted())
+    {
+      return -1;
+    }
+    ssize_t n = copy_file_range(inFd, NULL, outFd, NULL, COPY_CHUNK, 0);
+    if (n == 0)
+    {
+      return 0;
+    }
+    if (n > 0)
+    {
+      moved += (size_t)n;
+      continue;
+    }
+    if (retry())
+    {
+      continue;
+    }
+    // Other file systems, same file, O_APPEND output or an old kernel
+    if (moved == 0 && (errno == EXDEV || errno == EINVAL || errno == EBADF || errno == ENOSYS || errno == EOPNOTSUPP))
+    {
+      return MOVE_UNSUPPORTED;
+    }
+    return -1;
+  }
+}
+
+static int splice_all(int inFd, int outFd)
+{
+  size_t moved = 0;
+  for (;;)
+  {
+    if (interrupted())
+    {
+      return -1;
+    }
+    ssize_t n = splice(inFd, NULL, outFd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE);
+    if (n == 0)
+    {
+      return 0;
+    }
+    if (n > 0)
+    {
+      moved += (size_t)n;
+      continue;
+    }
+    if (retry())
+    {
+      continue;
+    }
+    if (moved == 0 && errno == EINVAL)
+    {
+      return MOVE_UNSUPPORTED;
+    }
+    return -1;
+  }
+}
+
+static int send_all(int inFd, int outFd)
+{
+  size_t moved = 0;
+  for (;;)
+  {
+    if (interrupted())
+    {
+      return -1;
+    }
+    ssize_t n = sendfile(outFd, inFd, NULL, COPY_CHUNK);
+    if (n == 0)
+    {
+      return 0;
+    }
+    if (n > 0)
+    {
+      moved += (size_t)n;
+      continue;
+    }
+    if (retry())
+    {
+      continue;
+    }
+    if (moved == 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+      return MOVE_UNSUPPORTED;
+    }
+    return -1;
+  }
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (retry())
+      {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/*
+ * Plain read/write loop, writes every chunk to all outFds
+ */
+static int copy_rw(int inFd, const int *outFds, int numOut)
+{
+  char buf[RW_BUFSIZE];
+  for (;;)
+  {
+    if (interrupted())
+    {
+      return -1;
+    }
+    ssize_t n = read(inFd, buf, sizeof(buf));
+    if (n == 0)
+    {
+      return 0;
+    }
+    if (n < 0)
+    {
+      if (retry())
+      {
+        continue;
+      }
+      return -1;
+    }
+    for (int i = 0; i < numOut; i++)
+    {
+      if (write_all(outFds[i], buf, (size_t)n) == -1)
+      {
+        return -1;
+      }
+    }
+  }
+}
+
+/*
+ * Move everything from inFd to outFd with the cheapest method the two
+ * fds allow. Returns 0, or -1 with errno set.
+ */
+int move_fd(int inFd, int outFd)
+{
+  struct stat in;
+  struct stat out;
+  int ret = MOVE_UNSUPPORTED;
+
+  if (fstat(inFd, &in) == -1 || fstat(outFd, &out) == -1)
+  {
+    return -1;
+  }
+  if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode))
+  {
+    ret = copy_range(inFd, outFd);
+  }
+  if (ret == MOVE_UNSUPPORTED && (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode)))
+  {
+    ret = splice_all(inFd, outFd);
+  }
+  if (ret == MOVE_UNSUPPORTED && S_ISREG(in.st_mode))
+  {
+    ret = send_all(inFd, outFd);
+  }
+  if (ret == MOVE_UNSUPPORTED)
+  {
+    ret = copy_rw(inFd, &outFd, 1);
+  }
+  return ret;
+}
+
+static int is_fifo(int fd)
+{
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/*
+ * Drain len bytes, already tee'd elsewhere, from the pipe inFd into fileFd
+ * with read/write
+ */
+static int drain_rw(int inFd, int fileFd, size_t len)
+{
+  char buf[RW_BUFSIZE];
+  while (len > 0)
+  {
+    ssize_t n = read(inFd, buf, len < sizeof(buf) ? len : sizeof(buf));
+    if (n <= 0)
+    {
+      if (n < 0 && retry())
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (write_all(fileFd, buf, (size_t)n) == -1)
+    {
+      return -1;
+    }
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/*
+ * Duplicate a pipe into another pipe and a file without copying:
+ * tee(2) clones the pipe buffers into outFd, splice then drains the
+ * same bytes from inFd into the file. splice can't write to an O_APPEND
+ * file (tee -a), such a file gets them with read/write.
+ */
+static int tee_pipe(int inFd, int outFd, int fileFd)
+{
+  int flags = fcntl(fileFd, F_GETFL);
+  int useSplice = flags != -1 && !(flags & O_APPEND);
+  for (;;)
+  {
+    if (interrupted())
+    {
+      return -1;
+    }
+    ssize_t n = tee(inFd, outFd, SPLICE_CHUNK, 0);
+    if (n == 0)
+    {
+      return 0;
+    }
+    if (n < 0)
+    {
+      if (retry())
+      {
+        continue;
+      }
+      return -1;
+    }
+    while (n > 0 && useSplice)
+    {
+      ssize_t m = splice(inFd, NULL, fileFd, NULL, (size_t)n, SPLICE_F_MOVE);
+      if (m < 0)
+      {
+        if (retry())
+        {
+          continue;
+        }
+        if (errno != EINVAL)
+        {
+          return -1;
+        }
+        useSplice = 0;
+        break;
+      }
+      n -= m;
+    }
+    if (n > 0 && drain_rw(inFd, fileFd, (size_t)n) == -1)
+    {
+      return -1;
+    }
+  }
+}
+
+/*
+ * Report a failed move, returns the exit status of the mover. A closed
+ * reader or Ctrl+c ends it quietly, like the signals end the external
+ * programs.
+ */
+static int move_failed(const char *prog, const char *file)
+{
+  if (errno == EPIPE)
+  {
+    return 128 + SIGPIPE;
+  }
+  if (errno == EINTR)
+  {
+    return 128 + SIGINT;
+  }
+  if (file != NULL)
+  {
+    fprintf(stderr, "%s: %s: %s\n", prog, file, strerror(errno));
+  }
+  else
+  {
+    fprintf(stderr, "%s: %s\n", prog, strerror(errno));
+  }
+  return 1;
+}
+
+static int run_cat(char **argv, int inFd, int outFd)
+{
+  int status = 0;
+  if (argv[1] == NULL)
+  {
+    return move_fd(inFd, outFd) == -1 ? move_failed("cat", NULL) : 0;
+  }
+  for (int i = 1; argv[i] != NULL && !shell_interrupted; i++)
+  {
+    int fd = inFd;
+    if (strcmp(argv[i], "-") != 0)
+    {
+      fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+      {
+        status = move_failed("cat", argv[i]);
+        continue;
+      }
+    }
+    int ret = move_fd(fd, outFd);
+    if (ret == -1)
+    {
+      status = move_failed("cat", argv[i]);
+    }
+    if (fd != inFd)
+    {
+      close(fd);
+    }
+    if (ret == -1 && errno == EPIPE)
+    {
+      break;
+    }
+  }
+  return status;
+}
+
+static int run_tee(char **argv, int inFd, int outFd)
+{
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+  int status = 0;
+  int i = 1;
+
+  if (argv[1] != NULL && strcmp(argv[1], "-a") == 0)
+  {
+    flags |= O_APPEND;
+    i++;
+  }
+  else
+  {
+    flags |= O_TRUNC;
+  }
+
+  // outFds[0] is stdout, the files follow
+  int numOut = 1;
+  for (int j = i; argv[j] != NULL; j++)
+  {
+    numOut++;
+  }
+  int outFds[numOut];
+  outFds[0] = outFd;
+  numOut = 1;
+  for (; argv[i] != NULL; i++)
+  {
+    int fd = open(argv[i], flags, 0666);
+    if (fd == -1)
+    {
+      fprintf(stderr, "tee: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    outFds[numOut++] = fd;
+  }
+
+  int ret;
+  if (numOut == 1)
+  {
+    ret = move_fd(inFd, outFd);
+  }
+  else if (numOut == 2 && is_fifo(inFd) && is_fifo(outFd))
+  {
+    ret = tee_pipe(inFd, outFd, outFds[1]);
+  }
+  else
+  {
+    ret = copy_rw(inFd, outFds, numOut);
+  }
+  if (ret == -1)
+  {
+    status = move_failed("tee", NULL);
+  }
+  for (int j = 1; j < numOut; j++)
+  {
+    close(outFds[j]);
+  }
+  return status;
+}
+
+/*
+ * Which mover argv is, MOVER_NONE if it needs the real program
+ */
+MoverKind mover_kind(char **argv)
+{
+  MoverKind kind;
+  int i = 1;
+
+  if (strcmp(argv[0], "cat") == 0)
+  {
+    kind = MOVER_CAT;
+  }
+  else if (strcmp(argv[0], "tee") == 0)
+  {
+    kind = MOVER_TEE;
+    if (argv[1] != NULL && strcmp(argv[1], "-a") == 0)
+    {
+      i++;
+    }
+  }
+  else
+  {
+    return MOVER_NONE;
+  }
+  // Options are left to the real programs
+  for (; argv[i] != NULL; i++)
+  {
+    if (argv[i][0] == '-' && argv[i][1] != '\0')
+    {
+      return MOVER_NONE;
+    }
+  }
+  return kind;
+}
+
+/*
+ * Run a mover reading inFd and writing outFd, returns its exit status
+ */
+int mover_run(char **argv, int inFd, int outFd)
+{
+  switch (mover_kind(argv))
+  {
+  case MOVER_CAT:
+    return run_cat(argv, inFd, outFd);
+  case MOVER_TEE:
+    return run_tee(argv, inFd, outFd);
+  default:
+    return 127;
+  }
+}
+
+/*
+ * Entry point of a mover in a child process, see spawn_call
+ */
+int mover_main(char **argv)
+{
+  return mover_run(argv, STDIN_FILENO, STDOUT_FILENO);
+}
@@ -0,0 +1,20 @@
+#ifndef MOVER_INC
+#define MOVER_INC
+
+/*
+ * Builtins that only move bytes between file descriptors (cat and tee).
+ * They run inside the pipeline wiring without an exec and let the kernel
+ * move the data with splice, tee and copy_file_range.
+ */
+typedef enum
+{
+  MOVER_NONE, // Not a mover, or options the builtin doesn't handle
+  MOVER_CAT,
+  MOVER_TEE
+} MoverKind;
+
+MoverKind mover_kind(char **argv);
+int mover_run(char **argv, int inFd, int outFd);
+int mover_main(char **argv);
+int move_fd(int inFd, int outFd);
+#endif
@@ -0,0 +1,242 @@
+/*
+ * The parallel builtin, see parallel.h
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "lsh.h"
+#include "interrupt.h"
+
+/*
+ * Copy of arg with every {} replaced by input, NULL if arg has no {}
+ */
+static char* replace_braces(const char* arg, const char* input)
+{
+  if(strstr(arg, "{}") == NULL){
+    return NULL;
+  }
+  size_t inputLen = strlen(input);
+  size_t count = 0;
+  for(const char* p = arg; (p = strstr(p, "{}")) != NULL; p += 2){
+    count++;
+  }
+  char* result = malloc(strlen(arg) + count * inputLen + 1);
+  char* out = result;
+  for(const char* p = arg; *p != '\0';){
+    if(p[0] == '{' && p[1] == '}'){
+      memcpy(out, input, inputLen);
+      out += inputLen;
+      p += 2;
+    }
+    else {
+      *out++ = *p++;
+    }
+  }
+  *out = '\0';
+  return result;
+}
+
+/*
+ * Lines of path as a NULL-terminated array, NULL if it can't be read
+ */
+static char** read_lines(const char* path, size_t* count)
+{
+  FILE* file = fopen(path, "r");
+  if(file == NULL){
+    return NULL;
+  }
+  size_t cap = 64;
+  char** lines = malloc(cap * sizeof(char*));
+  char* line = NULL;
+  size_t lineCap = 0;
+  ssize_t len;
+  *count = 0;
+  while((len = getline(&line, &lineCap, file)) != -1){
+    if(len > 0 && line[len - 1] == '\n'){
+      line[len - 1] = '\0';
+    }
+    if(*count + 1 == cap){
+      cap *= 2;
+      lines = realloc(lines, cap * sizeof(char*));
+    }
+    lines[(*count)++] = strdup(line);
+  }
+  lines[*count] = NULL;
+  free(line);
+  fclose(file);
+  return lines;
+}
+
+/*
+ * parallel [-j N] cmd [arg ...] ::: input ... or :::: file
+ * Runs cmd once per input (or line of file), with the input in place of
+ * every {} in the arguments or appended to them. N of them (default: one
+ * per online CPU) run at a time and the next one starts as soon as one
+ * exits. The run is a single job; the exit status is the number of failed
+ * commands, 101 for more than 100, and the throughput goes to stderr.
+ */
+int handle_parallel(ProgramState* state, Command* cmd)
+{
+  char** argv = cmd->pgm->pgmlist;
+  long slots = sysconf(_SC_NPROCESSORS_ONLN);
+  int i = 1;
+
+  if(argv[i] != NULL && strncmp(argv[i], "-j", 2) == 0)
+  {
+    const char* n = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+    char* end;
+    slots = n != NULL ? strtol(n, &end, 10) : 0;
+    if(n == NULL || *end != '\0' || slots <= 0)
+    {
+      printf("parallel: -j needs a positive number\n");
+      return 2;
+    }
+    i++;
+  }
+  if(slots <= 0)
+  {
+    slots = 1;
+  }
+  int first = i;
+  int sep = first;
+  while(argv[sep] != NULL && strcmp(argv[sep], ":::") != 0 && strcmp(argv[sep], "::::") != 0)
+  {
+    sep++;
+  }
+  if(sep == first || argv[sep] == NULL)
+  {
+    printf("parallel: usage: parallel [-j N] cmd [arg ...] ::: input ... | :::: file\n");
+    return 2;
+  }
+
+  char** inputs = &argv[sep + 1];
+  char** lines = NULL;
+  size_t numInputs = 0;
+  if(strcmp(argv[sep], "::::") == 0)
+  {
+    if(argv[sep + 1] == NULL || (lines = read_lines(argv[sep + 1], &numInputs)) == NULL)
+    {
+      printf("parallel: %s: %s\n", argv[sep + 1] ? argv[sep + 1] : "", argv[sep + 1] ? strerror(errno) : "file expected");
+      return 2;
+    }
+    inputs = lines;
+  }
+  else
+  {
+    while(inputs[numInputs] != NULL)
+    {
+      numInputs++;
+    }
+  }
+
+  int fileIn = -1;
+  int fileOut = -1;
+  if(setInputOutput(cmd, &fileIn, &fileOut) == -1)
+  {
+    return 1;
+  }
+  fflush(stdout);
+  // All commands share stdin and stdout, like commands started with &
+  SpawnStage stage = {.inFd = fileIn, .outFd = fileOut, .background = 0};
+  char* cmdline = command_string(cmd);
+  Job* job = add_job(state, cmdline, 0);
+  free(cmdline);
+
+  int numArgs = sep - first;
+  char** jobArgv = malloc((numArgs + 2) * sizeof(char*));
+  char** replaced = calloc(numArgs, sizeof(char*));
+  size_t next = 0;
+  int stopped = 0;
+  double start = monotonic_seconds();
+  shell_interrupted = 0;
+
+  while(next < numInputs && !shell_interrupted)
+  {
+    if(job->numAlive >= (size_t)slots)
+    {
+      if(wait_job_slot(state, job, (size_t)slots) == -1)
+      {
+        stopped = 1;
+        break;
+      }
+      continue;
+    }
+    int braces = 0;
+    for(int a = 0; a < numArgs; a++)
+    {
+      replaced[a] = replace_braces(argv[first + a], inputs[next]);
+      braces |= replaced[a] != NULL;
+      jobArgv[a] = replaced[a] != NULL ? replaced[a] : argv[first + a];
+    }
+    jobArgv[numArgs] = braces ? NULL : inputs[next];
+    jobArgv[numArgs + 1] = NULL;
+    pid_t process = spawn_any(jobArgv, &stage);
+    if(process != -1)
+    {
+      add_child(state, job, process, jobArgv[0]);
+    }
+    for(int a = 0; a < numArgs; a++)
+    {
+      free(replaced[a]);
+    }
+    if(process == -1)
+    {
+      // The next inputs wouldn't fare any better
+      break;
+    }
+    next++;
+  }
+  free(replaced);
+  free(jobArgv);
+  if(lines != NULL)
+  {
+    for(size_t l = 0; l < numInputs; l++)
+    {
+      free(lines[l]);
+    }
+    free(lines);
+  }
+  close_fd(fileIn);
+  close_fd(fileOut);
+
+  if(!stopped && job->numAlive > 0 && wait_job(state, job) == 128 + SIGTSTP)
+  {
+    stopped = 1;
+  }
+  if(stopped)
+  {
+    // Stopped with Ctrl+z, the running commands continue with fg
+    printf("\nparallel: stopped, %zu inputs not started\n", numInputs - next);
+    return 128 + SIGTSTP;
+  }
+
+  double wall = monotonic_seconds() - start;
+  double cpu = 0;
+  size_t failed = next < numInputs ? numInputs - next : 0;
+  for(size_t c = 0; c < job->numChildren; c++)
+  {
+    struct rusage* usage = &job->children[c].usage;
+    cpu += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6
+      + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+    if(exit_status(job->children[c].status) != 0)
+    {
+      failed++;
+    }
+  }
+  fflush(stdout);
+  fprintf(stderr, "parallel: %zu jobs, %zu failed, %d at a time, %.3fs, %.1f jobs/s, %.2f CPUs busy\n",
+          job->numChildren, failed, (int)slots, wall,
+          wall > 0 ? job->numChildren / wall : 0.0, wall > 0 ? cpu / wall : 0.0);
+  remove_job(state, job);
+  if(shell_interrupted)
+  {
+    return 128 + SIGINT;
+  }
+  return failed > 100 ? 101 : (int)failed;
+}
@@ -0,0 +1,13 @@
+#ifndef PARALLEL_INC
+#define PARALLEL_INC
+#include "parse.h"
+#include "ProgramState.h"
+
+/*
+ * parallel [-j N] cmd [arg ...] ::: input ... | :::: file (parallel.c)
+ *
+ * Runs cmd once per input, a limited number at a time, as one job of the
+ * job table. The commands are started like pipeline stages.
+ */
+int handle_parallel(ProgramState* state, Command* cmd);
+#endif
@@ -1,29 +1,78 @@
 /* This file contains the code for parser used to parse the input
- * given to shell program. You shouldn't need to modify this
- * file */
+ * given to shell program. All tokens and Pgm:s are allocated from an
+ * arena supplied by the caller, so the parser keeps no state of its own
+ * and lines can be of any length. */
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
-#include <ctype.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "parse.h"
 
 #define PIPE ('|')
 #define BG ('&')
 #define RIN ('<')
 #define RUT ('>')
+#define SEQ (';')
+
+/* Character classes, the lexer does one table lookup per character */
+#define CC_SPACE 0x01  /* isspace in the C locale */
+#define CC_SPEC 0x02   /* Operator */
+#define CC_ID 0x04     /* Allowed in a file name, see isidentifier */
+#define CC_END 0x08    /* Terminating NUL */
+#define CC_DOLLAR 0x10 /* Maybe the start of a $(...) */
+#define CC_GLOB 0x20   /* Wildcard, or a backslash escaping one */
+/* Characters the word scanner has to look at */
+#define CC_WORDSTOP (CC_SPACE | CC_SPEC | CC_END | CC_DOLLAR | CC_GLOB)
+
+static const unsigned char charclass[256] = {
+  ['\0'] = CC_END,
+  [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+  ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+  [PIPE] = CC_SPEC, [BG] = CC_SPEC, [RIN] = CC_SPEC, [RUT] = CC_SPEC, [SEQ] = CC_SPEC,
+  ['$'] = CC_DOLLAR,
+  ['*'] = CC_GLOB, ['?'] = CC_GLOB, ['['] = CC_GLOB, ['\\'] = CC_GLOB,
+  ['0' ... '9'] = CC_ID, ['A' ... 'Z'] = CC_ID, ['a' ... 'z'] = CC_ID,
+  ['_'] = CC_ID, ['-'] = CC_ID, ['.'] = CC_ID, [','] = CC_ID,
+  ['/'] = CC_ID, ['~'] = CC_ID, ['+'] = CC_ID,
+};
+
+#define charis(c, cls) (charclass[(unsigned char)(c)] & (cls))
 
 #define ispipe(c) ((c) == PIPE)
 #define isbg(c) ((c) == BG)
 #define isrin(c) ((c) == RIN)
 #define isrut(c) ((c) == RUT)
-#define isspec(c) (ispipe(c) || isbg(c) || isrin(c) || isrut(c))
+#define isseq(c) ((c) == SEQ)
+#define isspec(c) charis(c, CC_SPEC)
+
+/* Arena bytes reserved per input character before parsing, an estimate
+ * that keeps typical lines within a single arena block. It is not a
+ * bound: a line of one-character stages like a|a|a needs a Pgm and a
+ * pgmlist per two characters, more than this, and continues in an
+ * overflow block of the arena */
+#define PARSE_BYTES_PER_CHAR 32
 
-static Pgm cmdbuf[20], *cmds;
-static char cbuf[256], *cp;
-static char *pbuf[50], **pp;
+/* Initial size of a pgmlist, doubled when full */
+#define PGMLIST_INIT 4
+
+static void init_command(Command *c)
+{
+  c->rstdin = NULL;
+  c->rstdout = NULL;
+  c->rstderr = NULL;
+  c->background = false;
+  c->pgm = NULL;
+  c->connector = CONNECT_END;
+  c->next = NULL;
+}
 
-int parse(char *buf, Command *c)
+/* Parse a line into c and the commands chained to it by ;, &, && and ||,
+ * the extra Commands are allocated from the arena. */
+int parse(char *buf, Command *c, Arena *arena)
 {
   int n;
   Pgm *cmd0;
@@ -31,15 +80,11 @@ int parse(char *buf, Command *c)
   char *t = buf;
   char *tok;
 
-  init();
-  c->rstdin = NULL;
-  c->rstdout = NULL;
-  c->rstderr = NULL;
-  c->background = false;
-  c->pgm = NULL;
+  arena_reserve(arena, PARSE_BYTES_PER_CHAR * (strlen(buf) + 1));
+  init_command(c);
 
 newcmd:
-  if ((n = acmd(t, &cmd0)) <= 0)
+  if ((n = acmd(arena, t, &cmd0)) <= 0)
   {
     return -1;
   }
@@ -50,7 +95,7 @@ newcmd:
   c->pgm = cmd0;
 
 newtoken:
-  n = nexttoken(t, &tok);
+  n = nexttoken(arena, t, &tok);
   if (n == 0)
   {
     return 1;
@@ -60,26 +105,35 @@ newtoken:
   switch (*tok)
   {
   case PIPE:
+    if (tok[1] == PIPE)
+    {
+      c->connector = CONNECT_OR;
+      goto nextcommand;
+    }
     goto newcmd;
   case BG:
-    n = nexttoken(t, &tok);
-    if (n == 0)
+    if (tok[1] == BG)
     {
-      c->background = 1;
-      return 1;
+      c->connector = CONNECT_AND;
+      goto nextcommand;
     }
-    else
+    /* & ends the command like ; */
+    c->background = 1;
+    /* fall through */
+  case SEQ:
+    if (nexttoken(arena, t, &tok) == 0)
     {
-      fprintf(stderr, "illegal bakgrounding\n");
-      return -1;
+      return 1;
     }
+    c->connector = CONNECT_SEQ;
+    goto nextcommand;
   case RIN:
     if (c->rstdin != NULL)
     {
       fprintf(stderr, "duplicate redirection of stdin\n");
       return -1;
     }
-    if ((n = nexttoken(t, &(c->rstdin))) < 0)
+    if ((n = nexttoken(arena, t, &(c->rstdin))) <= 0)
     {
       return -1;
     }
@@ -96,7 +150,7 @@ newtoken:
       fprintf(stderr, "duplicate redirection of stdout\n");
       return -1;
     }
-    if ((n = nexttoken(t, &(c->rstdout))) < 0)
+    if ((n = nexttoken(arena, t, &(c->rstdout))) <= 0)
     {
       return -1;
     }
@@ -110,89 +164,225 @@ newtoken:
   default:
     return -1;
   }
+
+nextcommand:
+  {
+    Command *next = arena_alloc(arena, sizeof(Command));
+    init_command(next);
+    c->next = next;
+    c = next;
+  }
+  goto newcmd;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#ifdef __AVX2__
+#define LEX_BLOCK 32
+typedef __m256i lexvec;
+#define lex_load(p) _mm256_load_si256((const __m256i *)(p))
+#define lex_set1(c) _mm256_set1_epi8(c)
+#define lex_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define lex_or(a, b) _mm256_or_si256(a, b)
+#define lex_min(a, b) _mm256_min_epu8(a, b)
+#define lex_mask(v) ((uint32_t)_mm256_movemask_epi8(v))
+#else
+#define LEX_BLOCK 16
+typedef __m128i lexvec;
+#define lex_load(p) _mm_load_si128((const __m128i *)(p))
+#define lex_set1(c) _mm_set1_epi8(c)
+#define lex_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define lex_or(a, b) _mm_or_si128(a, b)
+#define lex_min(a, b) _mm_min_epu8(a, b)
+#define lex_mask(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+/* Whole blocks are read past the NUL, which ASan can't tell from an
+ * overflow */
+#define LEX_NO_ASAN __attribute__((no_sanitize_address))
+
+/* Bit i set if byte i of the aligned block may stop a word: a control
+ * character or space, an operator, '$' or a wildcard. The class table
+ * decides. */
+LEX_NO_ASAN static inline uint32_t stop_mask(const char *block)
+{
+  lexvec x = lex_load(block);
+  lexvec low = lex_eq(lex_min(x, lex_set1(' ')), x);
+  lexvec ops = lex_or(lex_or(lex_eq(x, lex_set1(PIPE)), lex_eq(x, lex_set1(BG))),
+                      lex_or(lex_eq(x, lex_set1(RIN)), lex_eq(x, lex_set1(RUT))));
+  ops = lex_or(ops, lex_or(lex_eq(x, lex_set1(SEQ)), lex_eq(x, lex_set1('$'))));
+  lexvec glob = lex_or(lex_or(lex_eq(x, lex_set1('*')), lex_eq(x, lex_set1('?'))),
+                       lex_or(lex_eq(x, lex_set1('[')), lex_eq(x, lex_set1('\\'))));
+  return lex_mask(lex_or(low, lex_or(ops, glob)));
 }
 
-void init(void)
+/* First character at or after s in class CC_WORDSTOP, a block at a time.
+ * Loads are aligned, so they never touch a page the string doesn't, and
+ * the bytes before s in the first block are masked off. */
+LEX_NO_ASAN static char *scan_word(char *s)
+{
+  uintptr_t offset = (uintptr_t)s & (LEX_BLOCK - 1);
+  char *block = s - offset;
+  uint32_t mask = stop_mask(block) & (UINT32_MAX << offset);
+  for (;;)
+  {
+    while (mask != 0)
+    {
+      char *p = block + __builtin_ctz(mask);
+      if (charis(*p, CC_WORDSTOP))
+      {
+        return p;
+      }
+      mask &= mask - 1;
+    }
+    block += LEX_BLOCK;
+    mask = stop_mask(block);
+  }
+}
+#else
+static char *scan_word(char *s)
 {
-  int i;
-  for (i = 0; i < 19; i++)
+  while (!charis(*s, CC_WORDSTOP))
   {
-    cmdbuf[i].next = &cmdbuf[i + 1];
+    s++;
   }
-  cmdbuf[19].next = NULL;
-  cmds = cmdbuf;
-  cp = cbuf;
-  pp = pbuf;
+  return s;
 }
+#endif
 
-int nexttoken(char *s, char **tok)
+/* Copy the next token of s into the arena and point *tok at it, set
+ * *expand if the word has anything run_command expands.
+ * Returns the number of characters consumed, 0 at end of line. */
+static int lex(Arena *arena, char *s, char **tok, bool *expand)
 {
   char *s0 = s;
-  char c;
+  char *start;
 
-  *tok = cp;
-  while (isspace(c = *s++) && c)
-    ;
-  if (c == '\0')
+  while (charis(*s, CC_SPACE))
+  {
+    s++;
+  }
+  if (*s == '\0')
   {
+    *tok = NULL;
     return 0;
   }
-  if (isspec(c))
+  start = s;
+  if (isspec(*s))
   {
-    *cp++ = c;
-    *cp++ = '\0';
+    /* && and || are single tokens */
+    if ((ispipe(*s) || isbg(*s)) && s[1] == *s)
+    {
+      s++;
+    }
+    s++;
   }
   else
   {
-    *cp++ = c;
-    do
+    for (;;)
     {
-      c = *cp++ = *s++;
-    } while (!isspace(c) && !isspec(c) && (c != '\0'));
-    --s;
-    --cp;
-    *cp++ = '\0';
+      s = scan_word(s);
+      if (charis(*s, CC_GLOB))
+      {
+        *expand = true;
+        s++;
+        continue;
+      }
+      if (*s != '$')
+      {
+        break;
+      }
+      *expand = true;
+      if (s[1] != '(')
+      {
+        s++;
+        continue;
+      }
+      /* A $(...) is part of the word, spaces and operators included.
+       * Unterminated it runs to the end of the line. */
+      int depth = 0;
+      s++;
+      do
+      {
+        depth += *s == '(';
+        depth -= *s == ')';
+        s++;
+      } while (*s != '\0' && depth > 0);
+    }
   }
+  *tok = arena_strndup(arena, start, (size_t)(s - start));
   return (int)(s - s0);
 }
 
-int acmd(char *s, Pgm **cmd)
+int nexttoken(Arena *arena, char *s, char **tok)
+{
+  bool expand;
+  return lex(arena, s, tok, &expand);
+}
+
+int acmd(Arena *arena, char *s, Pgm **cmd)
 {
   char *tok;
   int n, cnt = 0;
-  Pgm *cmd0 = cmds;
-  cmds = cmds->next;
-  cmd0->next = NULL;
-  cmd0->pgmlist = pp;
+  bool expand = false;
+  size_t argc = 0;
+  size_t cap = PGMLIST_INIT;
+  Pgm *cmd0 = arena_alloc(arena, sizeof(Pgm));
+  char **pl = arena_alloc(arena, cap * sizeof(char *));
 
 next:
-  n = nexttoken(s, &tok);
+  n = lex(arena, s, &tok, &expand);
   if (n == 0 || isspec(*tok))
   {
+    pl[argc] = NULL;
+    cmd0->pgmlist = pl;
+    cmd0->flags = expand ? PGM_EXPAND : 0;
+    if (argc > 0 && isassignment(pl[0]))
+    {
+      cmd0->flags |= PGM_ASSIGN;
+    }
+    cmd0->next = NULL;
     *cmd = cmd0;
-    *pp++ = NULL;
     return cnt;
   }
   else
   {
-    *pp++ = tok;
+    // Keep room for the terminating NULL
+    if (argc + 1 == cap)
+    {
+      char **grown = arena_alloc(arena, 2 * cap * sizeof(char *));
+      memcpy(grown, pl, argc * sizeof(char *));
+      pl = grown;
+      cap *= 2;
+    }
+    pl[argc++] = tok;
     cnt += n;
     s += n;
     goto next;
   }
 }
 
-#define IDCHARS "_-.,/~+"
-
+/* Letters, digits and _-.,/~+ */
 int isidentifier(char *s)
 {
-  while (*s)
+  while (charis(*s, CC_ID))
+  {
+    s++;
+  }
+  return *s == '\0';
+}
+
+/* NAME=value: a letter or _, then letters, digits and _ up to the = */
+int isassignment(const char *s)
+{
+  if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_'))
+  {
+    return false;
+  }
+  while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') || *s == '_')
   {
-    char *p = strrchr(IDCHARS, *s);
-    if (!isalnum(*s++) && (p == NULL))
-      return 0;
+    s++;
   }
-  return 1;
+  return *s == '=';
 }
 
 /* Print a (linked) list of Pgm:s.
@@ -1,11 +1,28 @@
 #ifndef PARSE_INC
 #define PARSE_INC
+#include "arena.h"
+
+/* Pgm flags, set by the tokenizer so that running a command needs no
+ * second look at its words */
+#define PGM_EXPAND 0x1 /* A word has a $, a wildcard or a backslash */
+#define PGM_ASSIGN 0x2 /* The first word is NAME=value */
+
 typedef struct c
 {
   char **pgmlist;
+  int flags;
   struct c *next;
 } Pgm;
 
+/* How a command is joined to the next one of the line */
+typedef enum
+{
+  CONNECT_END, /* Last command of the line */
+  CONNECT_SEQ, /* ; or &, the next one always runs */
+  CONNECT_AND, /* &&, the next one runs if this one succeeded */
+  CONNECT_OR   /* ||, the next one runs if this one failed */
+} Connector;
+
 typedef struct node
 {
   Pgm *pgm;
@@ -13,11 +30,13 @@ typedef struct node
   char *rstdout;
   char *rstderr;
   int background;
+  Connector connector;
+  struct node *next; /* Next command of the line, in order */
 } Command;
 
-extern void init(void);
-extern int parse(char *, Command *);
-extern int nexttoken(char *, char **);
-extern int acmd(char *, Pgm **);
+extern int parse(char *, Command *, Arena *);
+extern int nexttoken(Arena *, char *, char **);
+extern int acmd(Arena *, char *, Pgm **);
 extern int isidentifier(char *);
+extern int isassignment(const char *);
 #endif
@@ -0,0 +1,257 @@
+/*
+ * Command location cache.
+ *
+ * execvp walks $PATH and tries every directory on each launch. Here the
+ * walk is done once per command name, the absolute path is stored in an
+ * open addressing hash table and the command is exec'd directly after that.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+
+// Same default search path as execvp when PATH is unset
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+typedef struct
+{
+  char* name; // NULL if the slot has never been used
+  char* path; // NULL together with a name marks a removed entry
+  unsigned hash;
+  unsigned hits;
+} PathEntry;
+
+static PathEntry* table;
+static size_t capacity;
+static size_t used; // Live and removed entries, drives resizing
+static size_t count;
+
+// PATH the table was filled from, any change flushes the table
+static char* cachedPath;
+
+// Holds lookups that can't be cached, i.e. found through a relative dir
+static char* scratch;
+static size_t scratchSize;
+
+static unsigned hash_name(const char* s)
+{
+  // FNV-1a
+  unsigned h = 2166136261u;
+  while(*s){
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void free_entries(void)
+{
+  for(size_t i = 0; i < capacity; i++){
+    free(table[i].name);
+    free(table[i].path);
+  }
+  memset(table, 0, capacity * sizeof(PathEntry));
+  used = 0;
+  count = 0;
+}
+
+static PathEntry* find_slot(const char* name, unsigned hash)
+{
+  PathEntry* removed = NULL;
+  size_t mask = capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask){
+    PathEntry* e = &table[i];
+    if(e->name == NULL){
+      return removed ? removed : e;
+    }
+    if(e->path == NULL){
+      if(removed == NULL){
+        removed = e;
+      }
+    }
+    else if(e->hash == hash && strcmp(e->name, name) == 0){
+      return e;
+    }
+  }
+}
+
+static void grow(void)
+{
+  PathEntry* old = table;
+  size_t oldCapacity = capacity;
+
+  capacity = capacity ? capacity * 2 : 64;
+  table = calloc(capacity, sizeof(PathEntry));
+  used = 0;
+  count = 0;
+  for(size_t i = 0; i < oldCapacity; i++){
+    if(old[i].path == NULL){
+      free(old[i].name);
+      continue;
+    }
+    *find_slot(old[i].name, old[i].hash) = old[i];
+    used++;
+    count++;
+  }
+  free(old);
+}
+
+/*
+ * Flush the table if PATH is not what it was filled from.
+ * Only a string compare, no syscalls.
+ */
+static const char* check_path(void)
+{
+  const char* path = getenv("PATH");
+  if(path == NULL){
+    path = DEFAULT_PATH;
+  }
+  if(cachedPath == NULL || strcmp(cachedPath, path) != 0){
+    pathcache_clear();
+    free(cachedPath);
+    cachedPath = strdup(path);
+  }
+  return path;
+}
+
+static char* scratch_reserve(size_t size)
+{
+  if(size > scratchSize){
+    scratchSize = size * 2;
+    free(scratch);
+    scratch = malloc(scratchSize);
+  }
+  return scratch;
+}
+
+/*
+ * Walk PATH for name, one stat per directory.
+ * The result is left in the scratch buffer. Sets *absolute when it was
+ * found through an absolute directory and may be cached.
+ */
+static const char* search_path(const char* path, const char* name, int* absolute)
+{
+  size_t nameLen = strlen(name);
+  const char* dir = path;
+  struct stat buf;
+
+  for(;;){
+    const char* colon = strchr(dir, ':');
+    size_t dirLen = colon ? (size_t)(colon - dir) : strlen(dir);
+    char* file = scratch_reserve(dirLen + nameLen + 3);
+
+    // An empty entry means the current directory
+    if(dirLen == 0){
+      memcpy(file, ".", 1);
+      dirLen = 1;
+    }
+    else {
+      memcpy(file, dir, dirLen);
+    }
+    file[dirLen] = '/';
+    memcpy(file + dirLen + 1, name, nameLen + 1);
+
+    if(stat(file, &buf) == 0 && S_ISREG(buf.st_mode) && (buf.st_mode & 0111)){
+      *absolute = file[0] == '/';
+      return file;
+    }
+    if(colon == NULL){
+      return NULL;
+    }
+    dir = colon + 1;
+  }
+}
+
+static const char* lookup(const char* name, int countHit)
+{
+  // Paths are exec'd as given
+  if(strchr(name, '/') != NULL){
+    return name;
+  }
+  const char* path = check_path();
+
+  if(used + 1 > capacity * 7 / 10){
+    grow();
+  }
+  unsigned hash = hash_name(name);
+  PathEntry* e = find_slot(name, hash);
+  if(e->name != NULL && e->path != NULL){
+    e->hits += countHit;
+    return e->path;
+  }
+
+  int absolute = 0;
+  const char* file = search_path(path, name, &absolute);
+  if(file == NULL || !absolute){
+    // Relative results depend on the cwd and are resolved every time
+    return file;
+  }
+  if(e->name == NULL){
+    used++;
+  }
+  free(e->name);
+  e->name = strdup(name);
+  e->path = strdup(file);
+  e->hash = hash;
+  e->hits = countHit;
+  count++;
+  return e->path;
+}
+
+/*
+ * Absolute path to run for the command name, NULL if it isn't in PATH.
+ * The returned string is valid until the next call.
+ */
+const char* pathcache_lookup(const char* name)
+{
+  return lookup(name, 1);
+}
+
+/*
+ * Resolve name into the cache without counting it as a use (hash name)
+ */
+const char* pathcache_remember(const char* name)
+{
+  return lookup(name, 0);
+}
+
+/*
+ * Drop name from the cache, e.g. when exec of the cached path failed
+ */
+void pathcache_forget(const char* name)
+{
+  if(count == 0){
+    return;
+  }
+  PathEntry* e = find_slot(name, hash_name(name));
+  if(e->name != NULL && e->path != NULL){
+    free(e->path);
+    e->path = NULL;
+    count--;
+  }
+}
+
+void pathcache_clear(void)
+{
+  if(table != NULL){
+    free_entries();
+  }
+}
+
+/*
+ * List the cached commands in the same format as bash's hash builtin
+ */
+void pathcache_print(FILE* out)
+{
+  if(count == 0){
+    fprintf(out, "hash: hash table empty\n");
+    return;
+  }
+  fprintf(out, "hits\tcommand\n");
+  for(size_t i = 0; i < capacity; i++){
+    if(table[i].name != NULL && table[i].path != NULL){
+      fprintf(out, "%4u\t%s\n", table[i].hits, table[i].path);
+    }
+  }
+}
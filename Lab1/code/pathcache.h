@@ -0,0 +1,15 @@
+#ifndef PATHCACHE_INC
+#define PATHCACHE_INC
+#include <stdio.h>
+
+/*
+ * Hashed command locations, works like the hash builtin in bash.
+ * A command is looked up in $PATH once and the absolute path is reused
+ * until PATH changes, the cache is cleared or exec reports ENOENT.
+ */
+const char* pathcache_lookup(const char* name);
+const char* pathcache_remember(const char* name);
+void pathcache_forget(const char* name);
+void pathcache_clear(void);
+void pathcache_print(FILE* out);
+#endif
@@ -0,0 +1,322 @@
+/*
+ * Placement of pipeline stages on CPUs, see placement.h.
+ *
+ * The topology is read from sysfs the first time a policy is set: the
+ * CPUs the shell may run on, the L2 and last level cache each of them
+ * shares and the NUMA node it belongs to. The CPUs are sorted so that
+ * CPUs sharing caches are next to each other, and pipelines take them in
+ * that order. A stage is pinned with sched_setaffinity right after it is
+ * spawned, whatever the spawn mode.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "placement.h"
+
+#define SYS_CPU "/sys/devices/system/cpu"
+#define SYS_NODE "/sys/devices/system/node"
+
+typedef struct
+{
+  int cpu;
+  int node;
+  int llc; // Lowest CPU sharing the last level cache with cpu
+  int l2;  // Lowest CPU sharing the L2 with cpu
+} CpuInfo;
+
+// CPUs the shell may run on, in topology order
+static CpuInfo* cpus = NULL;
+static int numCpus = 0;
+
+static Placement policy = PLACEMENT_OFF;
+static int node = -1;
+// The CPUs of node, or all of them, are cpus[first] to cpus[first + count - 1]
+static int first = 0;
+static int count = 0;
+// Stages placed so far, the next pipeline continues from here
+static unsigned cursor = 0;
+
+/*
+ * Parse a cpulist like "0-3,8,10-11" from a sysfs file into set.
+ * Returns the lowest CPU, -1 if the file can't be read.
+ */
+static int read_cpulist(const char* path, cpu_set_t* set)
+{
+  FILE* f = fopen(path, "re");
+  if(f == NULL){
+    return -1;
+  }
+  char line[4096];
+  char* s = fgets(line, sizeof(line), f);
+  fclose(f);
+  if(s == NULL){
+    return -1;
+  }
+  CPU_ZERO(set);
+  int lowest = -1;
+  while(*s >= '0' && *s <= '9'){
+    char* end;
+    long lo = strtol(s, &end, 10);
+    long hi = lo;
+    if(*end == '-'){
+      hi = strtol(end + 1, &end, 10);
+    }
+    for(long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++){
+      CPU_SET((int)cpu, set);
+    }
+    if(lowest == -1 || lo < lowest){
+      lowest = (int)lo;
+    }
+    s = *end == ',' ? end + 1 : end;
+  }
+  return lowest;
+}
+
+static int read_int(const char* path)
+{
+  FILE* f = fopen(path, "re");
+  if(f == NULL){
+    return -1;
+  }
+  int value = -1;
+  if(fscanf(f, "%d", &value) != 1){
+    value = -1;
+  }
+  fclose(f);
+  return value;
+}
+
+/*
+ * Fill in the L2 and last level cache of info->cpu
+ */
+static void read_caches(CpuInfo* info)
+{
+  char path[256];
+  char type[32];
+  int llcLevel = 0;
+  info->l2 = info->cpu;
+  info->llc = info->cpu;
+  for(int index = 0;; index++){
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/level", info->cpu, index);
+    int level = read_int(path);
+    if(level == -1){
+      break;
+    }
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/type", info->cpu, index);
+    FILE* f = fopen(path, "re");
+    if(f == NULL){
+      continue;
+    }
+    int isInstruction = fgets(type, sizeof(type), f) != NULL
+      && strncmp(type, "Instruction", 11) == 0;
+    fclose(f);
+    if(isInstruction){
+      continue;
+    }
+    cpu_set_t shared;
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list", info->cpu, index);
+    int lowest = read_cpulist(path, &shared);
+    if(lowest == -1){
+      continue;
+    }
+    if(level == 2){
+      info->l2 = lowest;
+    }
+    if(level > llcLevel){
+      llcLevel = level;
+      info->llc = lowest;
+    }
+  }
+}
+
+/*
+ * Node, then last level cache, then L2: CPUs sharing more come together
+ */
+static int compare_cpus(const void* a, const void* b)
+{
+  const CpuInfo* x = a;
+  const CpuInfo* y = b;
+  if(x->node != y->node){
+    return x->node - y->node;
+  }
+  if(x->llc != y->llc){
+    return x->llc - y->llc;
+  }
+  if(x->l2 != y->l2){
+    return x->l2 - y->l2;
+  }
+  return x->cpu - y->cpu;
+}
+
+static int read_topology(void)
+{
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1){
+    return -1;
+  }
+  cpus = calloc((size_t)CPU_COUNT(&allowed), sizeof(CpuInfo));
+  if(cpus == NULL){
+    return -1;
+  }
+  for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+    if(CPU_ISSET(cpu, &allowed)){
+      CpuInfo* info = &cpus[numCpus++];
+      info->cpu = cpu;
+      read_caches(info);
+    }
+  }
+
+  // Without NUMA support in the kernel there is no node directory,
+  // every CPU stays on node 0
+  DIR* dir = opendir(SYS_NODE);
+  struct dirent* entry;
+  while(dir != NULL && (entry = readdir(dir)) != NULL){
+    int id;
+    char path[256 + sizeof(entry->d_name)];
+    cpu_set_t nodeCpus;
+    if(sscanf(entry->d_name, "node%d", &id) != 1){
+      continue;
+    }
+    snprintf(path, sizeof(path), SYS_NODE "/%s/cpulist", entry->d_name);
+    if(read_cpulist(path, &nodeCpus) == -1){
+      continue;
+    }
+    for(int i = 0; i < numCpus; i++){
+      if(CPU_ISSET(cpus[i].cpu, &nodeCpus)){
+        cpus[i].node = id;
+      }
+    }
+  }
+  if(dir != NULL){
+    closedir(dir);
+  }
+  qsort(cpus, (size_t)numCpus, sizeof(CpuInfo), compare_cpus);
+  return 0;
+}
+
+/*
+ * "off", "compact" or "spread", -1 for anything else
+ */
+int placement_parse(const char* text)
+{
+  if(strcmp(text, "off") == 0){
+    return PLACEMENT_OFF;
+  }
+  if(strcmp(text, "compact") == 0){
+    return PLACEMENT_COMPACT;
+  }
+  if(strcmp(text, "spread") == 0){
+    return PLACEMENT_SPREAD;
+  }
+  return -1;
+}
+
+const char* placement_name(Placement p)
+{
+  switch(p){
+  case PLACEMENT_COMPACT:
+    return "compact";
+  case PLACEMENT_SPREAD:
+    return "spread";
+  default:
+    return "off";
+  }
+}
+
+/*
+ * Set the policy and the NUMA node (-1 for any). Returns -1 with errno
+ * EINVAL if the shell may not run on any CPU of the node.
+ */
+int placement_set(Placement newPolicy, int newNode)
+{
+  if((newPolicy != PLACEMENT_OFF || newNode != -1) && cpus == NULL && read_topology() == -1){
+    return -1;
+  }
+  int newFirst = 0;
+  int newCount = numCpus;
+  if(newNode != -1){
+    while(newFirst < numCpus && cpus[newFirst].node != newNode){
+      newFirst++;
+    }
+    newCount = 0;
+    while(newFirst + newCount < numCpus && cpus[newFirst + newCount].node == newNode){
+      newCount++;
+    }
+    if(newCount == 0){
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  policy = newPolicy;
+  node = newNode;
+  first = newFirst;
+  count = newCount;
+  cursor = 0;
+  return 0;
+}
+
+Placement placement_policy(void)
+{
+  return policy;
+}
+
+int placement_node(void)
+{
+  return node;
+}
+
+/*
+ * Called before the stages of a pipeline are placed, moves on to the CPUs
+ * after the last pipeline's so that concurrent pipelines don't pile up
+ */
+void placement_start(int stages)
+{
+  if(policy != PLACEMENT_OFF && stages > 1){
+    cursor += (unsigned)stages;
+  }
+}
+
+/*
+ * Pin stage (0 for the first) of a pipeline of stages. Returns -1 if
+ * sched_setaffinity failed, e.g. because the stage already exited.
+ */
+int placement_apply(pid_t pid, int stage, int stages)
+{
+  if(count == 0 || ((policy == PLACEMENT_OFF || stages == 1) && node == -1)){
+    return 0;
+  }
+  const CpuInfo* range = cpus + first;
+  unsigned position = cursor - (unsigned)stages + (unsigned)stage;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if(policy == PLACEMENT_COMPACT && stages > 1){
+    CPU_SET(range[position % (unsigned)count].cpu, &set);
+  }
+  else if(policy == PLACEMENT_SPREAD && stages > 1){
+    int caches = 1;
+    for(int i = 1; i < count; i++){
+      caches += range[i].llc != range[i - 1].llc;
+    }
+    // CPUs of the cache are consecutive, find the first of them
+    int target = (int)(position % (unsigned)caches);
+    int i = 0;
+    for(int seen = 0; seen < target; i++){
+      seen += range[i + 1].llc != range[i].llc;
+    }
+    for(int llc = range[i].llc; i < count && range[i].llc == llc; i++){
+      CPU_SET(range[i].cpu, &set);
+    }
+  }
+  else {
+    // A single command, or no policy: anywhere on the node
+    for(int i = 0; i < count; i++){
+      CPU_SET(range[i].cpu, &set);
+    }
+  }
+  return sched_setaffinity(pid, sizeof(set), &set);
+}
@@ -0,0 +1,33 @@
+#ifndef PLACEMENT_INC
+#define PLACEMENT_INC
+#include <sys/types.h>
+
+/*
+ * Which CPUs the stages of a pipeline may run on (placement.c).
+ *
+ * PLACEMENT_COMPACT pins the stages of a pipeline to consecutive CPUs in
+ * topology order, so neighbouring stages share an L2 or at least the last
+ * level cache and a pipe's pages stay in it. PLACEMENT_SPREAD gives each
+ * stage a different last level cache, all of its CPUs, for stages that
+ * compete for cache more than they share data. A single command is never
+ * pinned, it has no neighbour to share a cache with.
+ *
+ * With a NUMA node set every stage stays on the CPUs of that node; the
+ * kernel allocates memory on the node a process runs on, so its memory
+ * follows.
+ */
+typedef enum
+{
+  PLACEMENT_OFF,
+  PLACEMENT_COMPACT,
+  PLACEMENT_SPREAD
+} Placement;
+
+int placement_parse(const char* text);
+const char* placement_name(Placement policy);
+int placement_set(Placement policy, int node);
+Placement placement_policy(void);
+int placement_node(void);
+void placement_start(int stages);
+int placement_apply(pid_t pid, int stage, int stages);
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Line reader used instead of readline when lsh is not interactive.
+ *
+ * No prompt, no history and no terminal handling, input is read in
+ * READER_BUFSIZE chunks and split into lines in place.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+
+void reader_init(LineReader *reader, int fd, size_t size)
+{
+  struct stat st;
+
+  reader->fd = fd;
+  reader->size = size;
+  reader->buf = malloc(size);
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = 0;
+  reader->wait = NULL;
+  reader->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+ * Read more input after the unconsumed bytes, growing the buffer if a
+ * single line doesn't fit. Returns 0 at end of input.
+ */
+static int fill(LineReader *reader)
+{
+  if (reader->start > 0)
+  {
+    memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  // Keep one byte for the terminator of an unterminated last line
+  if (reader->end + 1 >= reader->size)
+  {
+    reader->size *= 2;
+    reader->buf = realloc(reader->buf, reader->size);
+  }
+
+  if (reader->wait != NULL && reader->wait(reader->fd) == -1)
+  {
+    reader->eof = 1;
+    return 0;
+  }
+
+  ssize_t n;
+  do
+  {
+    n = read(reader->fd, reader->buf + reader->end, reader->size - reader->end - 1);
+  } while (n == -1 && errno == EINTR);
+
+  if (n <= 0)
+  {
+    reader->eof = 1;
+    return 0;
+  }
+  reader->end += (size_t)n;
+  return 1;
+}
+
+/*
+ * Next line without its newline, NULL at end of input.
+ * The line is only valid until the next call.
+ */
+char *reader_next(LineReader *reader)
+{
+  for (;;)
+  {
+    char *line = reader->buf + reader->start;
+    char *nl = memchr(line, '\n', reader->end - reader->start);
+    if (nl != NULL)
+    {
+      *nl = '\0';
+      reader->start = (size_t)(nl - reader->buf) + 1;
+      return line;
+    }
+    if (reader->eof || !fill(reader))
+    {
+      break;
+    }
+  }
+  if (reader->start == reader->end)
+  {
+    return NULL;
+  }
+  // Last line without a newline, fill left room for the terminator
+  char *line = reader->buf + reader->start;
+  reader->buf[reader->end] = '\0';
+  reader->start = reader->end;
+  return line;
+}
+
+/*
+ * Give input read ahead of the current line back to the file, so that a
+ * command reading the same stdin continues right after the line.
+ * Only possible for regular files, a pipe keeps what was read.
+ */
+void reader_sync(LineReader *reader)
+{
+  if (!reader->seekable || reader->start == reader->end)
+  {
+    return;
+  }
+  lseek(reader->fd, -(off_t)(reader->end - reader->start), SEEK_CUR);
+  reader->start = reader->end = 0;
+  reader->eof = 0;
+}
+
+void reader_free(LineReader *reader)
+{
+  free(reader->buf);
+  reader->buf = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef READER_INC
+#define READER_INC
+#include <stddef.h>
+
+/*
+ * Buffered line reader for scripts and non-interactive stdin.
+ * Reads large chunks with read(2) and hands out one line at a time.
+ */
+typedef struct
+{
+  int fd;
+  char *buf;
+  size_t size;  // Capacity of buf
+  size_t start; // First byte not yet handed out
+  size_t end;   // End of the bytes read so far
+  int eof;
+  int seekable; // Regular file, unread input can be given back with lseek
+  int (*wait)(int fd); // Called before a read that may block, NULL to just block
+} LineReader;
+
+#define READER_BUFSIZE (64 * 1024)
+
+void reader_init(LineReader *reader, int fd, size_t size);
+char *reader_next(LineReader *reader);
+void reader_sync(LineReader *reader);
+void reader_free(LineReader *reader);
+#endif
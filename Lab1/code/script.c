@@ -0,0 +1,943 @@
+/* Parser and executor for compound commands and functions, see script.h.
+ *
+ * The input, possibly several lines, is cut into tokens with the lexer
+ * of parse.c and a newline token at the end of each line. Keywords are
+ * only keywords where a command starts, so `echo done` is still an echo.
+ * A simple command is the run of tokens up to the next separator, handed
+ * to parse as it was typed; its Command is kept in the tree and run as is
+ * on every iteration.
+ *
+ * The executor walks the tree. break, continue and return set flow and
+ * every list being run stops on it until the loop or function it was
+ * meant for is reached. */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "script.h"
+#include "expand.h"
+#include "interrupt.h"
+#include "lsh.h"
+#include "trace.h"
+#include "vars.h"
+
+typedef struct
+{
+  char *text;  /* Copy of the token, NULL for the end of a line */
+  char *start; /* Where it is in the input */
+  char *end;
+} Token;
+
+typedef struct
+{
+  Token *tokens;
+  size_t count;
+  size_t pos;
+  Arena *arena;
+  /* 1 while all is well, 0 if the input ended inside a compound command
+   * and -1 on a syntax error */
+  int status;
+} Parser;
+
+/* Words that end the list before them */
+static const char *const terminators[] = {
+  "then", "elif", "else", "fi", "do", "done", "}", NULL
+};
+
+/* Words that start a compound command, or end one */
+static const char *const keywords[] = {
+  "if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done", "{", "}", NULL
+};
+
+static ShellFunction *functions = NULL;
+
+static Node *parse_list(Parser *p);
+static Node *parse_command(Parser *p);
+
+static bool is_keyword(const char *const *list, const char *s, size_t len)
+{
+  for (; *list != NULL; list++)
+  {
+    if (strlen(*list) == len && strncmp(*list, s, len) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* 1 if line can go to parse as it is: no command of it starts with a
+ * keyword and it defines no function. A $(...) that contains one makes
+ * the line look compound too, the script parser handles both. */
+int script_plain(const char *line)
+{
+  if (strstr(line, "()") != NULL)
+  {
+    return 0;
+  }
+  const char *s = line;
+  for (;;)
+  {
+    s += strspn(s, " \t\v\f\r");
+    size_t len = strcspn(s, " \t\v\f\r;&|<>");
+    if (is_keyword(keywords, s, len))
+    {
+      return 0;
+    }
+    s = strpbrk(s + len, ";&|");
+    if (s == NULL)
+    {
+      return 1;
+    }
+    s += strspn(s, ";&|");
+  }
+}
+
+static void push_token(Parser *p, size_t *cap, char *text, char *start, char *end)
+{
+  if (p->count == *cap)
+  {
+    Token *grown = arena_alloc(p->arena, 2 * *cap * sizeof(Token));
+    memcpy(grown, p->tokens, p->count * sizeof(Token));
+    p->tokens = grown;
+    *cap *= 2;
+  }
+  p->tokens[p->count++] = (Token){text, start, end};
+}
+
+/* Split text into tokens, the newlines in it are overwritten */
+static void tokenize(Parser *p, char *text)
+{
+  size_t cap = 64;
+  p->tokens = arena_alloc(p->arena, cap * sizeof(Token));
+  char *line = text;
+  while (line != NULL)
+  {
+    char *nl = strchr(line, '\n');
+    if (nl != NULL)
+    {
+      *nl = '\0';
+    }
+    char *s = line;
+    char *tok;
+    int n;
+    while ((n = nexttoken(p->arena, s, &tok)) > 0)
+    {
+      /* The token is a copy of the characters just before s + n */
+      push_token(p, &cap, tok, s + n - strlen(tok), s + n);
+      s += n;
+    }
+    push_token(p, &cap, NULL, s, s);
+    line = nl != NULL ? nl + 1 : NULL;
+  }
+}
+
+static Token *peek(Parser *p)
+{
+  return p->pos < p->count ? &p->tokens[p->pos] : NULL;
+}
+
+static bool at_word(Parser *p, const char *word)
+{
+  Token *t = peek(p);
+  return t != NULL && t->text != NULL && strcmp(t->text, word) == 0;
+}
+
+static bool at_separator(Parser *p)
+{
+  Token *t = peek(p);
+  return t->text == NULL || strcmp(t->text, ";") == 0 || strcmp(t->text, "&") == 0
+         || strcmp(t->text, "&&") == 0 || strcmp(t->text, "||") == 0;
+}
+
+static bool at_terminator(Parser *p)
+{
+  Token *t = peek(p);
+  return t != NULL && t->text != NULL && is_keyword(terminators, t->text, strlen(t->text));
+}
+
+static void skip_newlines(Parser *p)
+{
+  while (p->pos < p->count && p->tokens[p->pos].text == NULL)
+  {
+    p->pos++;
+  }
+}
+
+/* Stop parsing: if the input ran out, more of it may complete the
+ * command, anything else is an error */
+static Node *fail(Parser *p)
+{
+  if (p->status == 1)
+  {
+    skip_newlines(p);
+    p->status = peek(p) == NULL ? 0 : -1;
+  }
+  return NULL;
+}
+
+static Node *syntax_error(Parser *p)
+{
+  p->status = -1;
+  return NULL;
+}
+
+/* Consume word, after the newlines before it */
+static bool expect(Parser *p, const char *word)
+{
+  if (p->status != 1)
+  {
+    return false;
+  }
+  skip_newlines(p);
+  if (!at_word(p, word))
+  {
+    fail(p);
+    return false;
+  }
+  p->pos++;
+  return true;
+}
+
+static Node *new_node(Parser *p, NodeKind kind)
+{
+  Node *node = arena_alloc(p->arena, sizeof(Node));
+  memset(node, 0, sizeof(Node));
+  node->kind = kind;
+  node->connector = CONNECT_END;
+  return node;
+}
+
+/* if cond; then body; [elif ...;] [else orelse;] fi, an elif ends with
+ * the fi of its if */
+static Node *parse_if(Parser *p)
+{
+  Node *node = new_node(p, NODE_IF);
+  p->pos++;
+  node->cond = parse_list(p);
+  if (!expect(p, "then"))
+  {
+    return NULL;
+  }
+  node->body = parse_list(p);
+  if (p->status != 1)
+  {
+    return NULL;
+  }
+  skip_newlines(p);
+  /* At the end of the input the fi may still come */
+  if (peek(p) != NULL && (node->cond == NULL || node->body == NULL))
+  {
+    return syntax_error(p);
+  }
+  if (at_word(p, "elif"))
+  {
+    node->orelse = parse_if(p);
+    return node->orelse != NULL ? node : NULL;
+  }
+  if (at_word(p, "else"))
+  {
+    p->pos++;
+    node->orelse = parse_list(p);
+  }
+  if (!expect(p, "fi"))
+  {
+    return NULL;
+  }
+  return node;
+}
+
+/* The do body; done of a loop */
+static Node *parse_body(Parser *p, Node *node)
+{
+  if (!expect(p, "do"))
+  {
+    return NULL;
+  }
+  node->body = parse_list(p);
+  if (!expect(p, "done"))
+  {
+    return NULL;
+  }
+  if (node->body == NULL)
+  {
+    return syntax_error(p);
+  }
+  return node;
+}
+
+/* while cond; do body; done or the same with until */
+static Node *parse_loop(Parser *p, NodeKind kind)
+{
+  Node *node = new_node(p, kind);
+  p->pos++;
+  node->cond = parse_list(p);
+  if (p->status == 1 && node->cond == NULL)
+  {
+    return peek(p) == NULL ? fail(p) : syntax_error(p);
+  }
+  return parse_body(p, node);
+}
+
+/* for name [in words]; do body; done */
+static Node *parse_for(Parser *p)
+{
+  Node *node = new_node(p, NODE_FOR);
+  p->pos++;
+  Token *t = peek(p);
+  if (t == NULL || t->text == NULL || !vars_valid_name(t->text, strlen(t->text)))
+  {
+    return fail(p);
+  }
+  node->name = t->text;
+  p->pos++;
+  skip_newlines(p);
+  if (at_word(p, "in"))
+  {
+    size_t first = ++p->pos;
+    while ((t = peek(p)) != NULL && !at_separator(p))
+    {
+      if (strchr("|<>", t->text[0]) != NULL)
+      {
+        return syntax_error(p);
+      }
+      p->pos++;
+    }
+    size_t count = p->pos - first;
+    node->words = arena_alloc(p->arena, (count + 1) * sizeof(char *));
+    for (size_t i = 0; i < count; i++)
+    {
+      node->words[i] = p->tokens[first + i].text;
+    }
+    node->words[count] = NULL;
+  }
+  if (at_word(p, ";"))
+  {
+    p->pos++;
+  }
+  return parse_body(p, node);
+}
+
+/* { body; } */
+static Node *parse_group(Parser *p)
+{
+  Node *node = new_node(p, NODE_GROUP);
+  p->pos++;
+  node->body = parse_list(p);
+  if (!expect(p, "}"))
+  {
+    return NULL;
+  }
+  if (node->body == NULL)
+  {
+    return syntax_error(p);
+  }
+  return node;
+}
+
+/* name() followed by a compound command, usually a { } group */
+static Node *parse_function(Parser *p, char *name)
+{
+  if (!vars_valid_name(name, strlen(name)))
+  {
+    return syntax_error(p);
+  }
+  Node *node = new_node(p, NODE_FUNCTION);
+  node->name = name;
+  skip_newlines(p);
+  if (peek(p) == NULL)
+  {
+    return fail(p);
+  }
+  node->body = parse_command(p);
+  if (node->body == NULL)
+  {
+    return NULL;
+  }
+  if (node->body->kind == NODE_COMMAND || node->body->kind == NODE_FUNCTION)
+  {
+    return syntax_error(p);
+  }
+  return node;
+}
+
+/* The tokens up to the next separator, through parse */
+static Node *parse_simple(Parser *p)
+{
+  size_t first = p->pos;
+  while (peek(p) != NULL && !at_separator(p))
+  {
+    p->pos++;
+  }
+  if (p->pos == first)
+  {
+    return fail(p);
+  }
+  Token *a = &p->tokens[first];
+  Token *b = &p->tokens[p->pos - 1];
+  char *text = arena_strndup(p->arena, a->start, (size_t)(b->end - a->start));
+  Node *node = new_node(p, NODE_COMMAND);
+  node->command = arena_alloc(p->arena, sizeof(Command));
+  if (parse(text, node->command, p->arena) != 1)
+  {
+    return syntax_error(p);
+  }
+  return node;
+}
+
+static Node *parse_command(Parser *p)
+{
+  Token *t = peek(p);
+  if (at_word(p, "if"))
+  {
+    return parse_if(p);
+  }
+  if (at_word(p, "while"))
+  {
+    return parse_loop(p, NODE_WHILE);
+  }
+  if (at_word(p, "until"))
+  {
+    return parse_loop(p, NODE_UNTIL);
+  }
+  if (at_word(p, "for"))
+  {
+    return parse_for(p);
+  }
+  if (at_word(p, "{"))
+  {
+    return parse_group(p);
+  }
+  size_t len = t->text != NULL ? strlen(t->text) : 0;
+  if (len > 2 && strcmp(t->text + len - 2, "()") == 0)
+  {
+    p->pos++;
+    return parse_function(p, arena_strndup(p->arena, t->text, len - 2));
+  }
+  if (len > 0 && p->pos + 1 < p->count && p->tokens[p->pos + 1].text != NULL
+      && strcmp(p->tokens[p->pos + 1].text, "()") == 0)
+  {
+    p->pos += 2;
+    return parse_function(p, t->text);
+  }
+  return parse_simple(p);
+}
+
+/* < file and > file after a compound command, for all of it */
+static bool parse_redirections(Parser *p, Node *node)
+{
+  Token *t;
+  while ((t = peek(p)) != NULL && t->text != NULL && (t->text[0] == '<' || t->text[0] == '>'))
+  {
+    char **file = t->text[0] == '<' ? &node->rstdin : &node->rstdout;
+    p->pos++;
+    t = peek(p);
+    if (*file != NULL || t == NULL || t->text == NULL || !isidentifier(t->text))
+    {
+      syntax_error(p);
+      return false;
+    }
+    *file = t->text;
+    p->pos++;
+  }
+  return true;
+}
+
+/* Commands joined by newlines, ;, &, && and ||, up to a word that ends
+ * the list or the end of the input. NULL if it is empty, check status. */
+static Node *parse_list(Parser *p)
+{
+  Node *head = NULL;
+  Node **link = &head;
+  for (;;)
+  {
+    skip_newlines(p);
+    if (peek(p) == NULL || at_terminator(p))
+    {
+      return head;
+    }
+    Node *node = parse_command(p);
+    if (node == NULL || (node->kind != NODE_COMMAND && !parse_redirections(p, node)))
+    {
+      return NULL;
+    }
+    *link = node;
+    link = &node->next;
+
+    Token *t = peek(p);
+    if (t == NULL)
+    {
+      return head;
+    }
+    if (t->text == NULL || strcmp(t->text, ";") == 0)
+    {
+      node->connector = CONNECT_SEQ;
+    }
+    else if (strcmp(t->text, "&") == 0)
+    {
+      /* Only a pipeline can run in the background */
+      if (node->kind != NODE_COMMAND)
+      {
+        return syntax_error(p);
+      }
+      node->command->background = 1;
+      node->connector = CONNECT_SEQ;
+    }
+    else if (strcmp(t->text, "&&") == 0 || strcmp(t->text, "||") == 0)
+    {
+      node->connector = t->text[0] == '&' ? CONNECT_AND : CONNECT_OR;
+      p->pos++;
+      skip_newlines(p);
+      if (peek(p) == NULL || at_terminator(p))
+      {
+        return fail(p);
+      }
+      continue;
+    }
+    else
+    {
+      return syntax_error(p);
+    }
+    p->pos++;
+  }
+}
+
+Script *script_new(void)
+{
+  Script *script = malloc(sizeof(Script));
+  if (script == NULL)
+  {
+    abort();
+  }
+  arena_init(&script->arena, 4096);
+  script->list = NULL;
+  script->refs = 1;
+  return script;
+}
+
+/* Parse text, all of it, into script->list. Returns 1 on success, 0 if a
+ * compound command is still open at the end and -1 on a syntax error.
+ * The newlines of text are overwritten. */
+int script_parse(Script *script, char *text)
+{
+  Parser p = {NULL, 0, 0, &script->arena, 1};
+  tokenize(&p, text);
+  script->list = parse_list(&p);
+  /* A terminator nothing opened, like a stray done */
+  if (p.status == 1 && peek(&p) != NULL)
+  {
+    p.status = -1;
+  }
+  return p.status;
+}
+
+void script_release(Script *script)
+{
+  if (--script->refs == 0)
+  {
+    arena_free(&script->arena);
+    free(script);
+  }
+}
+
+/* Define or replace the function name, body stays valid as long as the
+ * function does */
+void script_define(const char *name, Node *body, Script *script)
+{
+  script->refs++;
+  for (ShellFunction *f = functions; f != NULL; f = f->next)
+  {
+    if (strcmp(f->name, name) == 0)
+    {
+      Script *old = f->script;
+      f->body = body;
+      f->script = script;
+      script_release(old);
+      return;
+    }
+  }
+  ShellFunction *f = malloc(sizeof(ShellFunction));
+  if (f == NULL)
+  {
+    abort();
+  }
+  f->name = strdup(name);
+  f->body = body;
+  f->script = script;
+  f->next = functions;
+  functions = f;
+}
+
+ShellFunction *script_function(const char *name)
+{
+  for (ShellFunction *f = functions; f != NULL; f = f->next)
+  {
+    if (strcmp(f->name, name) == 0)
+    {
+      return f;
+    }
+  }
+  return NULL;
+}
+
+int script_has_functions(void)
+{
+  return functions != NULL;
+}
+
+/* Running parsed nodes. Their simple commands go to run_command of lsh.c
+ * like the commands of a plain line. */
+
+/* What the nodes being run do next, set by break, continue and return */
+typedef enum
+{
+  FLOW_NEXT,
+  FLOW_BREAK,
+  FLOW_CONTINUE,
+  FLOW_RETURN
+} Flow;
+
+/* What the shell's stdin, stdout and capture were before redirect_begin */
+typedef struct
+{
+  int in;
+  int out;
+  Capture *capture;
+} ShellRedirect;
+
+/* Script the nodes being run belong to, functions they define keep it */
+static Script *runningScript = NULL;
+/* Set by break, continue and return until the loop or function is left */
+static Flow flow = FLOW_NEXT;
+/* Loops a break or continue leaves */
+static int flowLevels = 0;
+/* Loops of the function being run, or outside functions, and functions */
+static int loopDepth = 0;
+static int functionDepth = 0;
+
+static int run_nodes(Node *list, Arena *arena);
+
+/* Point fd at file, returns a copy of what fd was or -1 if it stays as
+ * it is */
+static int redirect_fd(int file, int fd)
+{
+  if (file < 0)
+  {
+    return -1;
+  }
+  int saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  dup2(file, fd);
+  close(file);
+  return saved;
+}
+
+static void restore_fd(int saved, int fd)
+{
+  if (saved >= 0)
+  {
+    dup2(saved, fd);
+    close(saved);
+  }
+}
+
+/* Apply the redirections of cmd to the shell itself, for a function or
+ * a compound command that runs in it. Returns -1 if a file can't be
+ * opened, otherwise redirect_end undoes them. */
+static int redirect_begin(Command *cmd, ShellRedirect *saved)
+{
+  int fileIn = -1;
+  int fileOut = -1;
+  if (setInputOutput(cmd, &fileIn, &fileOut) == -1)
+  {
+    return -1;
+  }
+  fflush(stdout);
+  saved->in = redirect_fd(fileIn, STDIN_FILENO);
+  saved->out = redirect_fd(fileOut, STDOUT_FILENO);
+  /* Redirected output doesn't go to an enclosing $(...) */
+  saved->capture = shell_capture;
+  if (fileOut >= 0)
+  {
+    shell_capture = NULL;
+  }
+  return 0;
+}
+
+static void redirect_end(ShellRedirect *saved)
+{
+  shell_capture = saved->capture;
+  fflush(stdout);
+  restore_fd(saved->in, STDIN_FILENO);
+  restore_fd(saved->out, STDOUT_FILENO);
+}
+
+/* Run a Command kept in a node. run_command rewrites the argument lists
+ * of the Command it runs, so it gets a copy and the node can run again. */
+static int run_node_command(const Command *command, Arena *arena)
+{
+  Command copy = *command;
+  Pgm **link = &copy.pgm;
+  for (Pgm *pgm = command->pgm; pgm != NULL; pgm = pgm->next)
+  {
+    *link = arena_alloc(arena, sizeof(Pgm));
+    **link = *pgm;
+    link = &(*link)->next;
+  }
+  return run_command(&copy, arena);
+}
+
+/* After the body of a loop has run: 1 if the loop goes on. A break or
+ * continue meant for this loop ends here. */
+static int next_iteration(void)
+{
+  if (shell_interrupted)
+  {
+    return 0;
+  }
+  if (flow == FLOW_BREAK || flow == FLOW_CONTINUE)
+  {
+    if (--flowLevels > 0)
+    {
+      return 0;
+    }
+    int again = flow == FLOW_CONTINUE;
+    flow = FLOW_NEXT;
+    return again;
+  }
+  return flow == FLOW_NEXT;
+}
+
+/* while and until. What an iteration allocates is dropped before the
+ * next one, a long loop runs in the same memory as a short one. */
+static int run_while(Node *node, Arena *arena)
+{
+  int status = 0;
+  loopDepth++;
+  for (;;)
+  {
+    ArenaMark mark = arena_mark(arena);
+    int test = run_nodes(node->cond, arena);
+    int going = flow == FLOW_NEXT && !shell_interrupted;
+    int done = going && (test == 0) == (node->kind == NODE_UNTIL);
+    if (going && !done)
+    {
+      status = run_nodes(node->body, arena);
+    }
+    arena_release(arena, mark);
+    if (done || !next_iteration())
+    {
+      break;
+    }
+  }
+  loopDepth--;
+  return status;
+}
+
+/* for, the words are expanded once before the first iteration */
+static int run_for(Node *node, Arena *arena)
+{
+  char **words = shell_positional;
+  size_t count = (size_t)shell_positionalCount;
+  if (node->words != NULL)
+  {
+    words = expand_words(node->words, 0, arena, &count);
+    if (words == NULL)
+    {
+      return 2;
+    }
+  }
+  int status = 0;
+  loopDepth++;
+  for (size_t i = 0; i < count; i++)
+  {
+    ArenaMark mark = arena_mark(arena);
+    vars_set(node->name, words[i]);
+    status = run_nodes(node->body, arena);
+    arena_release(arena, mark);
+    if (!next_iteration())
+    {
+      break;
+    }
+  }
+  loopDepth--;
+  return status;
+}
+
+/* Run a node of any kind, its redirections are done by run_node */
+static int run_compound(Node *node, Arena *arena)
+{
+  switch (node->kind)
+  {
+  case NODE_COMMAND:
+    return run_node_command(node->command, arena);
+  case NODE_IF:
+    {
+      int test = run_nodes(node->cond, arena);
+      if (flow != FLOW_NEXT || shell_interrupted)
+      {
+        return test;
+      }
+      if (test == 0)
+      {
+        return run_nodes(node->body, arena);
+      }
+      return node->orelse != NULL ? run_nodes(node->orelse, arena) : 0;
+    }
+  case NODE_WHILE:
+  case NODE_UNTIL:
+    return run_while(node, arena);
+  case NODE_FOR:
+    return run_for(node, arena);
+  case NODE_GROUP:
+    return run_nodes(node->body, arena);
+  case NODE_FUNCTION:
+    script_define(node->name, node->body, runningScript);
+    return 0;
+  }
+  return 0;
+}
+
+/* Run one node, with the redirections of a compound command */
+static int run_node(Node *node, Arena *arena)
+{
+  if (node->rstdin == NULL && node->rstdout == NULL)
+  {
+    return run_compound(node, arena);
+  }
+  Command redirections = {.rstdin = node->rstdin, .rstdout = node->rstdout};
+  ShellRedirect redirect;
+  if (redirect_begin(&redirections, &redirect) == -1)
+  {
+    return 1;
+  }
+  int status = run_compound(node, arena);
+  redirect_end(&redirect);
+  return status;
+}
+
+/* Run parsed nodes in order like run_list runs the commands of a line,
+ * returns the last status */
+static int run_nodes(Node *list, Arena *arena)
+{
+  for (Node *n = list; n != NULL; n = n->next)
+  {
+    shell_status = run_node(n, arena);
+    if (shell_interrupted || flow != FLOW_NEXT)
+    {
+      break;
+    }
+    while (n->next != NULL && ((n->connector == CONNECT_AND && shell_status != 0)
+                               || (n->connector == CONNECT_OR && shell_status == 0)))
+    {
+      n = n->next;
+    }
+  }
+  return shell_status;
+}
+
+/* Parse text, one or more lines, and run it if it is complete. Returns
+ * what script_parse returned. */
+int script_run(const char *text, Arena *arena)
+{
+  Script *script = script_new();
+  char *copy = arena_strndup(&script->arena, text, strlen(text));
+  double parseStart = TRACE_ON ? trace_now() : 0;
+  int parsed = script_parse(script, copy);
+  if (TRACE_ON)
+  {
+    trace_complete("parse", text, 0, parseStart, trace_now());
+  }
+  if (parsed == 1)
+  {
+    Script *outer = runningScript;
+    runningScript = script;
+    run_nodes(script->list, arena);
+    runningScript = outer;
+  }
+  script_release(script);
+  return parsed;
+}
+
+/* Run a function with the arguments of cmd as $1, $2, ... Its
+ * redirections hold for the whole body. Returns its status. */
+int script_call(Command *cmd, ShellFunction *function, Arena *arena)
+{
+  ShellRedirect redirect;
+  if (redirect_begin(cmd, &redirect) == -1)
+  {
+    return 1;
+  }
+
+  /* The function may be redefined while it runs */
+  Script *script = function->script;
+  script->refs++;
+  Script *outerScript = runningScript;
+  char **outerPositional = shell_positional;
+  int outerCount = shell_positionalCount;
+  int outerLoops = loopDepth;
+  runningScript = script;
+  shell_positional = cmd->pgm->pgmlist + 1;
+  shell_positionalCount = 0;
+  while (shell_positional[shell_positionalCount] != NULL)
+  {
+    shell_positionalCount++;
+  }
+  /* break and continue don't reach the loops of the caller */
+  loopDepth = 0;
+  functionDepth++;
+
+  int status = run_nodes(function->body, arena);
+  if (flow == FLOW_RETURN)
+  {
+    flow = FLOW_NEXT;
+  }
+
+  functionDepth--;
+  loopDepth = outerLoops;
+  shell_positional = outerPositional;
+  shell_positionalCount = outerCount;
+  runningScript = outerScript;
+  script_release(script);
+  redirect_end(&redirect);
+  return status;
+}
+
+/* break [n] and continue [n] leave n loops, return [status] leaves the
+ * function. They only set flow, the nodes being run stop on it. */
+int handle_flow(Command *cmd, BuiltinId id)
+{
+  char **argv = cmd->pgm->pgmlist;
+  long n = id == BUILTIN_RETURN ? shell_status : 1;
+  if (argv[1] != NULL)
+  {
+    char *end;
+    n = strtol(argv[1], &end, 10);
+    if (end == argv[1] || *end != '\0' || (id != BUILTIN_RETURN && n < 1))
+    {
+      printf("%s: %s: invalid number\n", argv[0], argv[1]);
+      return 2;
+    }
+  }
+  if (id == BUILTIN_RETURN)
+  {
+    if (functionDepth == 0)
+    {
+      printf("return: not in a function\n");
+      return 1;
+    }
+    flow = FLOW_RETURN;
+    return (int)(n & 0xff);
+  }
+  if (loopDepth == 0)
+  {
+    printf("%s: not in a loop\n", argv[0]);
+    return 1;
+  }
+  flow = id == BUILTIN_BREAK ? FLOW_BREAK : FLOW_CONTINUE;
+  flowLevels = n < loopDepth ? (int)n : loopDepth;
+  return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef SCRIPT_INC
+#define SCRIPT_INC
+#include "parse.h"
+#include "builtin.h"
+
+/*
+ * Compound commands and functions (script.c).
+ *
+ * Input that uses if, while, until, for, { } or defines a function is
+ * parsed once into a list of Nodes. Its simple commands are Commands
+ * from parse, so a loop runs its body again and again without going
+ * back to the lexer. Lines without any of that keep going straight to
+ * parse. script_run parses and runs such input, script_call runs a
+ * function and handle_flow is break, continue and return.
+ */
+typedef enum
+{
+  NODE_COMMAND,  /* A pipeline, with redirections */
+  NODE_IF,       /* if cond; then body; else orelse; fi */
+  NODE_WHILE,    /* while cond; do body; done */
+  NODE_UNTIL,    /* until cond; do body; done */
+  NODE_FOR,      /* for name in words; do body; done */
+  NODE_GROUP,    /* { body; } */
+  NODE_FUNCTION  /* name() body, running it defines the function */
+} NodeKind;
+
+typedef struct snode
+{
+  NodeKind kind;
+  Connector connector;  /* How it is joined to next, like a Command */
+  struct snode *next;
+  Command *command;     /* NODE_COMMAND */
+  struct snode *cond;
+  struct snode *body;
+  struct snode *orelse; /* else part, an elif is a NODE_IF */
+  char *name;           /* Variable of a for, name of a function */
+  char **words;         /* Words of a for, NULL without in */
+  char *rstdin;         /* Redirections of a compound command */
+  char *rstdout;
+} Node;
+
+/* Parsed input, shared by the functions it defines */
+typedef struct
+{
+  Arena arena;
+  Node *list;
+  int refs;
+} Script;
+
+typedef struct shellfunction
+{
+  char *name;
+  Node *body;
+  Script *script;
+  struct shellfunction *next;
+} ShellFunction;
+
+extern int script_plain(const char *line);
+extern Script *script_new(void);
+extern int script_parse(Script *script, char *text);
+extern void script_release(Script *script);
+extern void script_define(const char *name, Node *body, Script *script);
+extern ShellFunction *script_function(const char *name);
+extern int script_has_functions(void);
+extern int script_run(const char *text, Arena *arena);
+extern int script_call(Command *cmd, ShellFunction *function, Arena *arena);
+extern int handle_flow(Command *cmd, BuiltinId id);
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Settings of the shell and the builtins that change them, see
+ * settings.h
+ */
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "settings.h"
+#include "placement.h"
+#include "spawn.h"
+#include "vars.h"
+
+// Capacity of the pipes between stages in bytes, 0 for the kernel's
+// default. LSH_PIPESIZE or `set pipesize=size`.
+static long pipeSize = 0;
+// Limits of background jobs, `set bgcpu=`, `bgmemory=` and `bgio=`
+static JobLimits bgLimits;
+
+/*
+ * NUMA node of `set numanode=`, -1 for "any" and -2 if invalid
+ */
+static int parse_node(const char* text)
+{
+  if(strcmp(text, "any") == 0)
+  {
+    return -1;
+  }
+  char* end;
+  long node = strtol(text, &end, 10);
+  if(end == text || *end != '\0' || node < 0 || node > INT_MAX)
+  {
+    return -2;
+  }
+  return (int)node;
+}
+
+/*
+ * The settings the shell starts with: LSH_PIPESIZE, LSH_PLACEMENT and
+ * LSH_NUMANODE
+ */
+void settings_init(void)
+{
+  if(getenv("LSH_PIPESIZE") != NULL)
+  {
+    pipeSize = pipe_size_parse(getenv("LSH_PIPESIZE"));
+    if(pipeSize == -1)
+    {
+      printf("LSH_PIPESIZE: %s: invalid size\n", getenv("LSH_PIPESIZE"));
+      pipeSize = 0;
+    }
+  }
+  if(getenv("LSH_PLACEMENT") != NULL || getenv("LSH_NUMANODE") != NULL)
+  {
+    const char* name = getenv("LSH_PLACEMENT") != NULL ? getenv("LSH_PLACEMENT") : "off";
+    const char* nodeName = getenv("LSH_NUMANODE") != NULL ? getenv("LSH_NUMANODE") : "any";
+    int policy = placement_parse(name);
+    int node = parse_node(nodeName);
+    if(policy == -1 || node == -2 || placement_set((Placement)policy, node) == -1)
+    {
+      printf("LSH_PLACEMENT=%s LSH_NUMANODE=%s: invalid placement\n", name, nodeName);
+    }
+  }
+}
+
+long settings_pipe_size(void)
+{
+  return pipeSize;
+}
+
+const JobLimits* settings_bg_limits(void)
+{
+  return &bgLimits;
+}
+
+/*
+ * set prints the settings of the shell, set name=value changes one.
+ * pipesize is the capacity of the pipes between stages (see spawn.h),
+ * placement and numanode decide which CPUs stages run on (placement.h).
+ */
+int handle_set(Command* cmd)
+{
+  char** argv = cmd->pgm->pgmlist;
+  if(argv[1] == NULL)
+  {
+    if(pipeSize == 0)
+    {
+      printf("pipesize=default\n");
+    }
+    else
+    {
+      printf("pipesize=%ld\n", pipeSize);
+    }
+    printf("placement=%s\n", placement_name(placement_policy()));
+    if(placement_node() == -1)
+    {
+      printf("numanode=any\n");
+    }
+    else
+    {
+      printf("numanode=%d\n", placement_node());
+    }
+    if(bgLimits.cpu == 0)
+    {
+      printf("bgcpu=max\n");
+    }
+    else
+    {
+      printf("bgcpu=%d%%\n", bgLimits.cpu);
+    }
+    if(bgLimits.memory == 0)
+    {
+      printf("bgmemory=max\n");
+    }
+    else
+    {
+      printf("bgmemory=%lld\n", bgLimits.memory);
+    }
+    if(bgLimits.ioWeight == 0)
+    {
+      printf("bgio=default\n");
+    }
+    else
+    {
+      printf("bgio=%d\n", bgLimits.ioWeight);
+    }
+    if(joblimits_active(&bgLimits))
+    {
+      printf("# background jobs limited through %s\n", joblimits_mode());
+    }
+    return 0;
+  }
+  int status = 0;
+  for(int i = 1; argv[i] != NULL; i++)
+  {
+    char* value = strchr(argv[i], '=');
+    value = value != NULL ? value + 1 : "";
+    if(strncmp(argv[i], "pipesize=", 9) == 0)
+    {
+      long size = pipe_size_parse(value);
+      if(size == -1)
+      {
+        printf("set: %s: invalid size\n", value);
+        status = 2;
+        continue;
+      }
+      pipeSize = size;
+    }
+    else if(strncmp(argv[i], "placement=", 10) == 0)
+    {
+      int policy = placement_parse(value);
+      if(policy == -1 || placement_set((Placement)policy, placement_node()) == -1)
+      {
+        printf("set: %s: invalid placement, use off, compact or spread\n", value);
+        status = 2;
+      }
+    }
+    else if(strncmp(argv[i], "numanode=", 9) == 0)
+    {
+      int node = parse_node(value);
+      if(node == -2 || placement_set(placement_policy(), node) == -1)
+      {
+        printf("set: %s: no such NUMA node\n", value);
+        status = 2;
+      }
+    }
+    else if(strncmp(argv[i], "bgcpu=", 6) == 0 || strncmp(argv[i], "bgmemory=", 9) == 0
+            || strncmp(argv[i], "bgio=", 5) == 0)
+    {
+      // The limit's name without bg and =
+      char name[16];
+      snprintf(name, sizeof(name), "%.*s", (int)(value - argv[i] - 3), argv[i] + 2);
+      if(joblimits_parse(&bgLimits, name, value) == -1)
+      {
+        printf("set: %s: invalid %s limit\n", value, name);
+        status = 2;
+      }
+    }
+    else
+    {
+      printf("set: %s: unknown setting\n", argv[i]);
+      status = 2;
+    }
+  }
+  return status;
+}
+
+/*
+ * export NAME=value sets a variable and exports it to the commands the
+ * shell starts, export NAME exports it now or once it is set. Without arguments
+ * the exported variables are listed.
+ */
+int handle_export(Command* cmd)
+{
+  char** argv = cmd->pgm->pgmlist;
+  if(argv[1] == NULL)
+  {
+    for(char** env = vars_environ(); *env != NULL; env++)
+    {
+      printf("export %s\n", *env);
+    }
+    return 0;
+  }
+  int status = 0;
+  for(int i = 1; argv[i] != NULL; i++)
+  {
+    char* eq = strchr(argv[i], '=');
+    size_t len = eq != NULL ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+    if(!vars_valid_name(argv[i], len))
+    {
+      printf("export: %s: invalid name\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    if(eq == NULL)
+    {
+      vars_export(argv[i], NULL);
+      continue;
+    }
+    char* name = strndup(argv[i], len);
+    vars_export(name, eq + 1);
+    free(name);
+  }
+  return status;
+}
+
+/*
+ * unset NAME... removes variables, exported ones from the environment too
+ */
+int handle_unset(Command* cmd)
+{
+  char** argv = cmd->pgm->pgmlist;
+  int status = 0;
+  for(int i = 1; argv[i] != NULL; i++)
+  {
+    if(!vars_valid_name(argv[i], strlen(argv[i])))
+    {
+      printf("unset: %s: invalid name\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    vars_unset(argv[i]);
+  }
+  return status;
+}
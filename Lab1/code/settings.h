@@ -0,0 +1,18 @@
+#ifndef SETTINGS_INC
+#define SETTINGS_INC
+#include "parse.h"
+#include "joblimits.h"
+
+/*
+ * How the shell runs commands (settings.c): the capacity of pipes, the
+ * CPU placement of stages and the limits of background jobs, changed by
+ * set and listed by set without arguments. export and unset, which change
+ * what commands see of the shell's variables, are here as well.
+ */
+void settings_init(void);
+long settings_pipe_size(void);
+const JobLimits* settings_bg_limits(void);
+int handle_set(Command* cmd);
+int handle_export(Command* cmd);
+int handle_unset(Command* cmd);
+#endif
@@ -0,0 +1,299 @@
+/*
+ * Spawn engine used by setup_command_chain to start pipeline stages.
+ *
+ * A plain fork() copies the page tables of the whole shell (readline's
+ * history included) only for the child to throw them away in exec.
+ * posix_spawn and vfork avoid that copy, fork is kept as a fallback
+ * and can be selected with LSH_SPAWN=fork. Every mode passes the envp
+ * vars.c keeps up to date, nothing is built per launch.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+#include "trace.h"
+#include "vars.h"
+#include "zygote.h"
+
+/*
+ * Read the spawn mode from LSH_SPAWN (posix, vfork, fork or zygote)
+ */
+SpawnMode spawn_mode_from_env(void)
+{
+  const char* mode = getenv("LSH_SPAWN");
+  if(mode == NULL){
+    return SPAWN_POSIX;
+  }
+  if(strcmp(mode, "vfork") == 0){
+    return SPAWN_VFORK;
+  }
+  if(strcmp(mode, "fork") == 0){
+    return SPAWN_FORK;
+  }
+  if(strcmp(mode, "zygote") == 0){
+    return SPAWN_ZYGOTE;
+  }
+  return SPAWN_POSIX;
+}
+
+const char* spawn_mode_name(SpawnMode mode)
+{
+  switch(mode){
+  case SPAWN_VFORK:
+    return "vfork";
+  case SPAWN_FORK:
+    return "fork";
+  case SPAWN_ZYGOTE:
+    return "zygote";
+  default:
+    return "posix_spawn";
+  }
+}
+
+/*
+ * Make fd the target fd of the child. dup2 leaves the copy without
+ * O_CLOEXEC, an fd that already is the target needs the flag cleared.
+ */
+static int redirect(int fd, int target)
+{
+  if(fd == target){
+    return fcntl(fd, F_SETFD, 0);
+  }
+  return dup2(fd, target);
+}
+
+/*
+ * Runs in the child between vfork/fork and exec, and in the stages the
+ * zygote clones. Only async-signal-safe calls, the vfork child shares
+ * our memory. Returns 0 or an errno.
+ */
+int spawn_child_setup(const SpawnStage* stage)
+{
+  sigset_t empty;
+  sigemptyset(&empty);
+
+  signal(SIGINT, stage->background ? SIG_IGN : SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  // The zygote ignores it, exec would keep that
+  signal(SIGQUIT, SIG_DFL);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  if(stage->inFd >= 0 && redirect(stage->inFd, STDIN_FILENO) == -1){
+    return errno;
+  }
+  if(stage->outFd >= 0 && redirect(stage->outFd, STDOUT_FILENO) == -1){
+    return errno;
+  }
+  return 0;
+}
+
+static pid_t spawn_posix(const char* path, char** argv, const SpawnStage* stage)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t defaults;
+  sigset_t empty;
+  struct sigaction ignore;
+  struct sigaction oldInt;
+  pid_t pid = -1;
+  int err;
+
+  // dup2 onto the same fd clears O_CLOEXEC as well (glibc 2.29+)
+  posix_spawn_file_actions_init(&actions);
+  if(stage->inFd >= 0){
+    posix_spawn_file_actions_adddup2(&actions, stage->inFd, STDIN_FILENO);
+  }
+  if(stage->outFd >= 0){
+    posix_spawn_file_actions_adddup2(&actions, stage->outFd, STDOUT_FILENO);
+  }
+
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGCHLD);
+  sigaddset(&defaults, SIGHUP);
+  sigaddset(&defaults, SIGTSTP);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGQUIT);
+  sigemptyset(&empty);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setsigmask(&attr, &empty);
+
+  if(stage->background){
+    // posix_spawn can only reset signals to default, an ignored disposition
+    // is inherited. The shell's SIGINT handler is a no-op so ignoring it
+    // for the duration of the call changes nothing for the shell.
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore, &oldInt);
+  }
+  else {
+    sigaddset(&defaults, SIGINT);
+  }
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+
+  err = posix_spawn(&pid, path, &actions, &attr, argv, vars_environ());
+  // posix_spawn returns once the child has exec'd
+  if(err == 0){
+    trace_instant("exec", argv[0], pid);
+  }
+
+  if(stage->background){
+    sigaction(SIGINT, &oldInt, NULL);
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if(err != 0){
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+static pid_t spawn_vfork(const char* path, char** argv, const SpawnStage* stage)
+{
+  // Written by the child, which runs on our memory until it execs or exits
+  volatile int childErr = 0;
+  char** envp = vars_environ();
+
+  pid_t pid = vfork();
+  if(pid == 0){
+    int err = spawn_child_setup(stage);
+    if(err == 0){
+      trace_instant("exec", argv[0], getpid());
+      execve(path, argv, envp);
+      err = errno;
+    }
+    childErr = err;
+    _exit(127);
+  }
+  if(pid == -1){
+    return -1;
+  }
+  if(childErr != 0){
+    // Collect the child right away, it never became a command
+    waitpid(pid, NULL, 0);
+    errno = childErr;
+    return -1;
+  }
+  return pid;
+}
+
+static pid_t spawn_fork(const char* path, char** argv, const SpawnStage* stage)
+{
+  pid_t pid = fork();
+  if(pid == 0){
+    int err = spawn_child_setup(stage);
+    if(err == 0){
+      trace_instant("exec", argv[0], getpid());
+      execve(path, argv, vars_environ());
+      err = errno;
+    }
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+    _exit(127);
+  }
+  return pid;
+}
+
+/*
+ * Start argv as one stage of a pipeline, path is the resolved location
+ * of the command (see pathcache.h), PATH is not searched again.
+ * Returns the pid of the stage, or -1 with errno set if it could not be
+ * started. The fork fallback can only report exec failures through the
+ * exit status (127) of the child.
+ */
+pid_t spawn_stage(SpawnMode mode, const char* path, char** argv, const SpawnStage* stage)
+{
+  switch(mode){
+  case SPAWN_VFORK:
+    return spawn_vfork(path, argv, stage);
+  case SPAWN_FORK:
+    return spawn_fork(path, argv, stage);
+  case SPAWN_ZYGOTE:
+    if(zygote_running()){
+      pid_t pid = zygote_spawn(path, argv, stage);
+      if(pid != -1 || zygote_running()){
+        return pid;
+      }
+    }
+    // Without a zygote the stages are started by the shell after all
+    return spawn_posix(path, argv, stage);
+  default:
+    return spawn_posix(path, argv, stage);
+  }
+}
+
+/*
+ * Run fn(argv) as a pipeline stage in a forked child, for builtins that
+ * take part in a pipeline. The exit status of the child is the return
+ * value of fn.
+ */
+pid_t spawn_call(int (*fn)(char** argv), char** argv, const SpawnStage* stage)
+{
+  pid_t pid = fork();
+  if(pid == 0){
+    if(spawn_child_setup(stage) != 0){
+      _exit(126);
+    }
+    // There is no exec to drop the O_CLOEXEC fds, a pipe end left open
+    // here would keep the other stages from seeing end of file
+    close_range(3, ~0U, 0);
+    _exit(fn(argv));
+  }
+  return pid;
+}
+
+/*
+ * Bytes in text, see spawn.h. Returns -1 if it isn't a size.
+ */
+long pipe_size_parse(const char* text)
+{
+  if(strcmp(text, "default") == 0){
+    return 0;
+  }
+  char* end;
+  errno = 0;
+  long size = strtol(text, &end, 10);
+  if(end == text || size < 0 || errno != 0){
+    return -1;
+  }
+  long unit = 1;
+  if(*end == 'k' || *end == 'K'){
+    unit = 1L << 10;
+    end++;
+  }
+  else if(*end == 'm' || *end == 'M'){
+    unit = 1L << 20;
+    end++;
+  }
+  // F_SETPIPE_SZ takes an int
+  if(*end != '\0' || size > INT_MAX / unit){
+    return -1;
+  }
+  return size * unit;
+}
+
+/*
+ * Set the capacity of the pipe behind fd, the kernel rounds it up to a
+ * power of two pages. Size 0 leaves the pipe alone. Fails with EPERM above
+ * /proc/sys/fs/pipe-max-size without CAP_SYS_RESOURCE.
+ */
+int pipe_resize(int fd, long size)
+{
+  if(size == 0){
+    return 0;
+  }
+  return fcntl(fd, F_SETPIPE_SZ, (int)size) == -1 ? -1 : 0;
+}
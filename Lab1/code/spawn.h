@@ -0,0 +1,46 @@
+#ifndef SPAWN_INC
+#define SPAWN_INC
+#include <sys/types.h>
+
+/*
+ * How a pipeline stage is turned into a process.
+ * SPAWN_POSIX goes through posix_spawn with file actions, SPAWN_VFORK
+ * borrows the shell's address space until exec and SPAWN_FORK is the
+ * plain fork + exec fallback. With SPAWN_ZYGOTE a helper process forked at
+ * startup starts the stages, see zygote.h.
+ */
+typedef enum
+{
+  SPAWN_POSIX,
+  SPAWN_VFORK,
+  SPAWN_FORK,
+  SPAWN_ZYGOTE
+} SpawnMode;
+
+/*
+ * File descriptor wiring for one stage of a pipeline.
+ * The shell creates every fd with O_CLOEXEC, so only the two fds that
+ * become stdin and stdout survive the exec.
+ */
+typedef struct
+{
+  int inFd;  // Becomes stdin of the stage, -1 to inherit the shell's
+  int outFd; // Becomes stdout of the stage, -1 to inherit the shell's
+  int background; // Background stages ignore SIGINT
+} SpawnStage;
+
+SpawnMode spawn_mode_from_env(void);
+const char* spawn_mode_name(SpawnMode mode);
+pid_t spawn_stage(SpawnMode mode, const char* path, char** argv, const SpawnStage* stage);
+int spawn_child_setup(const SpawnStage* stage);
+pid_t spawn_call(int (*fn)(char** argv), char** argv, const SpawnStage* stage);
+
+/*
+ * Capacity of the pipes between stages. The kernel default is 64 KiB;
+ * a bigger pipe lets a fast producer run longer before the consumer has
+ * to be scheduled. Sizes are bytes with an optional k or m suffix,
+ * "default" is 0 and keeps the kernel's size.
+ */
+long pipe_size_parse(const char* text);
+int pipe_resize(int fd, long size);
+#endif
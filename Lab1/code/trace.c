@@ -0,0 +1,152 @@
+/*
+ * Chrome trace output for lsh, see trace.h.
+ *
+ * Recording an event is one atomic fetch_add to claim a slot and a few
+ * stores, no locks and no syscalls (clock_gettime goes through the vDSO),
+ * so it is safe in a vfork child. When the ring is full the oldest events
+ * are overwritten.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS (1 << 14)
+
+TraceRing* trace_ring = NULL;
+
+static char* tracePath = NULL;
+static pid_t tracePid = 0;
+
+/*
+ * Start tracing if LSH_TRACE is set, the trace is written there at exit
+ */
+void trace_init(void)
+{
+  const char* path = getenv("LSH_TRACE");
+  if(path == NULL || *path == '\0'){
+    return;
+  }
+  size_t size = sizeof(TraceRing) + TRACE_EVENTS * sizeof(TraceEvent);
+  void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(ring == MAP_FAILED){
+    perror("LSH_TRACE");
+    return;
+  }
+  trace_ring = ring;
+  trace_ring->capacity = TRACE_EVENTS;
+  tracePath = strdup(path);
+  tracePid = getpid();
+  atexit(trace_flush);
+}
+
+double trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static void record(const char* name, char phase, const char* detail, pid_t tid, double ts, double dur)
+{
+  unsigned long ticket = atomic_fetch_add_explicit(&trace_ring->head, 1, memory_order_relaxed);
+  TraceEvent* event = &trace_ring->events[ticket & (trace_ring->capacity - 1)];
+
+  // Mark the slot as being written, a flush skips it until it is ready
+  atomic_store_explicit(&event->ready, 0, memory_order_relaxed);
+  event->name = name;
+  event->phase = phase;
+  event->tid = tid;
+  event->ts = ts;
+  event->dur = dur;
+  event->detail[0] = '\0';
+  if(detail != NULL){
+    strncat(event->detail, detail, TRACE_DETAIL - 1);
+  }
+  atomic_store_explicit(&event->ready, ticket + 1, memory_order_release);
+}
+
+/*
+ * Event that lasted from start to end, both from trace_now
+ */
+void trace_complete(const char* name, const char* detail, pid_t tid, double start, double end)
+{
+  if(trace_ring != NULL){
+    record(name, 'X', detail, tid, start, end - start);
+  }
+}
+
+void trace_instant(const char* name, const char* detail, pid_t tid)
+{
+  if(trace_ring != NULL){
+    record(name, 'i', detail, tid, trace_now(), 0);
+  }
+}
+
+static void write_string(FILE* out, const char* s)
+{
+  fputc('"', out);
+  for(; *s != '\0'; s++){
+    unsigned char c = (unsigned char)*s;
+    if(c == '"' || c == '\\'){
+      fprintf(out, "\\%c", c);
+    }
+    else if(c < 0x20){
+      fprintf(out, "\\u%04x", c);
+    }
+    else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/*
+ * Write the recorded events to LSH_TRACE, oldest first. Runs at exit of
+ * the shell, forked children never write the file.
+ */
+void trace_flush(void)
+{
+  if(trace_ring == NULL || getpid() != tracePid){
+    return;
+  }
+  FILE* out = fopen(tracePath, "w");
+  if(out == NULL){
+    perror(tracePath);
+    return;
+  }
+  unsigned long head = atomic_load_explicit(&trace_ring->head, memory_order_acquire);
+  unsigned long first = head > trace_ring->capacity ? head - trace_ring->capacity : 0;
+  int comma = 0;
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for(unsigned long ticket = first; ticket < head; ticket++){
+    TraceEvent* event = &trace_ring->events[ticket & (trace_ring->capacity - 1)];
+    if(atomic_load_explicit(&event->ready, memory_order_acquire) != ticket + 1){
+      continue;
+    }
+    fprintf(out, "%s{\"name\":", comma ? ",\n" : "");
+    write_string(out, event->name);
+    fprintf(out, ",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+            event->phase, (int)tracePid, (int)(event->tid ? event->tid : tracePid), event->ts);
+    if(event->phase == 'X'){
+      fprintf(out, ",\"dur\":%.3f", event->dur);
+    }
+    else {
+      fprintf(out, ",\"s\":\"t\"");
+    }
+    if(event->detail[0] != '\0'){
+      fprintf(out, ",\"args\":{\"detail\":");
+      write_string(out, event->detail);
+      fprintf(out, "}");
+    }
+    fprintf(out, "}");
+    comma = 1;
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+}
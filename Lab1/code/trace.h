@@ -0,0 +1,41 @@
+#ifndef TRACE_INC
+#define TRACE_INC
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/*
+ * Hot path tracing, off unless LSH_TRACE names an output file.
+ * Events go to a ring buffer in shared memory, so fork and vfork children
+ * can record into it as well, and are written as Chrome trace JSON
+ * (chrome://tracing, Perfetto) when the shell exits.
+ */
+#define TRACE_DETAIL 48
+
+typedef struct
+{
+  atomic_ulong ready; // Ticket + 1 once the slot is completely written
+  const char* name;   // Static string
+  char phase;         // 'X' complete event, 'i' instant
+  pid_t tid;          // Track of the event, 0 for the shell
+  double ts;          // Microseconds
+  double dur;
+  char detail[TRACE_DETAIL];
+} TraceEvent;
+
+typedef struct
+{
+  atomic_ulong head; // Next ticket, the slot is ticket & (capacity - 1)
+  unsigned long capacity;
+  TraceEvent events[];
+} TraceRing;
+
+// NULL while tracing is off, test it before building trace arguments
+extern TraceRing* trace_ring;
+#define TRACE_ON (trace_ring != NULL)
+
+void trace_init(void);
+double trace_now(void);
+void trace_complete(const char* name, const char* detail, pid_t tid, double start, double end);
+void trace_instant(const char* name, const char* detail, pid_t tid);
+void trace_flush(void);
+#endif
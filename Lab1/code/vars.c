@@ -0,0 +1,393 @@
+/*
+ * Shell variable table and environment block.
+ *
+ * Loops set a variable on every iteration and every $name of a command
+ * looks one up, so the variables live in an open addressing hash table
+ * like the path cache. Each variable is kept as its "name=value" entry,
+ * updated in place when the new value fits, so an exported variable's
+ * entry can go into envp as it is.
+ *
+ * The environment the shell started with is imported on first use
+ * without copying: the entries point into it and envp is environ itself.
+ * Only the first change to an exported variable copies the pointer array
+ * (and a string only once its value changes). After that the array is
+ * patched in place: an export appends an entry, an unset moves the last
+ * one into its place and a value that no longer fits swaps one pointer.
+ * Launching a command passes envp as it is.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "vars.h"
+
+extern char** environ;
+
+typedef struct
+{
+  char* entry;     // "name=value", NULL if the slot has never been used
+  size_t nameLen;
+  size_t size;     // Bytes allocated for entry, 0 if the shell doesn't own it
+  size_t envIndex; // Position in envp while exported
+  unsigned hash;
+  char exported;
+  char pending;    // Unset but exported (export name), setting it exports it
+  char removed;    // Unset, the slot is kept for the probe sequences
+} Var;
+
+// Entry of a removed variable
+static char removedEntry[] = "";
+// Environment of a shell started without one
+static char* emptyEnv[] = {NULL};
+
+static Var* table;
+static size_t capacity;
+static size_t used; // Live and removed entries, drives resizing
+
+// The exported entries, NULL-terminated. Until the first change it is the
+// inherited environ and envCap is 0.
+static char** envp;
+static size_t envCount;
+static size_t envCap;
+static unsigned envGeneration;
+
+static unsigned hash_name(const char* s, size_t len)
+{
+  // FNV-1a
+  unsigned h = 2166136261u;
+  for(size_t i = 0; i < len; i++){
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static Var* find_slot(const char* name, size_t len, unsigned hash)
+{
+  Var* removed = NULL;
+  size_t mask = capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask){
+    Var* v = &table[i];
+    if(v->entry == NULL){
+      return removed ? removed : v;
+    }
+    if(v->removed){
+      if(removed == NULL){
+        removed = v;
+      }
+    }
+    else if(v->hash == hash && v->nameLen == len && memcmp(v->entry, name, len) == 0){
+      return v;
+    }
+  }
+}
+
+static void grow(void)
+{
+  Var* old = table;
+  size_t oldCapacity = capacity;
+
+  capacity = capacity ? capacity * 2 : 64;
+  table = calloc(capacity, sizeof(Var));
+  used = 0;
+  for(size_t i = 0; i < oldCapacity; i++){
+    if(old[i].entry == NULL || old[i].removed){
+      continue;
+    }
+    *find_slot(old[i].entry, old[i].nameLen, old[i].hash) = old[i];
+    used++;
+  }
+  free(old);
+}
+
+/*
+ * Take over the environment the shell was started with
+ */
+static void import(void)
+{
+  envp = environ != NULL ? environ : emptyEnv;
+  while(envp[envCount] != NULL){
+    envCount++;
+  }
+  while(capacity * 7 / 10 < envCount + 1){
+    grow();
+  }
+  for(size_t i = 0; i < envCount; i++){
+    char* eq = strchr(envp[i], '=');
+    if(eq == NULL || !vars_valid_name(envp[i], (size_t)(eq - envp[i]))){
+      continue;
+    }
+    size_t len = (size_t)(eq - envp[i]);
+    unsigned hash = hash_name(envp[i], len);
+    Var* v = find_slot(envp[i], len, hash);
+    // Of duplicates the first counts, like for getenv
+    if(v->entry != NULL && !v->removed){
+      continue;
+    }
+    used += v->entry == NULL;
+    *v = (Var){.entry = envp[i], .nameLen = len, .envIndex = i, .hash = hash, .exported = 1};
+  }
+}
+
+/*
+ * The variable name, set or pending, NULL if there is none
+ */
+static Var* find(const char* name, size_t len)
+{
+  if(capacity == 0){
+    import();
+  }
+  Var* v = find_slot(name, len, hash_name(name, len));
+  return v->entry != NULL && !v->removed ? v : NULL;
+}
+
+static Var* lookup(const char* name, size_t len)
+{
+  Var* v = find(name, len);
+  return v != NULL && !v->pending ? v : NULL;
+}
+
+/*
+ * The variable name, created unset if there is none
+ */
+static Var* insert(const char* name)
+{
+  if(capacity == 0){
+    import();
+  }
+  if(used + 1 > capacity * 7 / 10){
+    grow();
+  }
+  size_t len = strlen(name);
+  unsigned hash = hash_name(name, len);
+  Var* v = find_slot(name, len, hash);
+  if(v->entry == NULL || v->removed){
+    used += v->entry == NULL;
+    *v = (Var){.entry = removedEntry, .nameLen = len, .hash = hash, .removed = 1};
+  }
+  return v;
+}
+
+/*
+ * Store value in v, the variable name. Returns 1 if the entry moved, 0 if
+ * it was updated in place.
+ */
+static int store(Var* v, const char* name, const char* value)
+{
+  size_t valueLen = strlen(value);
+  size_t size = v->nameLen + valueLen + 2;
+  v->removed = 0;
+  if(size <= v->size){
+    // value may be the old value itself
+    memmove(v->entry + v->nameLen + 1, value, valueLen + 1);
+    return 0;
+  }
+  // Some slack, a counter or a growing list doesn't move on every change
+  size = (size + 31) & ~(size_t)31;
+  char* entry = malloc(size);
+  memcpy(entry, name, v->nameLen);
+  entry[v->nameLen] = '=';
+  memcpy(entry + v->nameLen + 1, value, valueLen + 1);
+  if(v->size > 0){
+    free(v->entry);
+  }
+  v->entry = entry;
+  v->size = size;
+  return 1;
+}
+
+/*
+ * 1 if v is set to value already. The PWD exported at startup is usually
+ * the inherited one, setting it again mustn't copy the environment.
+ */
+static int unchanged(const Var* v, const char* value)
+{
+  return !v->removed && !v->pending && strcmp(v->entry + v->nameLen + 1, value) == 0;
+}
+
+/*
+ * Make envp the shell's own array with room for one more entry. The first
+ * time the exported variables are copied out of the table, which also
+ * drops duplicates and invalid names of the inherited environment.
+ */
+static void own_env(void)
+{
+  if(envCap == 0){
+    envCap = envCount + 16;
+    envp = malloc(envCap * sizeof(char*));
+    envCount = 0;
+    for(size_t i = 0; i < capacity; i++){
+      Var* v = &table[i];
+      if(v->entry != NULL && !v->removed && v->exported){
+        v->envIndex = envCount;
+        envp[envCount++] = v->entry;
+      }
+    }
+  }
+  else if(envCount + 2 > envCap){
+    envCap *= 2;
+    envp = realloc(envp, envCap * sizeof(char*));
+  }
+  envp[envCount] = NULL;
+  // getenv and the exec family without an envp read environ
+  environ = envp;
+  envGeneration++;
+}
+
+static void env_add(Var* v)
+{
+  own_env();
+  v->envIndex = envCount;
+  envp[envCount++] = v->entry;
+  envp[envCount] = NULL;
+  v->exported = 1;
+}
+
+static void env_remove(Var* v)
+{
+  own_env();
+  char* last = envp[--envCount];
+  envp[v->envIndex] = last;
+  envp[envCount] = NULL;
+  if(last != v->entry){
+    size_t len = (size_t)(strchr(last, '=') - last);
+    find_slot(last, len, hash_name(last, len))->envIndex = v->envIndex;
+  }
+  v->exported = 0;
+}
+
+/*
+ * After value of v changed: the entry goes into envp if it moved
+ */
+static void env_update(Var* v, int moved)
+{
+  if(!v->exported){
+    return;
+  }
+  if(moved){
+    own_env();
+    envp[v->envIndex] = v->entry;
+  }
+  else {
+    envGeneration++;
+  }
+}
+
+/*
+ * 1 if the len characters of name are a letter or _ followed by letters,
+ * digits and _
+ */
+int vars_valid_name(const char* name, size_t len)
+{
+  if(len == 0 || (name[0] >= '0' && name[0] <= '9')){
+    return 0;
+  }
+  for(size_t i = 0; i < len; i++){
+    char c = name[i];
+    if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Value of the variable named by the len characters of name, NULL if it
+ * is unset
+ */
+const char* vars_get(const char* name, size_t len)
+{
+  Var* v = lookup(name, len);
+  return v != NULL ? v->entry + len + 1 : NULL;
+}
+
+int vars_exported(const char* name)
+{
+  Var* v = lookup(name, strlen(name));
+  return v != NULL && v->exported;
+}
+
+/*
+ * Set a variable, an exported one stays exported
+ */
+void vars_set(const char* name, const char* value)
+{
+  Var* v = insert(name);
+  if(v->pending){
+    vars_export(name, value);
+  }
+  else if(!unchanged(v, value)){
+    env_update(v, store(v, name, value));
+  }
+}
+
+/*
+ * Export name to the commands the shell starts, with value unless it is
+ * NULL. An unset name is exported once it is set.
+ */
+void vars_export(const char* name, const char* value)
+{
+  Var* v;
+  if(value != NULL){
+    v = insert(name);
+    if(v->exported && unchanged(v, value)){
+      return;
+    }
+    int moved = store(v, name, value);
+    v->pending = 0;
+    if(v->exported){
+      env_update(v, moved);
+      return;
+    }
+  }
+  else if((v = lookup(name, strlen(name))) == NULL){
+    v = insert(name);
+    if(v->removed){
+      // Keeps the name in entry for find_slot, the value is ignored
+      store(v, name, "");
+      v->pending = 1;
+    }
+    return;
+  }
+  if(!v->exported){
+    env_add(v);
+  }
+}
+
+void vars_unset(const char* name)
+{
+  Var* v = find(name, strlen(name));
+  if(v == NULL){
+    return;
+  }
+  if(v->exported){
+    env_remove(v);
+  }
+  if(v->size > 0){
+    free(v->entry);
+  }
+  v->entry = removedEntry;
+  v->size = 0;
+  v->pending = 0;
+  v->removed = 1;
+}
+
+/*
+ * The environment of the commands the shell starts, valid until the next
+ * change to an exported variable
+ */
+char** vars_environ(void)
+{
+  if(capacity == 0){
+    import();
+  }
+  return envp;
+}
+
+/*
+ * Changes with every change to the environment, so that a copy of it can
+ * tell whether it is still current
+ */
+unsigned vars_env_generation(void)
+{
+  return envGeneration;
+}
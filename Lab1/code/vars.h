@@ -0,0 +1,21 @@
+#ifndef VARS_INC
+#define VARS_INC
+#include <stddef.h>
+
+/*
+ * Shell variables and the environment of commands (vars.c).
+ *
+ * The environment the shell starts with becomes its exported variables.
+ * Assignments, for loops, export and unset change the table, and the
+ * envp array handed to every spawned command is kept up to date as they
+ * do, so launching a command doesn't build an environment.
+ */
+int vars_valid_name(const char* name, size_t len);
+const char* vars_get(const char* name, size_t len);
+int vars_exported(const char* name);
+void vars_set(const char* name, const char* value);
+void vars_export(const char* name, const char* value);
+void vars_unset(const char* name);
+char** vars_environ(void);
+unsigned vars_env_generation(void);
+#endif
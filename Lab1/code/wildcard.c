@@ -0,0 +1,397 @@
+/*
+ * Pathname expansion, see wildcard.h.
+ *
+ * A pattern is matched one component at a time. Components without
+ * wildcards are taken as they are, the others are matched with fnmatch
+ * against the listing of the directory so far. A listing holds the names
+ * of a directory sorted, so the matches of a single directory need no
+ * sorting of their own.
+ *
+ * The mtime of a directory changes whenever an entry is added, removed or
+ * renamed, so a listing is reused while the directory's device, inode and
+ * mtime are what they were before it was read. A directory that changed
+ * less than a second before it was read may change again without a new
+ * mtime on file systems with coarse timestamps; such a listing is only
+ * used once.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "wildcard.h"
+
+// Directories whose listings are kept
+#define LISTING_SLOTS 8
+// Bytes read per getdents64 call, a few thousand entries
+#define DENTS_BUFSIZE (256 << 10)
+
+// What getdents64 returns, glibc has no declaration of its own for it
+typedef struct
+{
+  uint64_t ino;
+  int64_t off;
+  unsigned short reclen;
+  unsigned char type;
+  char name[];
+} Dirent64;
+
+typedef struct
+{
+  uint32_t name;      // Offset of the name in the listing's names
+  unsigned char type; // d_type, DT_UNKNOWN if the file system doesn't say
+} Entry;
+
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int racy;      // Changed just before it was read, not reused
+  int pinned;    // Being matched, can't be replaced
+  char* names;   // NUL-terminated back to back
+  size_t namesSize;
+  Entry* entries; // Sorted by name
+  size_t count;
+  unsigned long used; // Last use, 0 for a free slot
+} Listing;
+
+static Listing listings[LISTING_SLOTS];
+static unsigned long useCount = 0;
+
+typedef struct
+{
+  Arena* arena;
+  char** matches;
+  size_t count;
+  size_t cap;
+  int listed; // Directories matched against, with one they are sorted
+  char path[PATH_MAX];
+} Glob;
+
+static void free_listing(Listing* l)
+{
+  free(l->names);
+  free(l->entries);
+  memset(l, 0, sizeof(Listing));
+}
+
+static int compare_entries(const void* a, const void* b, void* names)
+{
+  return strcmp((char*)names + ((const Entry*)a)->name, (char*)names + ((const Entry*)b)->name);
+}
+
+/*
+ * Read the directory fd into l, without . and .. Returns -1 on failure.
+ */
+static int scan(int fd, Listing* l)
+{
+  static char* dents = NULL;
+  if(dents == NULL && (dents = malloc(DENTS_BUFSIZE)) == NULL){
+    return -1;
+  }
+  size_t namesLen = 0;
+  size_t entriesCap = 0;
+  for(;;){
+    long n = syscall(SYS_getdents64, fd, dents, DENTS_BUFSIZE);
+    if(n <= 0){
+      if(n == -1){
+        return -1;
+      }
+      break;
+    }
+    for(long pos = 0; pos < n; pos += ((Dirent64*)(dents + pos))->reclen){
+      Dirent64* d = (Dirent64*)(dents + pos);
+      if(d->name[0] == '.' && (d->name[1] == '\0' || (d->name[1] == '.' && d->name[2] == '\0'))){
+        continue;
+      }
+      size_t len = strlen(d->name) + 1;
+      if(namesLen + len > l->namesSize){
+        size_t size = l->namesSize ? l->namesSize * 2 : 4096;
+        while(size < namesLen + len){
+          size *= 2;
+        }
+        char* grown = realloc(l->names, size);
+        if(grown == NULL){
+          return -1;
+        }
+        l->names = grown;
+        l->namesSize = size;
+      }
+      if(l->count == entriesCap){
+        entriesCap = entriesCap ? entriesCap * 2 : 256;
+        Entry* grown = realloc(l->entries, entriesCap * sizeof(Entry));
+        if(grown == NULL){
+          return -1;
+        }
+        l->entries = grown;
+      }
+      memcpy(l->names + namesLen, d->name, len);
+      l->entries[l->count].name = (uint32_t)namesLen;
+      l->entries[l->count].type = d->type;
+      l->count++;
+      namesLen += len;
+    }
+  }
+  qsort_r(l->entries, l->count, sizeof(Entry), compare_entries, l->names);
+  return 0;
+}
+
+/*
+ * Listing of the directory path, from the cache if it is still valid.
+ * Returns it pinned, NULL if the directory can't be read.
+ */
+static Listing* acquire_listing(const char* path)
+{
+  struct stat st;
+  if(stat(path, &st) == -1 || !S_ISDIR(st.st_mode)){
+    return NULL;
+  }
+  Listing* slot = NULL;
+  for(int i = 0; i < LISTING_SLOTS; i++){
+    Listing* l = &listings[i];
+    if(l->used == 0 || l->dev != st.st_dev || l->ino != st.st_ino){
+      continue;
+    }
+    if(!l->racy && l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec){
+      l->used = ++useCount;
+      l->pinned++;
+      return l;
+    }
+    if(!l->pinned){
+      slot = l;
+    }
+  }
+  // Otherwise replace the least recently used listing not being matched
+  for(int i = 0; i < LISTING_SLOTS && slot == NULL; i++){
+    Listing* l = &listings[i];
+    if(!l->pinned && (slot == NULL || l->used < slot->used)){
+      slot = l;
+    }
+  }
+  if(slot == NULL){
+    return NULL;
+  }
+  free_listing(slot);
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd == -1){
+    return NULL;
+  }
+  // The mtime from before the read, a change during it shows next time
+  struct stat opened;
+  struct timespec now;
+  int failed = fstat(fd, &opened) == -1 || scan(fd, slot) == -1;
+  close(fd);
+  clock_gettime(CLOCK_REALTIME, &now);
+  if(failed){
+    free_listing(slot);
+    return NULL;
+  }
+  slot->dev = opened.st_dev;
+  slot->ino = opened.st_ino;
+  slot->mtime = opened.st_mtim;
+  double age = (double)(now.tv_sec - opened.st_mtim.tv_sec) + (now.tv_nsec - opened.st_mtim.tv_nsec) / 1e9;
+  slot->racy = age < 1.0;
+  slot->used = ++useCount;
+  slot->pinned = 1;
+  return slot;
+}
+
+static void release_listing(Listing* l)
+{
+  l->pinned--;
+}
+
+/*
+ * 1 if the len characters at s have a *, ? or a [ closed by a ] that
+ * isn't escaped with a backslash
+ */
+static int has_wildcard(const char* s, size_t len)
+{
+  for(size_t i = 0; i < len; i++){
+    if(s[i] == '\\' && i + 1 < len){
+      i++;
+    }
+    else if(s[i] == '*' || s[i] == '?'){
+      return 1;
+    }
+    if(s[i] == '[' && memchr(s + i + 1, ']', len - i - 1) != NULL){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int wildcard_has(const char* word)
+{
+  return has_wildcard(word, strlen(word));
+}
+
+static int is_wildcard(char c)
+{
+  return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
+
+/*
+ * Copy len characters of s to dst without the backslashes escaping
+ * wildcards, returns the length of the copy
+ */
+static size_t unescape(char* dst, const char* s, size_t len)
+{
+  size_t n = 0;
+  for(size_t i = 0; i < len; i++){
+    if(s[i] == '\\' && i + 1 < len && is_wildcard(s[i + 1])){
+      i++;
+    }
+    dst[n++] = s[i];
+  }
+  return n;
+}
+
+/*
+ * Remove the backslashes escaping wildcards from word, in place. `\*.c`
+ * passes *.c on to a command instead of the files it matches.
+ */
+void wildcard_unescape(char* word)
+{
+  word[unescape(word, word, strlen(word))] = '\0';
+}
+
+/*
+ * Match one name, `*suffix` is common enough to skip fnmatch for
+ */
+static int match(const char* pattern, const char* suffix, const char* name)
+{
+  if(suffix != NULL){
+    size_t len = strlen(name);
+    size_t suffixLen = strlen(suffix);
+    return name[0] != '.' && len >= suffixLen && memcmp(name + len - suffixLen, suffix, suffixLen) == 0;
+  }
+  return fnmatch(pattern, name, FNM_PERIOD) == 0;
+}
+
+static void add_match(Glob* g, size_t len)
+{
+  if(g->count + 1 >= g->cap){
+    size_t cap = g->cap ? g->cap * 2 : 16;
+    char** grown = arena_alloc(g->arena, cap * sizeof(char*));
+    memcpy(grown, g->matches, g->count * sizeof(char*));
+    g->matches = grown;
+    g->cap = cap;
+  }
+  g->matches[g->count++] = arena_strndup(g->arena, g->path, len);
+}
+
+static int is_directory(const Entry* e, const char* path)
+{
+  if(e->type != DT_UNKNOWN && e->type != DT_LNK){
+    return e->type == DT_DIR;
+  }
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Match the components of pattern below the directory in g->path, which
+ * holds len characters ending in a / or none for the current directory
+ */
+static void expand_from(Glob* g, size_t len, const char* pattern)
+{
+  // Components without wildcards are taken as they are
+  const char* slash;
+  size_t compLen;
+  for(;;){
+    slash = strchr(pattern, '/');
+    compLen = slash != NULL ? (size_t)(slash - pattern) : strlen(pattern);
+    if(has_wildcard(pattern, compLen)){
+      break;
+    }
+    if(len + compLen + 2 > PATH_MAX){
+      return;
+    }
+    len += unescape(g->path + len, pattern, compLen);
+    if(slash == NULL){
+      struct stat st;
+      g->path[len] = '\0';
+      if(lstat(g->path, &st) == 0){
+        add_match(g, len);
+      }
+      return;
+    }
+    g->path[len++] = '/';
+    pattern = slash + 1;
+  }
+
+  char component[NAME_MAX + 1];
+  if(compLen > NAME_MAX){
+    return;
+  }
+  memcpy(component, pattern, compLen);
+  component[compLen] = '\0';
+  const char* suffix = component[0] == '*' && strpbrk(component + 1, "*?[\\") == NULL ? component + 1 : NULL;
+
+  g->path[len] = '\0';
+  Listing* l = acquire_listing(len > 0 ? g->path : ".");
+  if(l == NULL){
+    return;
+  }
+  g->listed++;
+  for(size_t i = 0; i < l->count; i++){
+    const char* name = l->names + l->entries[i].name;
+    if(!match(component, suffix, name)){
+      continue;
+    }
+    size_t nameLen = strlen(name);
+    if(len + nameLen + 2 > PATH_MAX){
+      continue;
+    }
+    memcpy(g->path + len, name, nameLen + 1);
+    if(slash == NULL){
+      add_match(g, len + nameLen);
+    }
+    else if(is_directory(&l->entries[i], g->path)){
+      g->path[len + nameLen] = '/';
+      expand_from(g, len + nameLen + 1, slash + 1);
+    }
+  }
+  release_listing(l);
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * The paths pattern matches, sorted and NULL-terminated in the arena.
+ * Returns NULL if nothing matches, the word then stays as it is.
+ */
+char** wildcard_expand(const char* pattern, Arena* arena, size_t* count)
+{
+  Glob g = {.arena = arena, .matches = NULL, .count = 0, .cap = 0, .listed = 0};
+  size_t len = 0;
+  if(pattern[0] == '/'){
+    g.path[len++] = '/';
+    pattern++;
+  }
+  expand_from(&g, len, pattern);
+
+  *count = g.count;
+  if(g.count == 0){
+    return NULL;
+  }
+  if(g.count > 1 && g.listed > 1){
+    qsort(g.matches, g.count, sizeof(char*), compare_paths);
+  }
+  g.matches[g.count] = NULL;
+  return g.matches;
+}
@@ -0,0 +1,18 @@
+#ifndef WILDCARD_INC
+#define WILDCARD_INC
+#include <stddef.h>
+
+#include "arena.h"
+
+/*
+ * Pathname expansion of *, ? and [...] in arguments (wildcard.c).
+ *
+ * Directories are read with getdents64 and their sorted listings kept in
+ * a small cache, checked against the directory's mtime on every use.
+ * Globbing a directory again costs one stat instead of a rescan, which
+ * matters for scripts that glob over directories with 100k+ files.
+ */
+int wildcard_has(const char* word);
+char** wildcard_expand(const char* pattern, Arena* arena, size_t* count);
+void wildcard_unescape(char* word);
+#endif
@@ -0,0 +1,446 @@
+/*
+ * Zygote spawn helper, see zygote.h.
+ *
+ * fork() copies the page tables of the process that calls it, and the
+ * shell's keep growing with history, jobs and the path cache. The zygote
+ * is forked once at startup and never holds more than one request, so a
+ * fork from it costs the same however long the shell has been running.
+ * posix_spawn and vfork avoid the copy as well, but a stage still starts
+ * on the shell's critical path; the zygote does the work in its own
+ * process while the shell only sends a message.
+ *
+ * The zygote keeps the environment it was last sent, a request only
+ * carries one when an exported variable changed since. The same goes for
+ * the resource limits and umask, which the zygote copies into itself so
+ * that its stages inherit them like the shell's would: a request only
+ * carries them after ulimit changed a limit.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "trace.h"
+#include "vars.h"
+#include "builtin.h"
+
+// Fixed part of a request, followed by size bytes of NUL-terminated
+// strings: the path, argc arguments and envc environment entries
+typedef struct
+{
+  uint32_t size;
+  uint32_t argc;
+  uint32_t envc;
+  int8_t hasEnv; // The environment changed, envc entries replace it
+  int8_t background;
+  int8_t hasIn;  // stdin of the stage follows the working directory
+  int8_t hasOut; // stdout of the stage, after stdin if both are passed
+  int8_t hasLimits; // A ZygoteLimits follows the strings
+} ZygoteRequest;
+
+// The shell's limits and umask, after a ulimit
+typedef struct
+{
+  uint32_t umask;
+  struct rlimit limits[RLIM_NLIMITS];
+} ZygoteLimits;
+
+// Every request passes the shell's working directory, then stdin/stdout
+#define ZYGOTE_MAX_FDS 3
+
+typedef struct
+{
+  pid_t pid; // -1 if the stage could not be cloned
+  int err;   // errno of a failed clone or exec
+} ZygoteReply;
+
+// Shell's end of the socketpair, -1 when there is no zygote
+static int zygoteFd = -1;
+// vars_env_generation of the environment the zygote has
+static unsigned sentGeneration;
+static int envSent = 0;
+// builtin_limits_generation of the limits the zygote has
+static unsigned sentLimitsGeneration;
+
+// In the zygote: the environment of the stages, and its strings
+static char** zygoteEnv = NULL;
+static char* zygoteEnvStrings = NULL;
+
+static int write_full(int fd, const void* buf, size_t len)
+{
+  const char* p = buf;
+  while(len > 0){
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if(n == -1 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static int read_full(int fd, void* buf, size_t len)
+{
+  char* p = buf;
+  while(len > 0){
+    ssize_t n = read(fd, p, len);
+    if(n == -1 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      if(n == 0){
+        errno = EPIPE;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/*
+ * Point list at count strings starting at *s, NULL-terminated.
+ * Returns -1 if they run past end.
+ */
+static int unpack(char** s, const char* end, char** list, uint32_t count)
+{
+  for(uint32_t i = 0; i < count; i++){
+    const char* nul = memchr(*s, '\0', (size_t)(end - *s));
+    if(nul == NULL){
+      return -1;
+    }
+    list[i] = *s;
+    *s = (char*)nul + 1;
+  }
+  list[count] = NULL;
+  return 0;
+}
+
+/*
+ * Keep the environment at the end of a request's strings for this and
+ * the following requests. Returns -1 if it is malformed.
+ */
+static int keep_env(char* s, const char* end, uint32_t envc)
+{
+  char* strings = malloc((size_t)(end - s) + 1);
+  char** envp = malloc((envc + 1) * sizeof(char*));
+  if(strings == NULL || envp == NULL){
+    free(strings);
+    free(envp);
+    return -1;
+  }
+  memcpy(strings, s, (size_t)(end - s));
+  char* copy = strings;
+  if(unpack(&copy, strings + (end - s), envp, envc) == -1){
+    free(strings);
+    free(envp);
+    return -1;
+  }
+  free(zygoteEnvStrings);
+  free(zygoteEnv);
+  zygoteEnvStrings = strings;
+  zygoteEnv = envp;
+  return 0;
+}
+
+/*
+ * Take over the shell's limits and umask. A limit the zygote can't set
+ * is one the shell couldn't have either.
+ */
+static void apply_limits(const ZygoteLimits* limits)
+{
+  for(int r = 0; r < RLIM_NLIMITS; r++){
+    setrlimit(r, &limits->limits[r]);
+  }
+  umask((mode_t)limits->umask);
+}
+
+/*
+ * Clone and exec the stage of one request
+ */
+static ZygoteReply serve(int sock, const ZygoteRequest* req, char* strings, const int* fds)
+{
+  ZygoteReply reply = {-1, EINVAL};
+  char** argv = malloc((req->argc + 1) * sizeof(char*));
+  char* s = strings;
+  const char* end = strings + req->size;
+  char* path[2];
+  SpawnStage stage = {
+    .inFd = req->hasIn ? fds[1] : -1,
+    .outFd = req->hasOut ? fds[req->hasIn ? 2 : 1] : -1,
+    .background = req->background,
+  };
+  int errPipe[2];
+
+  if(argv == NULL || unpack(&s, end, path, 1) == -1 || unpack(&s, end, argv, req->argc) == -1
+     || (req->hasEnv && keep_env(s, end, req->envc) == -1) || zygoteEnv == NULL
+     || fds[0] < 0 || (req->hasIn && stage.inFd < 0) || (req->hasOut && stage.outFd < 0)){
+    goto out;
+  }
+  // Carries errno of a failed exec, end of file once the exec succeeded
+  if(pipe2(errPipe, O_CLOEXEC) == -1){
+    reply.err = errno;
+    goto out;
+  }
+
+  // Like fork, but the stage becomes a child of the shell
+  pid_t pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+  if(pid == 0){
+    close(sock);
+    int err = fchdir(fds[0]) == -1 ? errno : spawn_child_setup(&stage);
+    if(err == 0){
+      trace_instant("exec", argv[0], getpid());
+      execve(path[0], argv, zygoteEnv);
+      err = errno;
+    }
+    while(write(errPipe[1], &err, sizeof(err)) == -1 && errno == EINTR);
+    _exit(127);
+  }
+  close(errPipe[1]);
+  reply.pid = pid;
+  reply.err = pid == -1 ? errno : 0;
+  if(pid != -1){
+    int err;
+    ssize_t n;
+    while((n = read(errPipe[0], &err, sizeof(err))) == -1 && errno == EINTR);
+    if(n == sizeof(err)){
+      reply.err = err;
+    }
+  }
+  close(errPipe[0]);
+out:
+  free(argv);
+  return reply;
+}
+
+static void zygote_main(int sock)
+{
+  // Ctrl+C and Ctrl+Z go to the whole process group, the zygote has to
+  // outlive them. It ends when the shell closes its end of the socket.
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+
+  for(;;){
+    ZygoteRequest req;
+    union
+    {
+      char buf[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf),
+    };
+    int fds[ZYGOTE_MAX_FDS] = {-1, -1, -1};
+
+    ssize_t n;
+    while((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL)) == -1 && errno == EINTR);
+    if(n != sizeof(req)){
+      _exit(0);
+    }
+    for(struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)){
+      if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS){
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(c), (count < ZYGOTE_MAX_FDS ? count : ZYGOTE_MAX_FDS) * sizeof(int));
+      }
+    }
+
+    ZygoteReply reply = {-1, ENOMEM};
+    char* strings = malloc(req.size);
+    if(strings != NULL){
+      ZygoteLimits limits;
+      if(read_full(sock, strings, req.size) == -1
+         || (req.hasLimits && read_full(sock, &limits, sizeof(limits)) == -1)){
+        _exit(0);
+      }
+      if(req.hasLimits){
+        apply_limits(&limits);
+      }
+      reply = serve(sock, &req, strings, fds);
+      free(strings);
+    }
+    for(int i = 0; i < ZYGOTE_MAX_FDS; i++){
+      if(fds[i] >= 0){
+        close(fds[i]);
+      }
+    }
+    if(write_full(sock, &reply, sizeof(reply)) == -1){
+      _exit(0);
+    }
+  }
+}
+
+/*
+ * Fork the zygote, call it early while the shell is small. The zygote
+ * must be in the shell's process group, its stages inherit it.
+ */
+int zygote_start(void)
+{
+  int sv[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1){
+    return -1;
+  }
+  pid_t pid = fork();
+  if(pid == -1){
+    int err = errno;
+    close(sv[0]);
+    close(sv[1]);
+    errno = err;
+    return -1;
+  }
+  if(pid == 0){
+    // Nothing of the shell's but stdin, stdout, stderr and the socket
+    if(dup2(sv[1], 3) == -1){
+      _exit(1);
+    }
+    close_range(4, ~0U, 0);
+    zygote_main(3);
+  }
+  close(sv[1]);
+  zygoteFd = sv[0];
+  envSent = 0;
+  // Forked with the shell's limits
+  sentLimitsGeneration = builtin_limits_generation();
+  return 0;
+}
+
+int zygote_running(void)
+{
+  return zygoteFd != -1;
+}
+
+/*
+ * Have the zygote start path with argv and the shell's environment.
+ * Returns the pid of the stage, -1 with errno set on failure. If the
+ * zygote is gone zygote_running is 0 afterwards.
+ */
+pid_t zygote_spawn(const char* path, char** argv, const SpawnStage* stage)
+{
+  unsigned generation = vars_env_generation();
+  unsigned limitsGeneration = builtin_limits_generation();
+  char** envp = vars_environ();
+  ZygoteRequest req = {
+    .size = 0,
+    .argc = 0,
+    .envc = 0,
+    .hasEnv = !envSent || generation != sentGeneration,
+    .background = (int8_t)stage->background,
+    .hasIn = stage->inFd >= 0,
+    .hasOut = stage->outFd >= 0,
+    .hasLimits = limitsGeneration != sentLimitsGeneration,
+  };
+  size_t size = strlen(path) + 1;
+  for(; argv[req.argc] != NULL; req.argc++){
+    size += strlen(argv[req.argc]) + 1;
+  }
+  for(; req.hasEnv && envp[req.envc] != NULL; req.envc++){
+    size += strlen(envp[req.envc]) + 1;
+  }
+  char* strings = malloc(size);
+  if(strings == NULL){
+    return -1;
+  }
+  // The zygote stays where the shell started, the stage follows cd
+  int cwdFd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if(cwdFd == -1){
+    free(strings);
+    return -1;
+  }
+  char* p = stpcpy(strings, path) + 1;
+  for(uint32_t i = 0; i < req.argc; i++){
+    p = stpcpy(p, argv[i]) + 1;
+  }
+  for(uint32_t i = 0; i < req.envc; i++){
+    p = stpcpy(p, envp[i]) + 1;
+  }
+  req.size = (uint32_t)size;
+
+  union
+  {
+    char buf[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  int numFds = 0;
+  int fds[ZYGOTE_MAX_FDS];
+  fds[numFds++] = cwdFd;
+  if(stage->inFd >= 0){
+    fds[numFds++] = stage->inFd;
+  }
+  if(stage->outFd >= 0){
+    fds[numFds++] = stage->outFd;
+  }
+  memset(&control, 0, sizeof(control));
+  msg.msg_control = control.buf;
+  msg.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+  memcpy(CMSG_DATA(c), fds, numFds * sizeof(int));
+
+  ZygoteLimits limits;
+  if(req.hasLimits){
+    for(int r = 0; r < RLIM_NLIMITS; r++){
+      getrlimit(r, &limits.limits[r]);
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    limits.umask = mask;
+  }
+
+  ZygoteReply reply;
+  ssize_t sent;
+  while((sent = sendmsg(zygoteFd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+  close(cwdFd);
+  if(sent != sizeof(req) || write_full(zygoteFd, strings, size) == -1
+     || (req.hasLimits && write_full(zygoteFd, &limits, sizeof(limits)) == -1)
+     || read_full(zygoteFd, &reply, sizeof(reply)) == -1){
+    // The zygote is gone, the caller falls back to another mode
+    int err = errno;
+    close(zygoteFd);
+    zygoteFd = -1;
+    free(strings);
+    errno = err;
+    return -1;
+  }
+  free(strings);
+  if(reply.err != 0){
+    if(reply.pid > 0){
+      // Collect the stage right away, it never became a command
+      waitpid(reply.pid, NULL, 0);
+    }
+    errno = reply.err;
+    return -1;
+  }
+  // A zygote that failed may not have kept it, it is sent again then
+  if(req.hasEnv){
+    envSent = 1;
+    sentGeneration = generation;
+  }
+  if(req.hasLimits){
+    sentLimitsGeneration = limitsGeneration;
+  }
+  return reply.pid;
+}
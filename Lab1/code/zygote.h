@@ -0,0 +1,19 @@
+#ifndef ZYGOTE_INC
+#define ZYGOTE_INC
+#include <sys/types.h>
+
+#include "spawn.h"
+
+/*
+ * Helper process forked when the shell starts, while its heap is still
+ * small. With LSH_SPAWN=zygote every stage is forked by the helper
+ * instead of the shell, so start latency doesn't grow with the shell.
+ * Requests go over a socketpair, the working directory and stdin/stdout
+ * of the stage as SCM_RIGHTS.
+ * The stages are cloned with CLONE_PARENT: they are children of the
+ * shell, which reaps them like any other stage.
+ */
+int zygote_start(void);
+int zygote_running(void);
+pid_t zygote_spawn(const char* path, char** argv, const SpawnStage* stage);
+#endif
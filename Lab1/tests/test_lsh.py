@@ -1,5 +1,5 @@
 from datetime import datetime
-from os import mkdir, setsid, killpg, getpgid
+from os import environ, mkdir, setsid, killpg, getpgid
 from pathlib import Path
 from signal import SIGINT
 from socket import gethostname
@@ -85,12 +85,15 @@ class TestLsh(unittest.TestCase):
         except FileNotFoundError:
             self.assertTrue(file.exists(), msg="Failed to detect output file")
 
-    def start_lsh(self, cwd: Path = None):
+    def start_lsh(self, cwd: Path = None, args: Optional[list] = None, spawn_mode: Optional[str] = None):
         """
-        Launches the lsh process, setting it up to run commands with optional custom working directory.
+        Launches the lsh process, setting it up to run commands with optional custom working directory,
+        command line arguments and LSH_SPAWN mode.
         """
         self.assertIsNone(self.lsh)
-        self.lsh = Popen(str(self.lsh_path), stdin=PIPE, stdout=PIPE, stderr=PIPE, cwd=cwd, preexec_fn=setsid)
+        env = dict(environ, LSH_SPAWN=spawn_mode) if spawn_mode else None
+        self.lsh = Popen([str(self.lsh_path)] + (args or []), stdin=PIPE, stdout=PIPE, stderr=PIPE, cwd=cwd,
+                         env=env, preexec_fn=setsid)
 
     def run_cmd(self, cmd: str):
         """
@@ -295,6 +298,31 @@ class TestLsh(unittest.TestCase):
 
         self.exit_with_eof()
 
+    def test_zygote(self):
+        """
+        Runs pipelines and background jobs with LSH_SPAWN=zygote, their signal dispositions must match the
+        vfork mode's and CTRL-C must still end the foreground command.
+        """
+        cmd = "echo hello world | grep hello | wc -w; grep -e SigIgn -e SigBlk /proc/self/status | cat\n" \
+              "grep SigIgn /proc/self/status > bg.txt &\nwait; cat bg.txt"
+        outputs = []
+        for mode in ["vfork", "zygote"]:
+            self.lsh = None
+            self.start_lsh(cwd=self.make_tmp_dir(), args=["-c", cmd], spawn_mode=mode)
+            out, err = self.lsh.communicate(timeout=3)
+            outputs.append(out.decode())
+        self.assertTrue(outputs[1].startswith("2\n"))
+        self.assertEqual(outputs[0], outputs[1], msg="Commands spawned by the zygote must start like vfork's")
+
+        self.lsh = None
+        self.start_lsh(spawn_mode="zygote")
+        self.run_cmd("sleep 60")
+        killpg(getpgid(self.lsh.pid), SIGINT)
+        sleep(1)
+        lsh_info = ProcessInfo(self.lsh.pid)
+        self.assertNotIn("sleep", [child.name() for child in lsh_info.children(recursive=True)])
+        self.exit_with_eof()
+
     def test_CTRL_C_with_fg_and_bg(self):
         """
         Tests lsh's response to a CTRL-C signal with concurrent foreground and background processes.
@@ -322,5 +350,256 @@ class TestLsh(unittest.TestCase):
         self.assertEqual(bg_pid, lsh_info.children()[0], msg="You should not have terminated the background process")
         self.exit_with_eof()
 
+    def test_hash(self):
+        """
+        Runs a command and checks that 'hash' lists its cached location, and that 'hash -r' clears the cache.
+        """
+        self.start_lsh()
+        self.run_cmd("date")
+        self.run_cmd("hash")
+        self.run_cmd("hash -r")
+        out = self.run_cmd_and_exit("hash")
+        self.assertIn("/date", out, msg="hash did not list the location of date")
+        self.assertIn("hash table empty", out, msg="hash -r did not clear the cache")
+
+    def test_long_pipeline(self):
+        """
+        Runs a pipeline with more than 20 commands. One with more pipes than ulimit -n allows must fail without
+        raising the limit.
+        """
+        self.start_lsh()
+        out = self.run_cmd_and_exit("echo ananab | " + " | ".join(["cat"] * 40) + " | rev", check_for_zombies=True)
+        self.assertIn("banana", out)
+
+        self.lsh = None
+        self.start_lsh(args=["-c", "ulimit -n 64; echo ananab | " + " | ".join(["cat"] * 40) + " | rev; ulimit -n"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertIn("Too many stages: 42 stages", out.decode())
+        self.assertNotIn("banana", out.decode())
+        self.assertTrue(out.decode().endswith("\n64\n"))
+
+    def test_long_line(self):
+        """
+        Runs a command line that is longer than 256 characters and has more than 50 arguments.
+        """
+        self.start_lsh()
+        words = " ".join(f"word{i}" for i in range(500))
+        out = self.run_cmd_and_exit(f"echo {words} | wc -w")
+        self.assertIn("500", out)
+
+    def test_cat_and_tee(self):
+        """
+        Runs the cat and tee builtins in a pipeline and with redirections, tee -a must append.
+        """
+        cwd = self.make_tmp_dir()
+        self.start_lsh(cwd)
+        self.run_cmd("echo hello | tee hello.txt | cat")
+        self.run_cmd("echo first > append.txt")
+        self.run_cmd("echo hello | tee -a append.txt | cat")
+        out = self.run_cmd_and_exit("cat < hello.txt > copy.txt\ncat copy.txt | rev", check_for_zombies=True)
+        self.check_test_txt(cwd.joinpath("hello.txt"))
+        self.check_test_txt(cwd.joinpath("copy.txt"))
+        self.assertEqual("first\nhello\n", cwd.joinpath("append.txt").read_text())
+        self.assertIn("hello", out)
+        self.assertIn("olleh", out)
+
+    def test_command_option(self):
+        """
+        Runs two lines with 'lsh -c' and checks that lsh exits with the status of the last command, also through
+        'exit', and with the status given to 'exit'.
+        """
+        self.start_lsh(args=["-c", "echo ananab | rev\nfalse"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertIn("banana", out.decode())
+        self.assertEqual(1, self.lsh.returncode, msg="lsh -c should return the status of the last command")
+        for cmd, status in [("false; exit; true", 1), ("exit 3", 3)]:
+            self.lsh = None
+            self.start_lsh(args=["-c", cmd])
+            self.lsh.communicate(timeout=3)
+            self.assertEqual(status, self.lsh.returncode, msg=f"lsh -c '{cmd}' should return {status}")
+
+    def test_time(self):
+        """
+        Runs a pipeline with the 'time' prefix and checks the per-stage report and the totals on stderr.
+        """
+        self.start_lsh(args=["-c", "time echo ananab | rev"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertIn("banana", out.decode())
+        self.assertIn("rev", err.decode(), msg="time did not report the rev stage")
+        self.assertIn("real\t0m", err.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_script(self):
+        """
+        Runs a script file given as argument to lsh.
+        """
+        cwd = self.make_tmp_dir()
+        with open(cwd.joinpath("script.lsh"), "w") as f:
+            f.write("echo hello > hello.txt\ncd /\nls\n")
+        self.start_lsh(cwd, args=["script.lsh"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual(0, self.lsh.returncode)
+        self.check_test_txt(cwd.joinpath("hello.txt"))
+        self.assertIn("tmp", out.decode(), msg="Did not find the output of ls after cd /")
+
+    def test_jobs_and_wait(self):
+        """
+        Starts two background jobs, lists them with 'jobs' and waits for one of them with 'wait'. A job whose last
+        stage couldn't be started must have status 127.
+        """
+        self.start_lsh()
+        self.run_cmd("sleep 3 &")
+        self.run_cmd("sleep 60 &")
+        self.run_cmd("jobs")
+        self.run_cmd("wait %1")
+        lsh_info = ProcessInfo(self.lsh.pid)
+        self.assertEqual(1, len(lsh_info.children()), msg="wait %1 returned before job 1 finished")
+        self.check_for_zombies()
+        out = self.exit_with_eof()
+        self.assertIn("[1]  Running                 sleep 3 &", out)
+        self.assertIn("[2]  Running                 sleep 60 &", out)
+
+        self.lsh = None
+        self.start_lsh(args=["-c", "false | no_such_command &\nwait %1; echo $?"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertTrue(out.decode().endswith("\n127\n"), msg=out.decode())
+
+    def test_builtins(self):
+        """
+        Runs echo, printf and kill in the shell, they must not leave any child behind.
+        """
+        self.start_lsh()
+        self.run_cmd("sleep 60 &")
+        self.run_cmd("kill %1")
+        self.run_cmd("echo in the shell")
+        self.run_cmd("printf %s-%d\\n a 1 b 2")
+        self.run_cmd("echo piped | rev")
+        sleep(0.5)
+        lsh_info = ProcessInfo(self.lsh.pid)
+        self.assertEqual(0, len(lsh_info.children()), msg="kill %1 did not terminate the job")
+        out = self.exit_with_eof()
+        self.assertIn("in the shell", out)
+        self.assertIn("a-1\nb-2", out)
+        self.assertIn("depip", out)
+
+    def test_parallel(self):
+        """
+        Runs a command per input with parallel and checks the outputs and the throughput report.
+        """
+        self.start_lsh(args=["-c", "parallel -j 2 echo x{}y ::: 1 2 3"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual(["x1y", "x2y", "x3y"], sorted(out.decode().split()))
+        self.assertIn("3 jobs, 0 failed, 2 at a time", err.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_command_lists(self):
+        """
+        Runs commands joined by ';', '&&' and '||' on one line, '&&' and '||' must short-circuit.
+        """
+        self.start_lsh(args=["-c", "false && echo skipped || echo first; true || echo skipped && echo second"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("first\nsecond\n", out.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_command_substitution(self):
+        """
+        Splices the output of $(...) into the arguments of the outer command, nested and through a pipeline.
+        """
+        self.start_lsh(args=["-c", "echo [$(echo a b | rev)] $(echo $(echo nested))"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("[b a] nested\n", out.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_compound_commands(self):
+        """
+        Runs for, while and if and calls a function across lines, loops must honour break and continue.
+        """
+        self.start_lsh(args=["-c", "greet() {\n  echo hi $1 $#\n  return 3\n}\n"
+                                   "for i in a b c d; do if [ $i = b ]; then continue; elif [ $i = d ]; then break; fi\n"
+                                   "  greet $i x\ndone\nwhile false; do echo never; done; greet z; echo $?"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("hi a 2\nhi c 2\nhi z 1\n3\n", out.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_wildcards(self):
+        """
+        Expands *, ? and [...] to the sorted matching paths, a pattern without a match or escaped with \\ stays as it is.
+        """
+        tmp_dir = self.make_tmp_dir()
+        for name in ["b.txt", "a.txt", ".hidden.txt", "c.log", "sub/x.c", "sub/y.h"]:
+            tmp_dir.joinpath(name).parent.mkdir(exist_ok=True)
+            tmp_dir.joinpath(name).touch()
+        self.start_lsh(cwd=tmp_dir, args=["-c", "echo *.txt s?b/*.[ch] none* \\*.txt; touch d.txt; echo *.txt"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("a.txt b.txt sub/x.c sub/y.h none* *.txt\na.txt b.txt d.txt\n", out.decode())
+
+    def test_export(self):
+        """
+        Only exported variables reach commands, NAME=value in front of a command exports it for that command.
+        'export NAME' of an unset NAME exports it once it is set.
+        """
+        self.start_lsh(args=["-c", "A=1; export B=2; printenv A B; A=3 printenv A; printenv A; unset B; printenv B; echo $A"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("2\n3\n1\n", out.decode())
+
+        self.lsh = None
+        self.start_lsh(args=["-c", "export C; printenv C || echo unset; C=4; printenv C"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("unset\n4\n", out.decode())
+
+    def test_history(self):
+        """
+        Lists the lines of the history file with 'history', with a pattern only the lines that contain it. The index
+        is left next to the file for the next shell, which must also find the lines appended after it was built.
+        """
+        tmp_dir = self.make_tmp_dir()
+        with open(tmp_dir.joinpath("history"), "w") as f:
+            f.write("echo a\nssh host1\nls\nssh host2\n")
+        self.start_lsh(cwd=tmp_dir, args=["-c", "export LSH_HISTFILE=history; history ssh; history none || echo none"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("    2  ssh host1\n    4  ssh host2\nnone\n", out.decode())
+        self.assertTrue(tmp_dir.joinpath("history.idx").exists())
+        with open(tmp_dir.joinpath("history"), "a") as f:
+            f.write("ssh host3\n")
+        self.lsh = None
+        self.start_lsh(cwd=tmp_dir, args=["-c", "export LSH_HISTFILE=history; history host"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("    2  ssh host1\n    4  ssh host2\n    5  ssh host3\n", out.decode())
+
+    def test_pipesize(self):
+        """
+        Sets the capacity of the pipes between stages with 'set pipesize=' and a 'pipesize' prefix.
+        """
+        tmp_dir = self.make_tmp_dir()
+        with open(tmp_dir.joinpath("size.py"), "w") as f:
+            f.write("import fcntl\nprint(fcntl.fcntl(1, fcntl.F_GETPIPE_SZ))\n")
+        self.start_lsh(cwd=tmp_dir,
+                       args=["-c", "set pipesize=256k; python3 size.py | cat; pipesize 128k python3 size.py | cat"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("262144\n131072\n", out.decode())
+        self.assertEqual(0, self.lsh.returncode)
+
+    def test_ulimit(self):
+        """
+        Lowers a limit with ulimit, it must hold for the shell and the commands it starts, also those the zygote
+        started after the zygote itself.
+        """
+        for mode in ["posix", "zygote"]:
+            self.lsh = None
+            self.start_lsh(args=["-c", "ulimit -n 64; ulimit -n; ulimit -Hn; grep files /proc/self/limits"],
+                           spawn_mode=mode)
+            out, err = self.lsh.communicate(timeout=3)
+            self.assertEqual(["64", "64", "Max", "open", "files", "64", "64", "files"], out.decode().split(), msg=mode)
+
+    def test_placement(self):
+        """
+        Switches the CPU placement of pipeline stages with 'set', an unknown NUMA node must be refused.
+        """
+        self.start_lsh(args=["-c", "set placement=spread numanode=0; set numanode=100000; echo a b | rev; set"])
+        out, err = self.lsh.communicate(timeout=3)
+        self.assertEqual("set: 100000: no such NUMA node\nb a\npipesize=default\nplacement=spread\nnumanode=0\n"
+                         "bgcpu=max\nbgmemory=max\nbgio=default\n",
+                         out.decode())
+
 if __name__ == "__main__":
     unittest.main(testRunner=HTMLTestRunner(report_name="test-lsh", open_in_browser=True, description="Lab 1 tests"))
\ No newline at end of file